@@ -0,0 +1,288 @@
+/*
+ * Copyright (C) 2017 Sergey Senozhatsky
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "config.h"
+#include <options.h>
+#include <bootstrap.h>
+
+/*
+ * Bootstrap arena.
+ *
+ * Allocations made before libmtrace is initialized (dlsym(), early
+ * constructors of other modules) cannot go to glibc: we don't know where
+ * glibc is yet. They are served from chunks mapped with a raw mmap
+ * syscall, our own mmap() is not usable either. Chunks grow
+ * geometrically, so there are few of them.
+ *
+ * Blocks are power of two regions of a chunk, with a header right
+ * before the returned pointer. Freed regions go to per size class free
+ * lists and are handed out again while we bootstrap. Once initialized
+ * no new blocks are made, but bootstrap blocks may still be freed or
+ * reallocated by the application: free() and realloc() check
+ * bootstrap_owns() and never pass them to glibc.
+ */
+
+#define BOOTSTRAP_CHUNK_SZ	(256 * 1024)
+#define BOOTSTRAP_MAX_CHUNKS	32
+#define BOOTSTRAP_MIN_CLASS	5
+#define BOOTSTRAP_MAX_CLASS	((int)sizeof(long) * 8 - 1)
+#define BOOTSTRAP_HDR_SZ	16
+
+struct bootstrap_hdr {
+	unsigned int	class;
+	/* from the start of the region to the returned pointer */
+	unsigned int	offset;
+	size_t		size;
+};
+
+struct bootstrap_chunk {
+	unsigned long	start;
+	unsigned long	end;
+};
+
+unsigned long bootstrap_lo = ~0UL;
+unsigned long bootstrap_hi;
+
+static struct bootstrap_chunk chunks[BOOTSTRAP_MAX_CHUNKS];
+static int nr_chunks;
+
+/* bump pointer of the last chunk */
+static unsigned long cur;
+static unsigned long cur_end;
+
+static void *free_lists[BOOTSTRAP_MAX_CLASS + 1];
+
+static char bootstrap_lock;
+
+static void lock(void)
+{
+	while (__atomic_test_and_set(&bootstrap_lock, __ATOMIC_ACQUIRE))
+		;
+}
+
+static void unlock(void)
+{
+	__atomic_clear(&bootstrap_lock, __ATOMIC_RELEASE);
+}
+
+static void *raw_mmap(size_t len)
+{
+#ifdef SYS_mmap2
+	return (void *)syscall(SYS_mmap2, NULL, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#else
+	return (void *)syscall(SYS_mmap, NULL, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#endif
+}
+
+static int size_class(size_t size)
+{
+	int class = BOOTSTRAP_MIN_CLASS;
+
+	while (class < BOOTSTRAP_MAX_CLASS && (1UL << class) < size)
+		class++;
+	return class;
+}
+
+/*
+ * Called with the lock held. The tail of the previous chunk is given up,
+ * bootstrap doesn't last long enough for it to matter.
+ */
+static int chunk_add(size_t need)
+{
+	size_t len = (size_t)BOOTSTRAP_CHUNK_SZ << (nr_chunks < 8 ?
+			nr_chunks : 8);
+	void *mem;
+
+	if (nr_chunks == BOOTSTRAP_MAX_CHUNKS)
+		return -1;
+
+	if (len < need)
+		len = ALIGN(need, (size_t)DEFAULT_PAGE_SIZE);
+
+	mem = raw_mmap(len);
+	if (mem == MAP_FAILED)
+		return -1;
+
+	cur = (unsigned long)mem;
+	cur_end = cur + len;
+
+	chunks[nr_chunks].start = cur;
+	chunks[nr_chunks].end = cur_end;
+	__atomic_store_n(&nr_chunks, nr_chunks + 1, __ATOMIC_RELEASE);
+
+	if (cur < bootstrap_lo)
+		__atomic_store_n(&bootstrap_lo, cur, __ATOMIC_RELEASE);
+	if (cur_end > bootstrap_hi)
+		__atomic_store_n(&bootstrap_hi, cur_end, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static unsigned long region_get(int class)
+{
+	size_t len = 1UL << class;
+	unsigned long region;
+
+	if (free_lists[class]) {
+		region = (unsigned long)free_lists[class];
+		free_lists[class] = *(void **)free_lists[class];
+		/* calloc() relies on zeroed memory, fresh chunks are */
+		memset((void *)region, 0x00, len);
+		return region;
+	}
+
+	if (cur_end - cur < len && chunk_add(len))
+		return 0;
+
+	region = cur;
+	cur += len;
+	return region;
+}
+
+static struct bootstrap_hdr *hdr(void *ptr)
+{
+	return (struct bootstrap_hdr *)((char *)ptr - BOOTSTRAP_HDR_SZ);
+}
+
+void *bootstrap_alloc(size_t size, size_t alignment)
+{
+	unsigned long region, ptr;
+	struct bootstrap_hdr *h;
+	size_t need;
+	int class;
+
+	if (alignment < BOOTSTRAP_HDR_SZ)
+		alignment = BOOTSTRAP_HDR_SZ;
+
+	/* memalign() rounds odd alignments up, so do we */
+	while (alignment & (alignment - 1))
+		alignment += alignment & -alignment;
+
+	/* regions are BOOTSTRAP_HDR_SZ aligned */
+	need = size + alignment;
+	if (need < size)
+		return NULL;
+
+	class = size_class(need);
+
+	lock();
+	region = region_get(class);
+	unlock();
+
+	if (!region) {
+		fprintf(stderr, "ERROR: unable to allocate %zu bytes "
+				"while bootstrapping\n", size);
+		return NULL;
+	}
+
+	ptr = ALIGN(region + BOOTSTRAP_HDR_SZ, alignment);
+	h = hdr((void *)ptr);
+	h->class = class;
+	h->offset = ptr - region;
+	h->size = size;
+	return (void *)ptr;
+}
+
+/*
+ * Held across fork(), the child gets the chunks in a consistent state.
+ */
+void bootstrap_fork_prepare(void)
+{
+	lock();
+}
+
+void bootstrap_fork_parent(void)
+{
+	unlock();
+}
+
+void bootstrap_fork_child(void)
+{
+	unlock();
+}
+
+int __bootstrap_owns(unsigned long addr)
+{
+	int i, nr = __atomic_load_n(&nr_chunks, __ATOMIC_ACQUIRE);
+
+	for (i = 0; i < nr; i++) {
+		if (addr >= chunks[i].start && addr < chunks[i].end)
+			return 1;
+	}
+	return 0;
+}
+
+void bootstrap_free(void *ptr)
+{
+	struct bootstrap_hdr *h;
+	void **region;
+
+	if (!bootstrap_owns(ptr))
+		return;
+
+	h = hdr(ptr);
+	region = (void **)((char *)ptr - h->offset);
+
+	lock();
+	*region = free_lists[h->class];
+	free_lists[h->class] = region;
+	unlock();
+}
+
+size_t bootstrap_usable_size(void *ptr)
+{
+	if (!bootstrap_owns(ptr))
+		return 0;
+	return (1UL << hdr(ptr)->class) - hdr(ptr)->offset;
+}
+
+void *bootstrap_realloc(void *ptr, size_t size)
+{
+	size_t old;
+	void *ret;
+
+	if (!ptr)
+		return bootstrap_alloc(size, MIN_ALIGNMENT);
+
+	old = hdr(ptr)->size;
+	if (size <= bootstrap_usable_size(ptr)) {
+		hdr(ptr)->size = size;
+		return ptr;
+	}
+
+	ret = bootstrap_alloc(size, MIN_ALIGNMENT);
+	if (!ret)
+		return NULL;
+
+	memcpy(ret, ptr, old);
+	bootstrap_free(ptr);
+	return ret;
+}
@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2017 Sergey Senozhatsky
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "config.h"
+#include <output.h>
+#include <sampler.h>
+#include <profile.h>
+#include <cold.h>
+
+/*
+ * Cold memory sampler.
+ *
+ * Every `interval' seconds the sampler thread takes the large live
+ * blocks from the pointer table (see profile.c) and checks their pages:
+ * mincore() tells which pages are resident, the soft-dirty bits in
+ * /proc/self/pagemap tell which pages were written since the previous
+ * sample. Soft-dirty bits are cleared after every sample by writing 4
+ * to /proc/self/clear_refs. The result is reported per allocating stack:
+ *	[k:SEQ:SEC.USEC]
+ *	[K:ID:BLOCKS:BYTES:RESIDENT_BYTES:DIRTY_BYTES]
+ *	...
+ */
+
+#define COLD_DEF_INTERVAL	10
+#define COLD_MAX_BLOCKS		4096
+#define COLD_VEC_PAGES		4096
+
+#define PM_SOFT_DIRTY		(1ULL << 55)
+#define PM_SWAP			(1ULL << 62)
+#define PM_PRESENT		(1ULL << 63)
+
+static struct options *cold_opts;
+static size_t cold_min_size;
+static unsigned long page_size;
+static int pagemap_fd = -1;
+static int clear_refs_fd = -1;
+static unsigned long cold_seq;
+
+/* only the sampler thread uses these */
+static struct live_block blocks[COLD_MAX_BLOCKS];
+static unsigned char vec[COLD_VEC_PAGES];
+static uint64_t pagemap[COLD_VEC_PAGES];
+
+static int block_cmp(const void *a, const void *b)
+{
+	const struct live_block *x = a, *y = b;
+
+	if (x->stack_id == y->stack_id)
+		return 0;
+	return x->stack_id < y->stack_id ? -1 : 1;
+}
+
+/*
+ * Returns -1 if the range is not mapped anymore.
+ */
+static int count_pages(unsigned long start, unsigned long nr_pages,
+		       unsigned long *resident, unsigned long *dirty)
+{
+	unsigned long done = 0;
+
+	while (done < nr_pages) {
+		unsigned long addr = start + done * page_size;
+		unsigned long nr = nr_pages - done;
+		unsigned long i;
+
+		if (nr > COLD_VEC_PAGES)
+			nr = COLD_VEC_PAGES;
+
+		if (mincore((void *)addr, nr * page_size, vec))
+			return -1;
+
+		for (i = 0; i < nr; i++)
+			*resident += vec[i] & 1;
+
+		if (pagemap_fd >= 0 &&
+				pread(pagemap_fd, pagemap,
+					nr * sizeof(pagemap[0]),
+					(addr / page_size) * sizeof(pagemap[0])) ==
+				(ssize_t)(nr * sizeof(pagemap[0]))) {
+			for (i = 0; i < nr; i++) {
+				uint64_t pm = pagemap[i];
+
+				if ((pm & (PM_PRESENT | PM_SWAP)) &&
+						(pm & PM_SOFT_DIRTY))
+					(*dirty)++;
+			}
+		}
+
+		done += nr;
+	}
+
+	return 0;
+}
+
+static void clear_soft_dirty(void)
+{
+	if (clear_refs_fd < 0)
+		return;
+
+	if (pwrite(clear_refs_fd, "4", 1, 0) != 1) {
+		close(clear_refs_fd);
+		clear_refs_fd = -1;
+	}
+}
+
+static void output_stack(unsigned long id, unsigned long nr,
+			 unsigned long bytes, unsigned long resident,
+			 unsigned long dirty)
+{
+	output("[K:%lu:%lu:%lu:%lu:%lu]\n", id, nr, bytes,
+			resident * page_size, dirty * page_size);
+	output_commit(cold_opts);
+}
+
+static void cold_sample(void)
+{
+	unsigned long id = 0, nr = 0, bytes = 0, resident = 0, dirty = 0;
+	struct timeval tv;
+	int i, nr_blocks;
+
+	nr_blocks = profile_live_blocks(cold_min_size, blocks,
+			COLD_MAX_BLOCKS);
+	qsort(blocks, nr_blocks, sizeof(blocks[0]), block_cmp);
+
+	gettimeofday(&tv, NULL);
+	output("[k:%lu:%lu.%06d]\n", ++cold_seq,
+			(unsigned long)tv.tv_sec,
+			(int)tv.tv_usec);
+	output_commit(cold_opts);
+
+	for (i = 0; i < nr_blocks; i++) {
+		struct live_block *b = &blocks[i];
+		unsigned long start = b->ptr & ~(page_size - 1);
+		unsigned long end = ALIGN(b->ptr + b->size, page_size);
+		unsigned long r = 0, d = 0;
+
+		if (count_pages(start, (end - start) / page_size, &r, &d))
+			continue;
+
+		if (nr && b->stack_id != id) {
+			output_stack(id, nr, bytes, resident, dirty);
+			nr = bytes = resident = dirty = 0;
+		}
+
+		id = b->stack_id;
+		nr++;
+		bytes += b->size;
+		resident += r;
+		dirty += d;
+	}
+
+	if (nr)
+		output_stack(id, nr, bytes, resident, dirty);
+
+	clear_soft_dirty();
+}
+
+/*
+ * MTRACE_COLD_MIN_SIZE=<num> enables the sampler for blocks of at least
+ * <num> bytes, MTRACE_COLD_INTERVAL=SECONDS, 10 by default. Needs the
+ * pointer table, the caller turns it on.
+ */
+int cold_setup(struct options *opts, size_t min_size)
+{
+	unsigned long interval = COLD_DEF_INTERVAL;
+
+	if (getenv("MTRACE_COLD_INTERVAL"))
+		interval = strtoul(getenv("MTRACE_COLD_INTERVAL"), NULL, 10);
+	if (!interval)
+		return 0;
+
+	cold_opts = opts;
+	cold_min_size = min_size;
+	page_size = sysconf(_SC_PAGESIZE);
+
+	pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+	clear_refs_fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+	if (pagemap_fd < 0 || clear_refs_fd < 0)
+		fprintf(stderr, "WARNING: no soft-dirty tracking, "
+				"dirty bytes are not reported\n");
+	clear_soft_dirty();
+
+	return sampler_register(cold_sample, interval * 1000);
+}
+
+/*
+ * In the child of a fork(). The inherited descriptors still point at
+ * the parent's /proc/PID, writing clear_refs through them would reset
+ * the parent's soft-dirty bits.
+ */
+void cold_fork_child(void)
+{
+	if (!cold_opts)
+		return;
+
+	if (pagemap_fd >= 0)
+		close(pagemap_fd);
+	if (clear_refs_fd >= 0)
+		close(clear_refs_fd);
+
+	pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+	clear_refs_fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+	clear_soft_dirty();
+}
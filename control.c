@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2017 Sergey Senozhatsky
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "config.h"
+#include <control.h>
+
+/*
+ * Runtime control channel.
+ *
+ * The control signal only marks a command as pending; we can't do
+ * much in a signal handler. The next intercepted call sees a non-zero
+ * mtrace_ctl, reads the control file and feeds every line to the
+ * handler. The file format is one command per line:
+ *
+ *	COMMAND [ARG]
+ */
+
+#define CTL_FILE_SZ	4096
+
+volatile int mtrace_ctl;
+
+static char ctl_path[PATH_MAX];
+static control_handler_t ctl_handler;
+static pthread_mutex_t ctl_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void control_signal(int sig __attribute__((unused)))
+{
+	__atomic_or_fetch(&mtrace_ctl, CTL_PENDING, __ATOMIC_RELAXED);
+}
+
+int control_init(const char *path, int sig, control_handler_t handler)
+{
+	struct sigaction sa;
+
+	if (strlen(path) >= sizeof(ctl_path)) {
+		fprintf(stderr, "ERROR: control file path is too long\n");
+		return -EINVAL;
+	}
+
+	strcpy(ctl_path, path);
+	ctl_handler = handler;
+
+	memset(&sa, 0x00, sizeof(sa));
+	sa.sa_handler = control_signal;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+
+	if (sigaction(sig, &sa, NULL)) {
+		fprintf(stderr, "ERROR: unable to install control signal "
+				"handler: %s\n", strerror(errno));
+		return -errno;
+	}
+	return 0;
+}
+
+static void snapshot_signal(int sig __attribute__((unused)))
+{
+	__atomic_or_fetch(&mtrace_ctl, CTL_SNAPSHOT, __ATOMIC_RELAXED);
+}
+
+/*
+ * Heap snapshots have their own signal, they need no control file.
+ */
+int control_snapshot_init(int sig)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0x00, sizeof(sa));
+	sa.sa_handler = snapshot_signal;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+
+	if (sigaction(sig, &sa, NULL)) {
+		fprintf(stderr, "ERROR: unable to install snapshot signal "
+				"handler: %s\n", strerror(errno));
+		return -errno;
+	}
+	return 0;
+}
+
+void control_enable(int enable)
+{
+	if (enable)
+		__atomic_and_fetch(&mtrace_ctl, ~CTL_DISABLED,
+				__ATOMIC_RELAXED);
+	else
+		__atomic_or_fetch(&mtrace_ctl, CTL_DISABLED,
+				__ATOMIC_RELAXED);
+}
+
+static void process_line(char *line)
+{
+	char *arg;
+
+	while (isspace(*line))
+		line++;
+	if (*line == 0x00 || *line == '#')
+		return;
+
+	arg = line;
+	while (*arg && !isspace(*arg))
+		arg++;
+	if (*arg) {
+		*arg++ = 0x00;
+		while (isspace(*arg))
+			arg++;
+	}
+
+	if (ctl_handler(line, arg))
+		fprintf(stderr, "ERROR: unknown control command: %s %s\n",
+				line, arg);
+}
+
+/*
+ * Must be called outside of event frames, with tracing disabled.
+ */
+void control_process(void)
+{
+	char buf[CTL_FILE_SZ];
+	char *line, *save;
+	ssize_t num_read;
+	int fd;
+
+	/* someone else is handling it */
+	if (pthread_mutex_trylock(&ctl_lock))
+		return;
+
+	__atomic_and_fetch(&mtrace_ctl, ~CTL_PENDING, __ATOMIC_RELAXED);
+
+	fd = open(ctl_path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		goto out;
+
+	do {
+		num_read = read(fd, buf, sizeof(buf) - 1);
+	} while (num_read < 0 && errno == EINTR);
+	close(fd);
+
+	if (num_read <= 0)
+		goto out;
+	buf[num_read] = 0x00;
+
+	for (line = strtok_r(buf, "\n", &save); line;
+			line = strtok_r(NULL, "\n", &save)) {
+		char *end = line + strlen(line);
+
+		while (end > line && isspace(end[-1]))
+			*--end = 0x00;
+		process_line(line);
+	}
+
+out:
+	pthread_mutex_unlock(&ctl_lock);
+}
+
+/*
+ * Held across fork(), a command is never cut off half way in the child.
+ */
+void control_fork_prepare(void)
+{
+	pthread_mutex_lock(&ctl_lock);
+}
+
+void control_fork_parent(void)
+{
+	pthread_mutex_unlock(&ctl_lock);
+}
+
+void control_fork_child(void)
+{
+	pthread_mutex_unlock(&ctl_lock);
+}
@@ -0,0 +1,343 @@
+/*
+ * Copyright (C) 2017 Sergey Senozhatsky
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "config.h"
+#include <output.h>
+#include <meta.h>
+#include <sampler.h>
+#include <counters.h>
+
+/*
+ * Counters reporting mode.
+ *
+ * Every thread gets a block of per event type counters (calls and
+ * bytes). Interposers bump them before anything else and go straight
+ * to glibc: no output, no timestamps, no locks. Blocks are linked into
+ * a list that only grows at the head; blocks of exited threads are
+ * handed over to new threads, so the list is as long as the maximum
+ * number of threads that ever ran at once.
+ *
+ * The sampler thread writes the deltas since the previous dump every
+ * `interval' seconds, and once more at exit:
+ *	[c:SEQ:SEC.USEC:ELAPSED_MS]
+ *	[C:TID:EVENT:CALLS:BYTES]
+ *	...
+ * Calls made by threads during their exit, after the block was handed
+ * back, are accounted to TID 0.
+ *
+ * Blocks also keep request size histograms (MTRACE_SIZE_HISTOGRAM),
+ * which are never reset. They are merged over all blocks and written
+ * at exit or on request, one line per allocation class and histogram:
+ *	[z:SEQ:SEC.USEC]
+ *	[Z:CLASS:log2:IDX=COUNT,...]
+ *	[Z:CLASS:fine:IDX=COUNT,...]
+ */
+
+#define COUNTERS_DEF_INTERVAL	1
+
+__thread struct counters_block *counters_tls;
+
+static struct counters_block *blocks;
+static struct counters_block exited_block;
+
+static pthread_key_t counters_key;
+static int counters_ready;
+
+static struct options *counters_opts;
+static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long dump_seq;
+static unsigned long last_dump_ms;
+static unsigned long hist_seq;
+
+static const char *hist_names[HIST_MAX] = {
+	[HIST_MALLOC]	= "malloc",
+	[HIST_CALLOC]	= "calloc",
+	[HIST_REALLOC]	= "realloc",
+	[HIST_MEMALIGN]	= "memalign",
+	[HIST_MMAP]	= "mmap",
+	[HIST_NEW]	= "new",
+};
+
+static unsigned long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL;
+}
+
+static void block_push(struct counters_block *cb)
+{
+	struct counters_block *head = __atomic_load_n(&blocks,
+			__ATOMIC_ACQUIRE);
+
+	do {
+		cb->next = head;
+	} while (!__atomic_compare_exchange_n(&blocks, &head, cb, 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+}
+
+static void counters_release(void *data)
+{
+	struct counters_block *cb = data;
+
+	/* late frees of this thread must not touch a recycled block */
+	counters_tls = &exited_block;
+	__atomic_store_n(&cb->tid, -cb->tid, __ATOMIC_RELEASE);
+}
+
+/*
+ * Called on the first event of a thread, with tracing disabled.
+ */
+struct counters_block *counters_register(void)
+{
+	struct counters_block *cb;
+	int tid = output_tid();
+
+	if (!counters_ready)
+		return NULL;
+
+	/* blocks of exited threads have negative tids */
+	for (cb = __atomic_load_n(&blocks, __ATOMIC_ACQUIRE); cb;
+			cb = cb->next) {
+		int old = __atomic_load_n(&cb->tid, __ATOMIC_ACQUIRE);
+
+		if (old < 0 && __atomic_compare_exchange_n(&cb->tid, &old,
+					tid, 0, __ATOMIC_ACQ_REL,
+					__ATOMIC_ACQUIRE))
+			goto out;
+	}
+
+	cb = meta_alloc(sizeof(*cb));
+	if (!cb)
+		return NULL;
+
+	cb->tid = tid;
+	block_push(cb);
+
+out:
+	counters_tls = cb;
+	pthread_setspecific(counters_key, cb);
+	return cb;
+}
+
+struct counters_block *counters_list(void)
+{
+	return __atomic_load_n(&blocks, __ATOMIC_ACQUIRE);
+}
+
+static void dump_block(struct options *opts, struct counters_block *cb)
+{
+	int tid = __atomic_load_n(&cb->tid, __ATOMIC_ACQUIRE);
+	int type;
+
+	if (tid < 0)
+		tid = -tid;
+
+	for (type = 0; type < EVENT_MAX; type++) {
+		unsigned long calls, bytes;
+
+		calls = __atomic_load_n(&cb->calls[type], __ATOMIC_RELAXED);
+		bytes = __atomic_load_n(&cb->bytes[type], __ATOMIC_RELAXED);
+		if (calls == cb->last_calls[type])
+			continue;
+
+		output("[C:%d:%s:%lu:%lu]\n", tid,
+				event_names[type].human_name,
+				calls - cb->last_calls[type],
+				bytes - cb->last_bytes[type]);
+		output_commit(opts);
+
+		cb->last_calls[type] = calls;
+		cb->last_bytes[type] = bytes;
+	}
+}
+
+void counters_dump(struct options *opts)
+{
+	struct counters_block *cb;
+	struct timeval tv;
+	unsigned long now;
+
+	pthread_mutex_lock(&dump_lock);
+
+	now = now_ms();
+	gettimeofday(&tv, NULL);
+	output("[c:%lu:%lu.%06d:%lu]\n", ++dump_seq,
+			(unsigned long)tv.tv_sec,
+			(int)tv.tv_usec,
+			now - last_dump_ms);
+	output_commit(opts);
+	last_dump_ms = now;
+
+	for (cb = __atomic_load_n(&blocks, __ATOMIC_ACQUIRE); cb;
+			cb = cb->next)
+		dump_block(opts, cb);
+
+	pthread_mutex_unlock(&dump_lock);
+}
+
+static void dump_hist(struct options *opts, const char *class,
+		      const char *kind, unsigned long *hist, int nr)
+{
+	int i, first = 1;
+
+	output("[Z:%s:%s:", class, kind);
+	for (i = 0; i < nr; i++) {
+		if (!hist[i])
+			continue;
+
+		output("%s%d=%lu", first ? "" : ",", i, hist[i]);
+		first = 0;
+	}
+	output("]\n");
+	output_commit(opts);
+}
+
+void counters_hist_dump(struct options *opts)
+{
+	static unsigned long log2[HIST_MAX][HIST_LOG2_BUCKETS];
+	static unsigned long fine[HIST_MAX][HIST_FINE_BUCKETS];
+	struct counters_block *cb;
+	struct timeval tv;
+	unsigned int i;
+	int class;
+
+	pthread_mutex_lock(&dump_lock);
+
+	memset(log2, 0x00, sizeof(log2));
+	memset(fine, 0x00, sizeof(fine));
+
+	for (cb = __atomic_load_n(&blocks, __ATOMIC_ACQUIRE); cb;
+			cb = cb->next) {
+		for (class = 0; class < HIST_MAX; class++) {
+			for (i = 0; i < HIST_LOG2_BUCKETS; i++)
+				log2[class][i] += __atomic_load_n(
+						&cb->hist_log2[class][i],
+						__ATOMIC_RELAXED);
+			for (i = 0; i < HIST_FINE_BUCKETS; i++)
+				fine[class][i] += __atomic_load_n(
+						&cb->hist_fine[class][i],
+						__ATOMIC_RELAXED);
+		}
+	}
+
+	gettimeofday(&tv, NULL);
+	output("[z:%lu:%lu.%06d]\n", ++hist_seq,
+			(unsigned long)tv.tv_sec,
+			(int)tv.tv_usec);
+	output_commit(opts);
+
+	for (class = 0; class < HIST_MAX; class++) {
+		dump_hist(opts, hist_names[class], "log2",
+				log2[class], HIST_LOG2_BUCKETS);
+		dump_hist(opts, hist_names[class], "fine",
+				fine[class], HIST_FINE_BUCKETS);
+	}
+
+	pthread_mutex_unlock(&dump_lock);
+}
+
+static void counters_sample(void)
+{
+	counters_dump(counters_opts);
+}
+
+/*
+ * MTRACE_COUNTERS_INTERVAL=SECONDS, 0 dumps the counters only at exit.
+ * The sampler job is registered only if counters mode was requested at
+ * start up, a runtime mode switch gets dumps on "flush" and at exit.
+ */
+int counters_setup(struct options *opts)
+{
+	unsigned long interval = COUNTERS_DEF_INTERVAL;
+
+	if (pthread_key_create(&counters_key, counters_release)) {
+		fprintf(stderr, "ERROR: unable to create counters key\n");
+		return -1;
+	}
+
+	counters_opts = opts;
+	last_dump_ms = now_ms();
+	block_push(&exited_block);
+	counters_ready = 1;
+
+	if (!(opts->flags & OPTS_COUNTERS_MODE))
+		return 0;
+
+	if (getenv("MTRACE_COUNTERS_INTERVAL"))
+		interval = strtoul(getenv("MTRACE_COUNTERS_INTERVAL"),
+				NULL, 10);
+	if (!interval)
+		return 0;
+
+	return sampler_register(counters_sample, interval * 1000);
+}
+
+/*
+ * The dump lock is held across fork(), the child's baselines are taken
+ * from counters no dump is halfway through.
+ */
+void counters_fork_prepare(void)
+{
+	pthread_mutex_lock(&dump_lock);
+}
+
+void counters_fork_parent(void)
+{
+	pthread_mutex_unlock(&dump_lock);
+}
+
+/*
+ * In the child of a fork(). The parent has reported everything up to
+ * now, the child starts from zero deltas. Blocks of the threads that
+ * didn't make it to the child are handed over to new threads, the
+ * forking thread keeps its block under the child's tid.
+ */
+void counters_fork_child(void)
+{
+	struct counters_block *cb;
+
+	pthread_mutex_unlock(&dump_lock);
+	last_dump_ms = now_ms();
+
+	for (cb = blocks; cb; cb = cb->next) {
+		memcpy(cb->last_calls, cb->calls, sizeof(cb->calls));
+		memcpy(cb->last_bytes, cb->bytes, sizeof(cb->bytes));
+
+		if (cb == &exited_block)
+			continue;
+
+		if (cb == counters_tls)
+			cb->tid = output_tid();
+		else if (cb->tid > 0)
+			cb->tid = -cb->tid;
+	}
+}
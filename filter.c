@@ -0,0 +1,399 @@
+/*
+ * Copyright (C) 2017 Sergey Senozhatsky
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <dlfcn.h>
+#include <regex.h>
+#include <sys/prctl.h>
+
+#include "config.h"
+#include <options.h>
+#include <filter.h>
+#include <event_names.h>
+
+/*
+ * MTRACE_FILTER grammar:
+ *
+ *   expr := term [ && term ]...
+ *   term := type in ( NAME [, NAME]... )
+ *         | type == NAME | type != NAME
+ *         | size OP NUM[K|M|G]		OP is one of < <= > >= ==
+ *         | thread =~ "REGEX" | thread !~ "REGEX"
+ *         | module =~ "REGEX" | module !~ "REGEX"
+ *
+ * NAME is an event name, e.g. malloc or mmap. The size of events that
+ * don't have one (free, mlockall, ...) is 0. `thread' matches the
+ * thread name (PR_GET_NAME), `module' matches the path of the ELF that
+ * issued the call.
+ */
+
+#define THREAD_RECHECK_EVENTS	4096
+#define MODULE_CACHE_SZ		64
+
+struct filter_table mtrace_filter = {
+	.active		= 0,
+	.slow		= 0,
+	.types		= ~0ULL,
+	.size_lo	= 0,
+	.size_hi	= ULONG_MAX,
+};
+
+static regex_t thread_re;
+static int thread_re_set;
+static int thread_re_neg;
+
+static regex_t module_re;
+static int module_re_set;
+static int module_re_neg;
+
+/* -1 unknown, 0 accept, 1 reject */
+static __thread int thread_verdict = -1;
+static __thread int thread_events;
+/*
+ * regexec() allocates under some locales, and the allocation comes back
+ * here while the regex is still busy. Events of the filter itself are
+ * rejected.
+ */
+static __thread int filtering;
+
+struct module_verdict {
+	unsigned long	callsite;
+	int		reject;
+};
+
+static __thread struct module_verdict module_cache[MODULE_CACHE_SZ];
+
+static const char *cur;
+
+static void skip_spaces(void)
+{
+	while (isspace(*cur))
+		cur++;
+}
+
+static int accept_tok(const char *tok)
+{
+	size_t len = strlen(tok);
+
+	skip_spaces();
+	if (strncmp(cur, tok, len))
+		return 0;
+
+	/* keywords must not be a prefix of a longer word */
+	if (isalpha(tok[len - 1]) && (isalnum(cur[len]) || cur[len] == '_'))
+		return 0;
+
+	cur += len;
+	return 1;
+}
+
+static int parse_word(char *buf, size_t sz)
+{
+	size_t i = 0;
+
+	skip_spaces();
+	while ((isalnum(*cur) || *cur == '_') && i < sz - 1)
+		buf[i++] = *cur++;
+	buf[i] = 0x00;
+	return i ? 0 : -1;
+}
+
+static int parse_string(char *buf, size_t sz)
+{
+	size_t i = 0;
+
+	skip_spaces();
+	if (*cur != '"')
+		return -1;
+	cur++;
+
+	while (*cur && *cur != '"' && i < sz - 1)
+		buf[i++] = *cur++;
+	buf[i] = 0x00;
+
+	if (*cur != '"')
+		return -1;
+	cur++;
+	return 0;
+}
+
+static int parse_size(unsigned long *ret)
+{
+	char *end;
+
+	skip_spaces();
+	if (!isdigit(*cur))
+		return -1;
+
+	*ret = __memparse(cur, &end);
+	cur = end;
+	return 0;
+}
+
+static int event_type(const char *name)
+{
+	int i;
+
+	for (i = 0; i < EVENT_MAX; i++) {
+		if (!strcmp(event_names[i].human_name, name))
+			return i;
+	}
+	return -1;
+}
+
+static int parse_type_term(void)
+{
+	char name[64];
+	unsigned long long mask = 0;
+	int type;
+
+	if (accept_tok("in")) {
+		if (!accept_tok("("))
+			return -1;
+
+		do {
+			if (parse_word(name, sizeof(name)))
+				return -1;
+			type = event_type(name);
+			if (type < 0)
+				return -1;
+			mask |= 1ULL << type;
+		} while (accept_tok(","));
+
+		if (!accept_tok(")"))
+			return -1;
+
+		mtrace_filter.types &= mask;
+		return 0;
+	}
+
+	if (accept_tok("==")) {
+		if (parse_word(name, sizeof(name)))
+			return -1;
+		type = event_type(name);
+		if (type < 0)
+			return -1;
+		mtrace_filter.types &= 1ULL << type;
+		return 0;
+	}
+
+	if (accept_tok("!=")) {
+		if (parse_word(name, sizeof(name)))
+			return -1;
+		type = event_type(name);
+		if (type < 0)
+			return -1;
+		mtrace_filter.types &= ~(1ULL << type);
+		return 0;
+	}
+
+	return -1;
+}
+
+static int parse_size_term(void)
+{
+	unsigned long sz;
+
+	if (accept_tok(">=")) {
+		if (parse_size(&sz))
+			return -1;
+		if (sz > mtrace_filter.size_lo)
+			mtrace_filter.size_lo = sz;
+		return 0;
+	}
+
+	if (accept_tok("<=")) {
+		if (parse_size(&sz))
+			return -1;
+		if (sz < mtrace_filter.size_hi)
+			mtrace_filter.size_hi = sz;
+		return 0;
+	}
+
+	if (accept_tok(">")) {
+		if (parse_size(&sz) || sz == ULONG_MAX)
+			return -1;
+		if (sz + 1 > mtrace_filter.size_lo)
+			mtrace_filter.size_lo = sz + 1;
+		return 0;
+	}
+
+	if (accept_tok("<")) {
+		if (parse_size(&sz) || sz == 0)
+			return -1;
+		if (sz - 1 < mtrace_filter.size_hi)
+			mtrace_filter.size_hi = sz - 1;
+		return 0;
+	}
+
+	if (accept_tok("==")) {
+		if (parse_size(&sz))
+			return -1;
+		if (sz > mtrace_filter.size_lo)
+			mtrace_filter.size_lo = sz;
+		if (sz < mtrace_filter.size_hi)
+			mtrace_filter.size_hi = sz;
+		return 0;
+	}
+
+	return -1;
+}
+
+static int parse_regex_term(regex_t *re, int *set, int *neg)
+{
+	char buf[256];
+
+	if (*set)
+		return -1;
+
+	if (accept_tok("=~"))
+		*neg = 0;
+	else if (accept_tok("!~"))
+		*neg = 1;
+	else
+		return -1;
+
+	if (parse_string(buf, sizeof(buf)))
+		return -1;
+
+	if (regcomp(re, buf, REG_EXTENDED | REG_NOSUB))
+		return -1;
+
+	*set = 1;
+	mtrace_filter.slow = 1;
+	return 0;
+}
+
+static int parse_term(void)
+{
+	if (accept_tok("type"))
+		return parse_type_term();
+	if (accept_tok("size"))
+		return parse_size_term();
+	if (accept_tok("thread"))
+		return parse_regex_term(&thread_re, &thread_re_set,
+				&thread_re_neg);
+	if (accept_tok("module"))
+		return parse_regex_term(&module_re, &module_re_set,
+				&module_re_neg);
+	return -1;
+}
+
+/*
+ * Called once from __init_mtrace(). A malformed filter is reported and
+ * ignored, we'd rather trace too much than silently trace nothing.
+ */
+int filter_compile(const char *expr)
+{
+	cur = expr;
+
+	do {
+		if (parse_term())
+			goto err;
+	} while (accept_tok("&&"));
+
+	skip_spaces();
+	if (*cur != 0x00)
+		goto err;
+
+	mtrace_filter.active = 1;
+	return 0;
+
+err:
+	fprintf(stderr, "ERROR: malformed MTRACE_FILTER at `%s'\n", cur);
+
+	if (thread_re_set)
+		regfree(&thread_re);
+	if (module_re_set)
+		regfree(&module_re);
+	thread_re_set = 0;
+	module_re_set = 0;
+
+	mtrace_filter.slow = 0;
+	mtrace_filter.types = ~0ULL;
+	mtrace_filter.size_lo = 0;
+	mtrace_filter.size_hi = ULONG_MAX;
+	return -1;
+}
+
+static int thread_reject(void)
+{
+	char name[17] = {0,};
+
+	/* threads can rename themselves, re-check once in a while */
+	if (thread_verdict >= 0 && ++thread_events < THREAD_RECHECK_EVENTS)
+		return thread_verdict;
+
+	thread_events = 0;
+	if (prctl(PR_GET_NAME, name, 0, 0, 0))
+		name[0] = 0x00;
+
+	/* provisional, until regexec() returns */
+	if (thread_verdict < 0)
+		thread_verdict = 1;
+	thread_verdict = !regexec(&thread_re, name, 0, NULL, 0) ^
+		!thread_re_neg;
+	return thread_verdict;
+}
+
+static int module_reject(unsigned long callsite)
+{
+	struct module_verdict *mv;
+	const char *fname = "";
+	Dl_info info;
+	int reject;
+
+	mv = &module_cache[(callsite >> 4) & (MODULE_CACHE_SZ - 1)];
+	if (mv->callsite == callsite)
+		return mv->reject;
+
+	if (dladdr((void *)callsite, &info) && info.dli_fname)
+		fname = info.dli_fname;
+
+	reject = !regexec(&module_re, fname, 0, NULL, 0);
+	reject ^= !module_re_neg;
+
+	mv->callsite = callsite;
+	mv->reject = reject;
+	return reject;
+}
+
+int filter_slow_reject(unsigned long callsite)
+{
+	int reject = 0;
+
+	if (filtering)
+		return 1;
+
+	filtering = 1;
+	if (thread_re_set && thread_reject())
+		reject = 1;
+	else if (module_re_set && module_reject(callsite))
+		reject = 1;
+	filtering = 0;
+	return reject;
+}
@@ -0,0 +1,443 @@
+/*
+ * Copyright (C) 2017 Sergey Senozhatsky
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <elf.h>
+#include <link.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/auxv.h>
+#include <sys/mman.h>
+
+#include "config.h"
+#include <got.h>
+
+/*
+ * Per-module tracing, MTRACE_MODULES=libfoo.so,libbar.so
+ *
+ * libmtrace is preloaded, so every module in the process binds its
+ * allocation symbols to our interposers. Modules that were not selected
+ * get their GOT entries of those symbols rewritten to the definitions
+ * that come after us (glibc, libstdc++): their calls never enter the
+ * library. Selected modules are left alone and are traced as usual.
+ *
+ * A module is selected when its file name starts with one of the names,
+ * "libfoo.so" selects libfoo.so.1 as well. The main program is matched
+ * by its name. Modules are patched once libc is initialized and again
+ * after every dlopen().
+ *
+ * Both lazily bound PLT slots (JUMP_SLOT) and GOT entries of -fno-plt
+ * calls and function pointers (GLOB_DAT) are patched. Entries in the
+ * RELRO segment are made writable for the update.
+ */
+
+#if defined(__x86_64__)
+#define GOT_R_JUMP_SLOT		R_X86_64_JUMP_SLOT
+#define GOT_R_GLOB_DAT		R_X86_64_GLOB_DAT
+#elif defined(__i386__)
+#define GOT_R_JUMP_SLOT		R_386_JMP_SLOT
+#define GOT_R_GLOB_DAT		R_386_GLOB_DAT
+#elif defined(__aarch64__)
+#define GOT_R_JUMP_SLOT		R_AARCH64_JUMP_SLOT
+#define GOT_R_GLOB_DAT		R_AARCH64_GLOB_DAT
+#elif defined(__arm__)
+#define GOT_R_JUMP_SLOT		R_ARM_JUMP_SLOT
+#define GOT_R_GLOB_DAT		R_ARM_GLOB_DAT
+#else
+#define GOT_UNSUPPORTED
+#define GOT_R_JUMP_SLOT		(~0UL)
+#define GOT_R_GLOB_DAT		(~0UL)
+#endif
+
+#if __ELF_NATIVE_CLASS == 64
+#define GOT_R_SYM(info)		ELF64_R_SYM(info)
+#define GOT_R_TYPE(info)	ELF64_R_TYPE(info)
+#else
+#define GOT_R_SYM(info)		ELF32_R_SYM(info)
+#define GOT_R_TYPE(info)	ELF32_R_TYPE(info)
+#endif
+
+#define GOT_MAX_NAMES		64
+#define GOT_MAX_OBJECTS		1024
+#define GOT_MAX_OVERRIDES	8
+
+struct got_object {
+	ElfW(Addr)		base;
+	const ElfW(Phdr)	*phdr;
+	ElfW(Half)		phnum;
+};
+
+static const char *got_symbols[] = {
+	"malloc", "calloc", "realloc", "reallocarray", "free", "cfree",
+	"memalign", "posix_memalign", "aligned_alloc", "valloc", "pvalloc",
+	"free_sized", "free_aligned_sized", "malloc_usable_size",
+	"mmap", "mmap64", "mmap2", "munmap", "mremap", "madvise",
+	"brk", "sbrk", "mlock", "munlock", "mlockall", "munlockall",
+	"memset", "memmove",
+	NULL,
+};
+
+/* C++ operator new/new[]/delete/delete[], all variants */
+static const char *got_prefixes[] = {
+	"_Znw", "_Zna", "_Zdl", "_Zda",
+	NULL,
+};
+
+/* targets other than the next definition, see got_override() */
+static struct {
+	const char	*name;
+	void		*fn;
+} overrides[GOT_MAX_OVERRIDES];
+static int nr_overrides;
+
+static char got_names_buf[4096];
+static char *got_names[GOT_MAX_NAMES];
+static int nr_got_names;
+
+static int got_enabled;
+static void *self_base;
+static unsigned long got_page_size;
+
+/* serializes got_patch(), protects the objects array */
+static pthread_mutex_t got_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct got_object objects[GOT_MAX_OBJECTS];
+static int nr_objects;
+
+static int got_selected(const char *path)
+{
+	const char *name;
+	int i;
+
+	if (!*path)
+		path = program_invocation_name;
+
+	name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+
+	for (i = 0; i < nr_got_names; i++) {
+		if (!strncmp(name, got_names[i], strlen(got_names[i])))
+			return 1;
+	}
+	return 0;
+}
+
+static int got_traced_symbol(const char *name)
+{
+	int i;
+
+	for (i = 0; got_prefixes[i]; i++) {
+		if (!strncmp(name, got_prefixes[i], strlen(got_prefixes[i])))
+			return 1;
+	}
+
+	for (i = 0; got_symbols[i]; i++) {
+		if (!strcmp(name, got_symbols[i]))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Only symbols that bind to our interposers are redirected, if another
+ * module (e.g. the main program) defines its own malloc we must not
+ * route its callers around it.
+ */
+static void *got_target(const char *name)
+{
+	void *ours = dlsym(RTLD_DEFAULT, name);
+	Dl_info info;
+	int i;
+
+	if (!ours || !dladdr(ours, &info) || info.dli_fbase != self_base)
+		return NULL;
+
+	for (i = 0; i < nr_overrides; i++) {
+		if (!strcmp(name, overrides[i].name))
+			return overrides[i].fn;
+	}
+	return dlsym(RTLD_NEXT, name);
+}
+
+/*
+ * Depending on the architecture the dynamic linker may or may not have
+ * relocated the d_ptr values.
+ */
+static unsigned long dyn_ptr(ElfW(Addr) base, ElfW(Addr) ptr)
+{
+	if (ptr < base)
+		return base + ptr;
+	return ptr;
+}
+
+static void got_write(void **slot, void *target,
+		      unsigned long relro_start, unsigned long relro_end)
+{
+	unsigned long addr = (unsigned long)slot;
+	void *page = (void *)(addr & ~(got_page_size - 1));
+	int relro = addr >= relro_start && addr < relro_end;
+
+	if (*slot == target)
+		return;
+
+	if (relro && mprotect(page, got_page_size, PROT_READ | PROT_WRITE))
+		return;
+
+	__atomic_store_n(slot, target, __ATOMIC_RELEASE);
+
+	if (relro)
+		mprotect(page, got_page_size, PROT_READ);
+}
+
+static void got_patch_relocs(struct got_object *obj, unsigned long rel,
+			     size_t size, size_t ent, const ElfW(Sym) *symtab,
+			     const char *strtab, unsigned long relro_start,
+			     unsigned long relro_end)
+{
+	size_t off;
+
+	if (!rel || !ent)
+		return;
+
+	/* Rel and Rela start with the same two fields */
+	for (off = 0; off + ent <= size; off += ent) {
+		const ElfW(Rel) *r = (const ElfW(Rel) *)(rel + off);
+		unsigned long type = GOT_R_TYPE(r->r_info);
+		const char *name;
+		void *target;
+
+		if (type != GOT_R_JUMP_SLOT && type != GOT_R_GLOB_DAT)
+			continue;
+
+		name = strtab + symtab[GOT_R_SYM(r->r_info)].st_name;
+		if (!got_traced_symbol(name))
+			continue;
+
+		target = got_target(name);
+		if (!target)
+			continue;
+
+		got_write((void **)(obj->base + r->r_offset), target,
+				relro_start, relro_end);
+	}
+}
+
+static void got_patch_object(struct got_object *obj)
+{
+	const ElfW(Dyn) *dyn = NULL;
+	const ElfW(Sym) *symtab = NULL;
+	const char *strtab = NULL;
+	unsigned long jmprel = 0, rel = 0, rela = 0;
+	size_t jmprel_sz = 0, rel_sz = 0, rela_sz = 0;
+	size_t rel_ent = sizeof(ElfW(Rel)), rela_ent = sizeof(ElfW(Rela));
+	long pltrel = DT_RELA;
+	unsigned long relro_start = 0, relro_end = 0;
+	int i;
+
+	for (i = 0; i < obj->phnum; i++) {
+		const ElfW(Phdr) *ph = &obj->phdr[i];
+
+		if (ph->p_type == PT_DYNAMIC)
+			dyn = (const ElfW(Dyn) *)(obj->base + ph->p_vaddr);
+
+		if (ph->p_type == PT_GNU_RELRO) {
+			/* the way the dynamic linker protects it */
+			relro_start = (obj->base + ph->p_vaddr) &
+				~(got_page_size - 1);
+			relro_end = (obj->base + ph->p_vaddr + ph->p_memsz) &
+				~(got_page_size - 1);
+		}
+	}
+
+	if (!dyn)
+		return;
+
+	for (; dyn->d_tag != DT_NULL; dyn++) {
+		switch (dyn->d_tag) {
+		case DT_SYMTAB:
+			symtab = (const ElfW(Sym) *)dyn_ptr(obj->base,
+					dyn->d_un.d_ptr);
+			break;
+		case DT_STRTAB:
+			strtab = (const char *)dyn_ptr(obj->base,
+					dyn->d_un.d_ptr);
+			break;
+		case DT_JMPREL:
+			jmprel = dyn_ptr(obj->base, dyn->d_un.d_ptr);
+			break;
+		case DT_PLTRELSZ:
+			jmprel_sz = dyn->d_un.d_val;
+			break;
+		case DT_PLTREL:
+			pltrel = dyn->d_un.d_val;
+			break;
+		case DT_REL:
+			rel = dyn_ptr(obj->base, dyn->d_un.d_ptr);
+			break;
+		case DT_RELSZ:
+			rel_sz = dyn->d_un.d_val;
+			break;
+		case DT_RELENT:
+			rel_ent = dyn->d_un.d_val;
+			break;
+		case DT_RELA:
+			rela = dyn_ptr(obj->base, dyn->d_un.d_ptr);
+			break;
+		case DT_RELASZ:
+			rela_sz = dyn->d_un.d_val;
+			break;
+		case DT_RELAENT:
+			rela_ent = dyn->d_un.d_val;
+			break;
+		}
+	}
+
+	if (!symtab || !strtab)
+		return;
+
+	got_patch_relocs(obj, jmprel, jmprel_sz,
+			pltrel == DT_REL ? rel_ent : rela_ent,
+			symtab, strtab, relro_start, relro_end);
+	got_patch_relocs(obj, rel, rel_sz, rel_ent,
+			symtab, strtab, relro_start, relro_end);
+	got_patch_relocs(obj, rela, rela_sz, rela_ent,
+			symtab, strtab, relro_start, relro_end);
+}
+
+/*
+ * Runs under the loader lock, dlsym() is not allowed here: only take
+ * a list of the objects, they are patched afterwards.
+ */
+static int got_collect(struct dl_phdr_info *info,
+		       size_t size __attribute__((unused)),
+		       void *data __attribute__((unused)))
+{
+	struct got_object *obj;
+
+	if (nr_objects == GOT_MAX_OBJECTS)
+		return 1;
+
+	/* ourselves and the dynamic linker */
+	if ((void *)info->dlpi_addr == self_base ||
+			info->dlpi_addr == getauxval(AT_BASE))
+		return 0;
+
+	if (got_selected(info->dlpi_name))
+		return 0;
+
+	obj = &objects[nr_objects++];
+	obj->base = info->dlpi_addr;
+	obj->phdr = info->dlpi_phdr;
+	obj->phnum = info->dlpi_phnum;
+	return 0;
+}
+
+/*
+ * Called with tracing disabled.
+ */
+void got_patch(void)
+{
+	int i;
+
+	if (!got_enabled)
+		return;
+
+	pthread_mutex_lock(&got_lock);
+	nr_objects = 0;
+	dl_iterate_phdr(got_collect, NULL);
+
+	for (i = 0; i < nr_objects; i++)
+		got_patch_object(&objects[i]);
+	pthread_mutex_unlock(&got_lock);
+}
+
+/*
+ * Held across fork(), the child never sees a half patched object.
+ */
+void got_fork_prepare(void)
+{
+	pthread_mutex_lock(&got_lock);
+}
+
+void got_fork_parent(void)
+{
+	pthread_mutex_unlock(&got_lock);
+}
+
+void got_fork_child(void)
+{
+	pthread_mutex_unlock(&got_lock);
+}
+
+/*
+ * Calls that need a word with libmtrace even when not traced, e.g.
+ * frees of blocks glibc doesn't own. Called before the first patch.
+ */
+void got_override(const char *name, void *fn)
+{
+	if (nr_overrides == GOT_MAX_OVERRIDES)
+		return;
+
+	overrides[nr_overrides].name = name;
+	overrides[nr_overrides].fn = fn;
+	nr_overrides++;
+}
+
+int got_setup(const char *modules)
+{
+	Dl_info info;
+	char *name, *save;
+
+#ifdef GOT_UNSUPPORTED
+	fprintf(stderr, "ERROR: MTRACE_MODULES is not supported "
+			"on this architecture\n");
+	return -1;
+#endif
+
+	if (!dladdr(got_setup, &info)) {
+		fprintf(stderr, "ERROR: unable to locate libmtrace\n");
+		return -1;
+	}
+
+	self_base = info.dli_fbase;
+	got_page_size = sysconf(_SC_PAGESIZE);
+
+	strncpy(got_names_buf, modules, sizeof(got_names_buf) - 1);
+	for (name = strtok_r(got_names_buf, ",", &save); name;
+			name = strtok_r(NULL, ",", &save)) {
+		if (nr_got_names == GOT_MAX_NAMES)
+			break;
+		got_names[nr_got_names++] = name;
+	}
+
+	if (!nr_got_names) {
+		fprintf(stderr, "ERROR: MTRACE_MODULES is empty\n");
+		return -1;
+	}
+
+	got_enabled = 1;
+	return 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2017 Sergey Senozhatsky
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "config.h"
+#include <output.h>
+#include <sampler.h>
+#include <memgrow.h>
+#include <heapstat.h>
+
+/*
+ * glibc allocator statistics.
+ *
+ * The sampler thread writes mallinfo2() totals, along with the process
+ * RSS, every MTRACE_MALLINFO_INTERVAL seconds:
+ *	[a:SEQ:SEC.USEC:RSS:ARENA:HBLKHD:UORDBLKS:FORDBLKS:KEEPCOST]
+ *
+ * and, at a lower rate, the per-arena malloc_info() XML, one trace line
+ * per XML line:
+ *	[x:SEQ:SEC.USEC]
+ *	[X:SEQ] <heap nr="0">
+ *	...
+ *
+ * The difference between RSS and UORDBLKS + HBLKHD is what the allocator
+ * keeps for itself: free chunks, fragmentation, retained arenas.
+ */
+
+#define MALLOC_INFO_DEF_RATIO	10
+
+static struct options *heapstat_opts;
+static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long mallinfo_seq;
+static unsigned long malloc_info_seq;
+static unsigned long malloc_info_interval;
+
+static void mallinfo_sample(void)
+{
+#ifdef HAVE_MALLINFO2
+	struct mallinfo2 mi = mallinfo2();
+#else
+	/* int counters, wrap around at 2G */
+	struct mallinfo mi = mallinfo();
+#endif
+	unsigned long rss = memgrow_rss() * sysconf(_SC_PAGESIZE);
+	struct timeval tv;
+
+	pthread_mutex_lock(&dump_lock);
+	gettimeofday(&tv, NULL);
+	output("[a:%lu:%lu.%06d:%lu:%lu:%lu:%lu:%lu:%lu]\n", ++mallinfo_seq,
+			(unsigned long)tv.tv_sec,
+			(int)tv.tv_usec,
+			rss,
+			(unsigned long)mi.arena,
+			(unsigned long)mi.hblkhd,
+			(unsigned long)mi.uordblks,
+			(unsigned long)mi.fordblks,
+			(unsigned long)mi.keepcost);
+	output_commit(heapstat_opts);
+	pthread_mutex_unlock(&dump_lock);
+}
+
+#ifdef HAVE_MALLOC_INFO
+/*
+ * malloc_info() takes arena locks one at a time and writes the XML to
+ * a memory stream, the trace is written once it's done.
+ */
+static void malloc_info_sample(void)
+{
+	char *buf = NULL, *line, *save;
+	struct timeval tv;
+	size_t sz = 0;
+	FILE *xml;
+
+	xml = open_memstream(&buf, &sz);
+	if (!xml)
+		return;
+
+	if (malloc_info(0, xml)) {
+		fclose(xml);
+		free(buf);
+		return;
+	}
+	fclose(xml);
+
+	pthread_mutex_lock(&dump_lock);
+	gettimeofday(&tv, NULL);
+	output("[x:%lu:%lu.%06d]\n", ++malloc_info_seq,
+			(unsigned long)tv.tv_sec,
+			(int)tv.tv_usec);
+	output_commit(heapstat_opts);
+
+	for (line = strtok_r(buf, "\n", &save); line;
+			line = strtok_r(NULL, "\n", &save)) {
+		output("[X:%lu] %s\n", malloc_info_seq, line);
+		output_commit(heapstat_opts);
+	}
+	pthread_mutex_unlock(&dump_lock);
+
+	free(buf);
+}
+#else
+static void malloc_info_sample(void)
+{
+}
+#endif
+
+/*
+ * One more sample of everything at exit.
+ */
+void heapstat_dump(void)
+{
+	if (!heapstat_opts)
+		return;
+
+	mallinfo_sample();
+	if (malloc_info_interval)
+		malloc_info_sample();
+}
+
+/*
+ * MTRACE_MALLINFO_INTERVAL=SECONDS enables the sampling.
+ * MTRACE_MALLOC_INFO_INTERVAL=SECONDS, 10 times the mallinfo interval
+ * by default, 0 disables malloc_info().
+ */
+int heapstat_setup(struct options *opts)
+{
+	unsigned long interval;
+	int ret;
+
+	if (!getenv("MTRACE_MALLINFO_INTERVAL"))
+		return 0;
+
+	interval = strtoul(getenv("MTRACE_MALLINFO_INTERVAL"), NULL, 10);
+	if (!interval)
+		return 0;
+
+	malloc_info_interval = interval * MALLOC_INFO_DEF_RATIO;
+	if (getenv("MTRACE_MALLOC_INFO_INTERVAL"))
+		malloc_info_interval =
+			strtoul(getenv("MTRACE_MALLOC_INFO_INTERVAL"), NULL, 10);
+
+	heapstat_opts = opts;
+
+	ret = sampler_register(mallinfo_sample, interval * 1000);
+	if (ret || !malloc_info_interval)
+		return ret;
+
+	return sampler_register(malloc_info_sample,
+			malloc_info_interval * 1000);
+}
+
+/*
+ * Held across fork(), a dump is never cut off half way in the child.
+ */
+void heapstat_fork_prepare(void)
+{
+	pthread_mutex_lock(&dump_lock);
+}
+
+void heapstat_fork_parent(void)
+{
+	pthread_mutex_unlock(&dump_lock);
+}
+
+void heapstat_fork_child(void)
+{
+	pthread_mutex_unlock(&dump_lock);
+}
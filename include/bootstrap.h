@@ -0,0 +1,35 @@
+#ifndef __BOOTSTRAP_H
+#define __BOOTSTRAP_H
+
+#include <stddef.h>
+
+/* bounds of all arena chunks, a quick reject for foreign pointers */
+extern unsigned long bootstrap_lo;
+extern unsigned long bootstrap_hi;
+
+extern void *bootstrap_alloc(size_t size, size_t alignment);
+extern void *bootstrap_realloc(void *ptr, size_t size);
+extern void bootstrap_free(void *ptr);
+extern size_t bootstrap_usable_size(void *ptr);
+extern int __bootstrap_owns(unsigned long addr);
+extern void bootstrap_fork_prepare(void);
+extern void bootstrap_fork_parent(void);
+extern void bootstrap_fork_child(void);
+
+/*
+ * Called by every free() and realloc(), must be cheap for pointers that
+ * glibc handed out.
+ */
+static inline int bootstrap_owns(const void *ptr)
+{
+	unsigned long addr = (unsigned long)ptr;
+
+	if (__builtin_expect(addr < __atomic_load_n(&bootstrap_lo,
+					__ATOMIC_RELAXED) ||
+			addr >= __atomic_load_n(&bootstrap_hi,
+				__ATOMIC_RELAXED), 1))
+		return 0;
+	return __bootstrap_owns(addr);
+}
+
+#endif /* __BOOTSTRAP_H */
@@ -0,0 +1,10 @@
+#ifndef __COLD_H
+#define __COLD_H
+
+#include <stddef.h>
+#include <options.h>
+
+extern int cold_setup(struct options *opts, size_t min_size);
+extern void cold_fork_child(void);
+
+#endif /* __COLD_H */
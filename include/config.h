@@ -16,6 +16,12 @@
 /* Define to 1 if you have the <dlfcn.h> header file. */
 #define HAVE_DLFCN_H 1
 
+/* Define to 1 if you have the `free_aligned_sized' function. */
+/* #undef HAVE_FREE_ALIGNED_SIZED */
+
+/* Define to 1 if you have the `free_sized' function. */
+/* #undef HAVE_FREE_SIZED */
+
 /* Define to 1 if you have the `gettimeofday' function. */
 #define HAVE_GETTIMEOFDAY 1
 
@@ -37,9 +43,15 @@
 /* Define to 1 if you have the <libunwind-ptrace.h> header file. */
 #define HAVE_LIBUNWIND_PTRACE_H 1
 
+/* Define to 1 if you have the `mallinfo2' function. */
+#define HAVE_MALLINFO2 1
+
 /* Define to 1 if you have the `malloc' function. */
 #define HAVE_MALLOC 1
 
+/* Define to 1 if you have the `malloc_info' function. */
+#define HAVE_MALLOC_INFO 1
+
 /* Define to 1 if you have the `memalign' function. */
 #define HAVE_MEMALIGN 1
 
@@ -82,6 +94,9 @@
 /* Define to 1 if you have the `realloc' function. */
 #define HAVE_REALLOC 1
 
+/* Define to 1 if you have the `reallocarray' function. */
+#define HAVE_REALLOCARRAY 1
+
 /* Define to 1 if you have the <stdint.h> header file. */
 #define HAVE_STDINT_H 1
 
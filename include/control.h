@@ -0,0 +1,26 @@
+#ifndef __CONTROL_H
+#define __CONTROL_H
+
+#define CTL_DISABLED	(1 << 0)
+#define CTL_PENDING	(1 << 1)
+#define CTL_DISARMED	(1 << 2)
+#define CTL_SNAPSHOT	(1 << 3)
+
+/*
+ * Non-zero only when tracing is disabled, disarmed or there is a
+ * pending command or snapshot, so interposers check it with a single
+ * branch.
+ */
+extern volatile int mtrace_ctl;
+
+typedef int (*control_handler_t)(const char *cmd, const char *arg);
+
+extern int control_init(const char *path, int sig, control_handler_t handler);
+extern int control_snapshot_init(int sig);
+extern void control_enable(int enable);
+extern void control_process(void);
+extern void control_fork_prepare(void);
+extern void control_fork_parent(void);
+extern void control_fork_child(void);
+
+#endif /* __CONTROL_H */
@@ -0,0 +1,135 @@
+#ifndef __COUNTERS_H
+#define __COUNTERS_H
+
+#include <stddef.h>
+#include <options.h>
+#include <event_names.h>
+
+struct counters_block;
+
+extern __thread struct counters_block *counters_tls;
+
+extern int counters_setup(struct options *opts);
+extern struct counters_block *counters_register(void);
+extern void counters_dump(struct options *opts);
+extern void counters_hist_dump(struct options *opts);
+extern struct counters_block *counters_list(void);
+extern void counters_fork_prepare(void);
+extern void counters_fork_parent(void);
+extern void counters_fork_child(void);
+
+enum hist_class {
+	HIST_MALLOC,
+	HIST_CALLOC,
+	HIST_REALLOC,
+	HIST_MEMALIGN,
+	HIST_MMAP,
+	HIST_NEW,
+	HIST_MAX
+};
+
+/* log2 buckets: [2^(i-1), 2^i), bucket 0 is for 0 byte requests */
+#define HIST_LOG2_BUCKETS	(sizeof(unsigned long) * 8 + 1)
+/* 16 byte buckets for requests up to 4K: (16 * i, 16 * (i + 1)] */
+#define HIST_FINE_STEP		16
+#define HIST_FINE_MAX		4096
+#define HIST_FINE_BUCKETS	(HIST_FINE_MAX / HIST_FINE_STEP)
+
+/*
+ * Per-thread, no locks and no atomic RMW: the block is only written by
+ * its thread, the dumper tolerates slightly stale values.
+ */
+struct counters_block {
+	struct counters_block	*next;
+	int			tid;
+
+	unsigned long		calls[EVENT_MAX];
+	unsigned long		bytes[EVENT_MAX];
+
+	/* values at the previous dump, owned by the dumper */
+	unsigned long		last_calls[EVENT_MAX];
+	unsigned long		last_bytes[EVENT_MAX];
+
+	/* values at the previous live stats update, owned by livestats.c */
+	unsigned long		live_calls;
+	unsigned long		live_bytes;
+
+	/* request size histograms, never reset */
+	unsigned long		hist_log2[HIST_MAX][HIST_LOG2_BUCKETS];
+	unsigned long		hist_fine[HIST_MAX][HIST_FINE_BUCKETS];
+
+	/* EVENT_MAX latency histograms, allocated in latency mode */
+	unsigned long		*lat;
+};
+
+/*
+ * The caller registers the thread's block first, with tracing disabled.
+ */
+static inline void counters_inc(int type, size_t size)
+{
+	struct counters_block *cb = counters_tls;
+
+	if (!cb)
+		return;
+
+	__atomic_store_n(&cb->calls[type], cb->calls[type] + 1,
+			__ATOMIC_RELAXED);
+	__atomic_store_n(&cb->bytes[type], cb->bytes[type] + size,
+			__ATOMIC_RELAXED);
+}
+
+static inline int hist_class(int type)
+{
+	switch (type) {
+	case EVENT_MALLOC:
+		return HIST_MALLOC;
+	case EVENT_CALLOC:
+		return HIST_CALLOC;
+	case EVENT_REALLOC:
+	case EVENT_REALLOCARRAY:
+		return HIST_REALLOC;
+	case EVENT_MEMALIGN:
+	case EVENT_POSIX_MEMALIGN:
+	case EVENT_ALIGNED_ALLOC:
+	case EVENT_VALLOC:
+	case EVENT_PVALLOC:
+		return HIST_MEMALIGN;
+	case EVENT_MMAP:
+	case EVENT_MMAP2:
+	case EVENT_MREMAP:
+		return HIST_MMAP;
+	case EVENT_NEW:
+	case EVENT_NEW_ARRAY:
+		return HIST_NEW;
+	}
+	return -1;
+}
+
+static inline void __hist_inc(unsigned long *bucket)
+{
+	__atomic_store_n(bucket, *bucket + 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Same rules as counters_inc()
+ */
+static inline void counters_hist(int type, size_t size)
+{
+	struct counters_block *cb = counters_tls;
+	int class = hist_class(type);
+
+	if (!cb || class < 0)
+		return;
+
+	if (!size) {
+		__hist_inc(&cb->hist_log2[class][0]);
+		return;
+	}
+
+	__hist_inc(&cb->hist_log2[class][HIST_LOG2_BUCKETS - 1 -
+			__builtin_clzl(size)]);
+	if (size <= HIST_FINE_MAX)
+		__hist_inc(&cb->hist_fine[class][(size - 1) / HIST_FINE_STEP]);
+}
+
+#endif /* __COUNTERS_H */
@@ -1,129 +1,67 @@
 #ifndef _EVENT_NAMES_H_
 #define _EVENT_NAMES_H_
 
+/*
+ * All events, one row each:
+ *	X(ID, human name, compact name)
+ *
+ * The parser looks for compact names in this order, none may contain
+ * another. Interposers of the regular shapes are generated from the
+ * descriptors in interposers.def, the rest are written in libmtrace.c.
+ */
+#define MTRACE_EVENTS(X)							\
+	X(MALLOC,		"malloc",		"MA$")		\
+	X(CALLOC,		"calloc",		"CA$")		\
+	X(REALLOC,		"realloc",		"RE$")		\
+	X(FREE,			"free",			"FR$")		\
+	X(CFREE,		"cfree",		"CF$")		\
+	X(MEMALIGN,		"memalign",		"ME$")		\
+	X(POSIX_MEMALIGN,	"posix_memalign",	"PO$")		\
+	X(ALIGNED_ALLOC,	"aligned_alloc",	"AL$")		\
+	X(VALLOC,		"valloc",		"VA$")		\
+	X(PVALLOC,		"pvalloc",		"PV$")		\
+	X(MEMMOVE,		"memmove",		"MM!")		\
+	X(MEMSET,		"memset",		"MS!")		\
+	X(MMAP,			"mmap",			"MM&")		\
+	X(MUNMAP,		"munmap",		"MU&")		\
+	X(MMAP2,		"mmap2",		"MM2&")		\
+	X(MLOCK,		"mlock",		"ML#")		\
+	X(MUNLOCK,		"munlock",		"MU#")		\
+	X(MLOCKALL,		"mlockall",		"MLA#")		\
+	X(MUNLOCKALL,		"munlockall",		"MUA#")		\
+	X(NEW,			"new",			"NW$")		\
+	X(NEW_ARRAY,		"new_array",		"NA$")		\
+	X(DELETE,		"delete",		"DL$")		\
+	X(DELETE_ARRAY,		"delete_array",		"DA$")		\
+	X(REALLOCARRAY,		"reallocarray",		"RA$")		\
+	X(FREE_SIZED,		"free_sized",		"FS$")		\
+	X(FREE_ALIGNED_SIZED,	"free_aligned_sized",	"FA$")		\
+	X(MALLOC_USABLE_SIZE,	"malloc_usable_size",	"US$")		\
+	X(MREMAP,		"mremap",		"MR&")		\
+	X(MADVISE,		"madvise",		"MA&")		\
+	X(BRK,			"brk",			"BR&")		\
+	X(SBRK,			"sbrk",			"SB&")
+
 struct event_name {
 	const char *human_name;
 	const char *compact_name;
 };
 
-static struct event_name event_names[] = {
-	{
-		"malloc",
-		"MA$",
-	},
-
-	{
-		"calloc",
-		"CA$",
-	},
-
-	{
-		"realloc",
-		"RE$",
-	},
-
-	{
-		"free",
-		"FR$",
-	},
-
-	{
-		"cfree",
-		"CF$",
-	},
-
-	{
-		"memalign",
-		"ME$",
-	},
-
-	{
-		"posix_memalign",
-		"PO$",
-	},
-
-	{
-		"aligned_alloc",
-		"AL$",
-	},
-
-	{
-		"valloc",
-		"VA$",
-	},
-
-	{
-		"pvalloc",
-		"PV$",
-	},
+#define EVENT_NAME(id, human, compact)	{ human, compact, },
 
-	{
-		"memmove",
-		"MM!",
-	},
-
-	{
-		"memset",
-		"MS!",
-	},
-
-	{
-		"mmap",
-		"MM&",
-	},
-
-	{
-		"munmap",
-		"MU&",
-	},
-
-	{
-		"mmap2",
-		"MM2&",
-	},
-
-	{
-		"mlock",
-		"ML#",
-	},
+static struct event_name event_names[] = {
+	MTRACE_EVENTS(EVENT_NAME)
+};
 
-	{
-		"munlock",
-		"MU#",
-	},
+#undef EVENT_NAME
 
-	{
-		"mlockall",
-		"MLA#",
-	},
-
-	{
-		"munlockall",
-		"MUA#",
-	}
-};
+#define EVENT_ID(id, human, compact)	EVENT_##id,
 
 enum events {
-	EVENT_MALLOC,
-	EVENT_CALLOC,
-	EVENT_REALLOC,
-	EVENT_FREE,
-	EVENT_CFREE,
-	EVENT_MEMALIGN,
-	EVENT_POSIX_MEMALIGN,
-	EVENT_ALIGNED_ALLOC,
-	EVENT_VALLOC,
-	EVENT_PVALLOC,
-	EVENT_MEMMOVE,
-	EVENT_MEMSET,
-	EVENT_MMAP,
-	EVENT_MUNMAP,
-	EVENT_MMAP2,
-	EVENT_MLOCK,
-	EVENT_MUNLOCK,
-	EVENT_MLOCKALL,
-	EVENT_MUNLOCKALL,
+	MTRACE_EVENTS(EVENT_ID)
 	EVENT_MAX
 };
 
+#undef EVENT_ID
+
 #endif /* _EVENT_NAMES_H_ */
@@ -0,0 +1,41 @@
+#ifndef __FILTER_H
+#define __FILTER_H
+
+#include <stddef.h>
+
+/*
+ * Compiled MTRACE_FILTER. Type and size predicates are folded into an
+ * event bitmask and a size range, so the common case is a couple of
+ * compares. Thread and module regexps are evaluated lazily and cached.
+ */
+struct filter_table {
+	int			active;
+	int			slow;
+	unsigned long long	types;
+	unsigned long		size_lo;
+	unsigned long		size_hi;
+};
+
+extern struct filter_table mtrace_filter;
+
+extern int filter_compile(const char *expr);
+extern int filter_slow_reject(unsigned long callsite);
+
+static inline int filter_reject(int type, size_t size, unsigned long callsite)
+{
+	struct filter_table *f = &mtrace_filter;
+
+	if (!f->active)
+		return 0;
+
+	if (!((f->types >> type) & 1) |
+			(size < f->size_lo) |
+			(size > f->size_hi))
+		return 1;
+
+	if (f->slow)
+		return filter_slow_reject(callsite);
+	return 0;
+}
+
+#endif /* __FILTER_H */
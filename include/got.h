@@ -0,0 +1,11 @@
+#ifndef __GOT_H
+#define __GOT_H
+
+extern int got_setup(const char *modules);
+extern void got_patch(void);
+extern void got_override(const char *name, void *fn);
+extern void got_fork_prepare(void);
+extern void got_fork_parent(void);
+extern void got_fork_child(void);
+
+#endif /* __GOT_H */
@@ -0,0 +1,12 @@
+#ifndef __HEAPSTAT_H
+#define __HEAPSTAT_H
+
+#include <options.h>
+
+extern int heapstat_setup(struct options *opts);
+extern void heapstat_dump(void);
+extern void heapstat_fork_prepare(void);
+extern void heapstat_fork_parent(void);
+extern void heapstat_fork_child(void);
+
+#endif /* __HEAPSTAT_H */
@@ -0,0 +1,76 @@
+#ifndef __LATENCY_H
+#define __LATENCY_H
+
+#include <stdint.h>
+#include <time.h>
+#include <options.h>
+#include <counters.h>
+
+/* HDR style log-linear buckets: 8 linear sub-buckets per power of two */
+#define LAT_SUB_BITS		3
+#define LAT_SUB_BUCKETS		(1 << LAT_SUB_BITS)
+#define LAT_BUCKETS		((64 - LAT_SUB_BITS + 1) << LAT_SUB_BITS)
+
+extern uint64_t latency_threshold;
+
+extern int latency_setup(struct options *opts);
+extern unsigned long latency_ns(uint64_t ticks);
+extern int latency_hist_alloc(struct counters_block *cb);
+extern void latency_dump(struct options *opts);
+extern void latency_fork_prepare(void);
+extern void latency_fork_parent(void);
+extern void latency_fork_child(void);
+
+/*
+ * A cheap cycle counter, not serializing. Only the difference of two
+ * reads on the same thread is used, latency_ns() converts it.
+ */
+static inline uint64_t latency_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+	uint64_t ticks;
+
+	asm volatile("mrs %0, cntvct_el0" : "=r" (ticks));
+	return ticks;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static inline int latency_bucket(uint64_t ticks)
+{
+	int msb;
+
+	if (ticks < LAT_SUB_BUCKETS)
+		return ticks;
+
+	msb = 63 - __builtin_clzll(ticks);
+	return ((msb - LAT_SUB_BITS + 1) << LAT_SUB_BITS) +
+		((ticks >> (msb - LAT_SUB_BITS)) & (LAT_SUB_BUCKETS - 1));
+}
+
+/*
+ * Same rules as counters_inc(), the thread's block is registered first.
+ */
+static inline void latency_inc(int type, uint64_t ticks)
+{
+	struct counters_block *cb = counters_tls;
+	unsigned long *bucket;
+
+	if (!cb)
+		return;
+
+	if (!__atomic_load_n(&cb->lat, __ATOMIC_ACQUIRE) &&
+			latency_hist_alloc(cb))
+		return;
+
+	bucket = &cb->lat[type * LAT_BUCKETS + latency_bucket(ticks)];
+	__atomic_store_n(bucket, *bucket + 1, __ATOMIC_RELAXED);
+}
+
+#endif /* __LATENCY_H */
@@ -0,0 +1,10 @@
+#ifndef __LINEAGE_H
+#define __LINEAGE_H
+
+#include <options.h>
+
+extern int lineage_exec(void);
+extern void lineage_start(struct options *opts);
+extern void lineage_fork_child(struct options *opts);
+
+#endif /* __LINEAGE_H */
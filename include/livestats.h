@@ -0,0 +1,74 @@
+#ifndef __LIVESTATS_H
+#define __LIVESTATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <options.h>
+
+/*
+ * Layout of the live statistics segment, /dev/shm/mtrace-PID. Shared
+ * with mtrace-top, bump LIVESTATS_VERSION on any change.
+ */
+#define LIVESTATS_PATH		"/dev/shm/mtrace-%d"
+#define LIVESTATS_MAGIC		0x6d747374
+#define LIVESTATS_VERSION	2
+
+#define LIVESTATS_EVENTS	64
+#define LIVESTATS_THREADS	64
+#define LIVESTATS_CALLSITES	32
+#define LIVESTATS_NAME_SZ	24
+#define LIVESTATS_SYM_SZ	96
+
+struct livestats_event {
+	char		name[LIVESTATS_NAME_SZ];
+	unsigned long	calls;
+	unsigned long	bytes;
+	unsigned long	calls_rate;
+	unsigned long	bytes_rate;
+};
+
+struct livestats_thread {
+	int		tid;
+	unsigned long	calls;
+	unsigned long	bytes;
+	unsigned long	calls_rate;
+	unsigned long	bytes_rate;
+};
+
+struct livestats_callsite {
+	unsigned long	addr;
+	unsigned long	calls_rate;
+	unsigned long	bytes_rate;
+	char		sym[LIVESTATS_SYM_SZ];
+};
+
+/*
+ * seq is odd while the sampler updates the segment: readers copy it
+ * out and retry if seq was odd or changed in the meantime.
+ */
+struct livestats {
+	uint32_t			magic;
+	uint32_t			version;
+	uint32_t			seq;
+	int				pid;
+
+	unsigned long			interval_ms;
+	unsigned long			updates;
+	unsigned long			tv_sec;
+	unsigned long			tv_usec;
+
+	int				nr_events;
+	int				nr_threads;
+	int				nr_callsites;
+
+	struct livestats_event		events[LIVESTATS_EVENTS];
+	struct livestats_thread		threads[LIVESTATS_THREADS];
+	struct livestats_callsite	callsites[LIVESTATS_CALLSITES];
+};
+
+extern int livestats_setup(struct options *opts);
+extern void livestats_callsite(unsigned long callsite, size_t size);
+extern void livestats_exit(void);
+extern void livestats_fork_child(void);
+
+#endif /* __LIVESTATS_H */
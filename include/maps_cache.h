@@ -4,5 +4,8 @@
 extern int maps_cache_deferred_flush(void);
 extern int maps_cache_lookup(unsigned long);
 extern int early_maps_cache_init(void);
+extern void maps_cache_fork_prepare(void);
+extern void maps_cache_fork_parent(void);
+extern void maps_cache_fork_child(void);
 
 #endif /* __MAPS_H */
@@ -0,0 +1,10 @@
+#ifndef __MEMGROW_H
+#define __MEMGROW_H
+
+extern int memgrow_setup(const char *backend);
+extern void memgrow_start(void);
+extern unsigned long memgrow_faults(void);
+extern unsigned long memgrow_rss(void);
+extern void memgrow_fork_child(void);
+
+#endif /* __MEMGROW_H */
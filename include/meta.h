@@ -0,0 +1,26 @@
+#ifndef __META_H
+#define __META_H
+
+#include <stddef.h>
+#include <options.h>
+
+struct meta_stats {
+	unsigned long	mapped;
+	unsigned long	used;
+	unsigned long	peak;
+	unsigned long	failed;
+};
+
+extern void *meta_alloc(size_t size);
+extern void *meta_realloc(void *ptr, size_t size);
+extern void meta_free(void *ptr);
+extern const char *meta_intern(const char *str);
+
+extern void meta_setup(unsigned long limit);
+extern void meta_fork_prepare(void);
+extern void meta_fork_parent(void);
+extern void meta_fork_child(void);
+extern void meta_get_stats(struct meta_stats *stats);
+extern void meta_dump(struct options *opts);
+
+#endif /* __META_H */
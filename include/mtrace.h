@@ -0,0 +1,47 @@
+#ifndef __MTRACE_H
+#define __MTRACE_H
+
+/*
+ * libmtrace annotation API.
+ *
+ * Tags name what the calling thread is doing, e.g. a request type or a
+ * program phase. Tags nest, every traced event carries the id of the
+ * innermost tag of its thread. Marks are one-off points in time.
+ *
+ * The symbols are weak, so applications don't have to link against
+ * libmtrace: without libmtrace preloaded they are NULL and the macros
+ * below do nothing.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* returns the tag id, 0 if the tag could not be registered */
+extern int mtrace_push_tag(const char *name) __attribute__((weak));
+extern void mtrace_pop_tag(void) __attribute__((weak));
+extern void mtrace_mark(const char *name) __attribute__((weak));
+
+#ifdef __cplusplus
+}
+#endif
+
+#define MTRACE_PUSH_TAG(name)				\
+	do {						\
+		if (mtrace_push_tag)			\
+			mtrace_push_tag(name);		\
+	} while (0)
+
+#define MTRACE_POP_TAG()				\
+	do {						\
+		if (mtrace_pop_tag)			\
+			mtrace_pop_tag();		\
+	} while (0)
+
+#define MTRACE_MARK(name)				\
+	do {						\
+		if (mtrace_mark)			\
+			mtrace_mark(name);		\
+	} while (0)
+
+#endif /* __MTRACE_H */
@@ -0,0 +1,9 @@
+#ifndef __NUMA_H
+#define __NUMA_H
+
+#include <stddef.h>
+#include <options.h>
+
+extern int numa_setup(struct options *opts, size_t min_size);
+
+#endif /* __NUMA_H */
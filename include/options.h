@@ -2,8 +2,8 @@
 #define __OPTIONS_H
 
 #include <stdio.h>
+#include <stdlib.h>
 
-#define INIT_BUF_SZ		(2 * 1024 * 1024)
 #define MAX_FN_NAME_BUF_SZ	4096
 
 #define UNWIND_DEPTH		32
@@ -19,6 +19,21 @@
 #define OPTS_MEM_GROW_MODE	(1 << 4)
 #define OPTS_HUMAN_READABLE	(1 << 5)
 #define OPTS_ALLOC_WMARK	(1 << 6)
+#define OPTS_PROFILE_MODE	(1 << 7)
+#define OPTS_LIVE_TABLE		(1 << 8)
+#define OPTS_COUNTERS_MODE	(1 << 9)
+#define OPTS_SIZE_HISTOGRAM	(1 << 10)
+#define OPTS_LATENCY_MODE	(1 << 11)
+#define OPTS_NUMA_SAMPLE	(1 << 12)
+#define OPTS_LIVE_STATS		(1 << 13)
+
+#define OPTS_REPORTING_MODES	(OPTS_ALLOC_ONLY_MODE |		\
+				 OPTS_ALLOC_TOP_MODE |		\
+				 OPTS_FULL_REPORT_MODE |	\
+				 OPTS_MEM_GROW_MODE |		\
+				 OPTS_PROFILE_MODE |		\
+				 OPTS_COUNTERS_MODE |		\
+				 OPTS_LATENCY_MODE)
 
 enum alloc_stats {
 	STATS_MALLOC_SZ,
@@ -30,6 +45,41 @@ enum alloc_stats {
 #define STATS_MLOCK	(STATS_FREE + 1)
 #define STATS_AUX	(STATS_MLOCK + 1)
 
+/*
+ * Parse a number with an optional K/M/G suffix. If `retend' is not
+ * NULL it is set past the suffix.
+ */
+static inline unsigned long __memparse(const char *mem, char **retend)
+{
+	char *end;
+
+	unsigned long ret = strtoul(mem, &end, 10);
+
+	switch (*end) {
+		case 'G':
+		case 'g':
+			ret <<= 10;
+		case 'M':
+		case 'm':
+			ret <<= 10;
+		case 'K':
+		case 'k':
+			ret <<= 10;
+			end++;
+		default:
+			break;
+	}
+
+	if (retend)
+		*retend = end;
+	return ret;
+}
+
+static inline unsigned long memparse(const char *mem)
+{
+	return __memparse(mem, NULL);
+}
+
 struct options {
 	FILE *fd;
 	int flags;
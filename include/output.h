@@ -4,10 +4,14 @@
 #include <options.h>
 
 void mtrace_init_file(struct options *opts, const char *base_path);
+int mtrace_rotate_file(struct options *opts);
+void output_fork_child(struct options *opts);
 
 int output(const char *fmt, ...);
+int output_tid(void);
 int output_event_pid(void);
 int output_event_timestamp(void);
 void output_commit(struct options *opts);
+void output_discard(void);
 
 #endif /* _OUTPUT_H */
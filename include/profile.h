@@ -0,0 +1,47 @@
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <options.h>
+
+struct profile_stack;
+
+/* pointer table entry */
+struct live_ptr {
+	unsigned long		ptr;
+	struct profile_stack	*stack;
+	size_t			size;
+	/* CLOCK_MONOTONIC */
+	uint64_t		ts_ns;
+	int			tid;
+	int			cpu;
+};
+
+struct live_block {
+	unsigned long	ptr;
+	size_t		size;
+	unsigned long	stack_id;
+	int		tid;
+	/* allocating CPU, -1 unless MTRACE_NUMA_MIN_SIZE is set */
+	int		cpu;
+};
+
+extern int profile_setup(struct options *opts);
+extern void profile_alloc(struct options *opts, void *ptr, size_t size);
+extern void profile_free(void *ptr);
+extern int profile_free_start(void *ptr, struct live_ptr *old);
+extern void profile_free_end(struct live_ptr *old, int failed);
+extern int profile_munmap_start(void *addr, size_t len,
+				struct live_ptr *old);
+extern void profile_munmap_end(struct live_ptr *old, size_t len,
+			       int failed);
+extern void profile_dump(struct options *opts);
+extern void profile_fork_prepare(void);
+extern void profile_fork_parent(void);
+extern void profile_fork_child(struct options *opts);
+extern void profile_snapshot(struct options *opts, const char *reason);
+extern int profile_live_blocks(size_t min_size, struct live_block *blocks,
+			       int max);
+
+#endif /* __PROFILE_H */
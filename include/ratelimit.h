@@ -0,0 +1,11 @@
+#ifndef __RATELIMIT_H
+#define __RATELIMIT_H
+
+#include <options.h>
+
+extern int ratelimit_setup(struct options *opts, const char *conf);
+extern int ratelimit_check(unsigned long callsite);
+extern void ratelimit_flush(struct options *opts);
+extern void ratelimit_fork_child(void);
+
+#endif /* __RATELIMIT_H */
@@ -0,0 +1,10 @@
+#ifndef __SAMPLER_H
+#define __SAMPLER_H
+
+typedef void (*sampler_fn_t)(void);
+
+extern int sampler_register(sampler_fn_t fn, unsigned long interval_ms);
+extern int sampler_start(void (*thread_init)(void));
+extern void sampler_fork_child(void);
+
+#endif /* __SAMPLER_H */
@@ -12,6 +12,15 @@ struct resovled_sym {
 	char		*fn_name;
 };
 
+/*
+ * Unresolved frames are added as an empty range, a symbol that wasn't
+ * found is all zeroes.
+ */
+static inline int symbol_unresolved(const struct resovled_sym *sym)
+{
+	return sym->start_ip == sym->end_ip;
+}
+
 extern struct resovled_sym add_resolved_symbol(struct options *opts,
 				unsigned long start_ip,
 				unsigned long end_ip,
@@ -20,5 +29,8 @@ extern struct resovled_sym add_resolved_symbol(struct options *opts,
 extern struct resovled_sym lookup_resolved_symbol(unsigned long ip);
 
 extern void early_lookup_init(void);
+extern void symbol_lookup_fork_prepare(void);
+extern void symbol_lookup_fork_parent(void);
+extern void symbol_lookup_fork_child(struct options *opts);
 
 #endif /* __SYMBOL_LOOKUP_H */
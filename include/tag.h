@@ -0,0 +1,23 @@
+#ifndef __TAG_H
+#define __TAG_H
+
+#include <options.h>
+
+#define TAG_MAX_DEPTH	32
+
+extern __thread int tag_stack[TAG_MAX_DEPTH];
+extern __thread int tag_depth;
+
+extern int tag_get(struct options *opts, const char *name);
+extern void tag_mark(struct options *opts, const char *name);
+
+static inline int tag_current(void)
+{
+	if (!tag_depth)
+		return 0;
+	if (tag_depth > TAG_MAX_DEPTH)
+		return tag_stack[TAG_MAX_DEPTH - 1];
+	return tag_stack[tag_depth - 1];
+}
+
+#endif /* __TAG_H */
@@ -0,0 +1,9 @@
+#ifndef __TRIGGER_H
+#define __TRIGGER_H
+
+#include <options.h>
+
+extern int trigger_setup(struct options *opts);
+extern void trigger_arm(int arm);
+
+#endif /* __TRIGGER_H */
@@ -4,7 +4,10 @@
 #include <options.h>
 
 extern void unwind_set_depth(int);
+extern int unwind_get_depth(void);
 extern void unwind_trace(struct options *);
+extern int unwind_stack(struct options *, unsigned long *ips, int max);
+extern void unwind_output_stack(struct options *, unsigned long *ips, int nr);
 
 extern void unwind_flush_cache(void);
 
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2017 Sergey Senozhatsky
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "config.h"
+#include <output.h>
+#include <meta.h>
+#include <latency.h>
+
+/*
+ * Latency reporting mode.
+ *
+ * Interposers read the cycle counter right before and right after the
+ * real glibc call of every top level event, and account the difference
+ * to per-thread, per event type log-linear histograms which live next
+ * to the event counters (see counters.c). Events that took less than
+ * MTRACE_LATENCY_THRESHOLD leave nothing in the trace; slower ones are
+ * written as usual, with a [l:NS] record and a full backtrace.
+ *
+ * Histograms of all threads are merged at exit and on "flush":
+ *	[g:SEQ:SEC.USEC:THRESHOLD_NS]
+ *	[G:EVENT:NS=COUNT,...]
+ * NS is the lower bound of a bucket.
+ */
+
+#define LATENCY_DEF_THRESHOLD_NS	10000
+#define LATENCY_CALIBRATE_NS		1000000
+
+uint64_t latency_threshold;
+
+static uint64_t base_ticks;
+static uint64_t base_ns;
+static double ticks_per_ns = 1.0;
+
+static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long dump_seq;
+
+static uint64_t clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * The counter frequency is measured against CLOCK_MONOTONIC, since the
+ * base point set up by latency_setup(). The longer the process runs the
+ * better the estimate is.
+ */
+static void latency_calibrate(void)
+{
+	uint64_t ticks = latency_now();
+	uint64_t ns = clock_ns();
+
+	if (ns > base_ns && ticks > base_ticks)
+		ticks_per_ns = (double)(ticks - base_ticks) / (ns - base_ns);
+}
+
+unsigned long latency_ns(uint64_t ticks)
+{
+	return ticks / ticks_per_ns;
+}
+
+/*
+ * Called by the owner of the block, within an event frame. Exiting
+ * threads share one block, so the histograms are published with CAS.
+ */
+int latency_hist_alloc(struct counters_block *cb)
+{
+	unsigned long *lat, *old = NULL;
+
+	lat = meta_alloc(EVENT_MAX * LAT_BUCKETS * sizeof(*lat));
+	if (!lat)
+		return -1;
+
+	if (!__atomic_compare_exchange_n(&cb->lat, &old, lat, 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		meta_free(lat);
+	return 0;
+}
+
+static uint64_t bucket_ticks(int bucket)
+{
+	int msb;
+
+	if (bucket < LAT_SUB_BUCKETS)
+		return bucket;
+
+	msb = (bucket >> LAT_SUB_BITS) + LAT_SUB_BITS - 1;
+	return (uint64_t)(LAT_SUB_BUCKETS + (bucket & (LAT_SUB_BUCKETS - 1)))
+		<< (msb - LAT_SUB_BITS);
+}
+
+void latency_dump(struct options *opts)
+{
+	static unsigned long hist[EVENT_MAX][LAT_BUCKETS];
+	struct counters_block *cb;
+	struct timeval tv;
+	int type, i;
+
+	pthread_mutex_lock(&dump_lock);
+
+	memset(hist, 0x00, sizeof(hist));
+	for (cb = counters_list(); cb; cb = cb->next) {
+		unsigned long *lat = __atomic_load_n(&cb->lat,
+				__ATOMIC_ACQUIRE);
+
+		if (!lat)
+			continue;
+
+		for (type = 0; type < EVENT_MAX; type++)
+			for (i = 0; i < LAT_BUCKETS; i++)
+				hist[type][i] += __atomic_load_n(
+						&lat[type * LAT_BUCKETS + i],
+						__ATOMIC_RELAXED);
+	}
+
+	latency_calibrate();
+
+	gettimeofday(&tv, NULL);
+	output("[g:%lu:%lu.%06d:%lu]\n", ++dump_seq,
+			(unsigned long)tv.tv_sec,
+			(int)tv.tv_usec,
+			latency_ns(latency_threshold));
+	output_commit(opts);
+
+	for (type = 0; type < EVENT_MAX; type++) {
+		int first = 1;
+
+		for (i = 0; i < LAT_BUCKETS; i++) {
+			if (!hist[type][i])
+				continue;
+
+			if (first)
+				output("[G:%s:", event_names[type].human_name);
+			output("%s%lu=%lu", first ? "" : ",",
+					latency_ns(bucket_ticks(i)),
+					hist[type][i]);
+			first = 0;
+		}
+
+		if (!first) {
+			output("]\n");
+			output_commit(opts);
+		}
+	}
+
+	pthread_mutex_unlock(&dump_lock);
+}
+
+/*
+ * MTRACE_LATENCY_THRESHOLD=NS, 10 microseconds by default. Spins for a
+ * millisecond to get the first estimate of the counter frequency, only
+ * the first call does anything.
+ */
+int latency_setup(struct options *opts __attribute__((unused)))
+{
+	uint64_t threshold = LATENCY_DEF_THRESHOLD_NS;
+	static int ready;
+
+	if (ready)
+		return 0;
+	ready = 1;
+
+	if (getenv("MTRACE_LATENCY_THRESHOLD"))
+		threshold = strtoull(getenv("MTRACE_LATENCY_THRESHOLD"),
+				NULL, 10);
+
+	base_ticks = latency_now();
+	base_ns = clock_ns();
+	while (clock_ns() - base_ns < LATENCY_CALIBRATE_NS)
+		;
+	latency_calibrate();
+
+	latency_threshold = threshold * ticks_per_ns;
+	return 0;
+}
+
+/*
+ * Held across fork(), a dump is never cut off half way in the child.
+ */
+void latency_fork_prepare(void)
+{
+	pthread_mutex_lock(&dump_lock);
+}
+
+void latency_fork_parent(void)
+{
+	pthread_mutex_unlock(&dump_lock);
+}
+
+void latency_fork_child(void)
+{
+	pthread_mutex_unlock(&dump_lock);
+}
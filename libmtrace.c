@@ -36,6 +36,8 @@
 #include <signal.h>
 #include <pthread.h>
 #include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
 
 #ifndef UNW_LOCAL_ONLY
 #define UNW_LOCAL_ONLY
@@ -48,6 +50,24 @@
 #include <unwind_trace.h>
 #include <options.h>
 #include <maps_cache.h>
+#include <ratelimit.h>
+#include <filter.h>
+#include <control.h>
+#include <sampler.h>
+#include <trigger.h>
+#include <memgrow.h>
+#include <profile.h>
+#include <counters.h>
+#include <latency.h>
+#include <heapstat.h>
+#include <cold.h>
+#include <numa.h>
+#include <tag.h>
+#include <livestats.h>
+#include <got.h>
+#include <bootstrap.h>
+#include <meta.h>
+#include <lineage.h>
 
 #include <event_names.h>
 
@@ -55,13 +75,20 @@ static struct options opts;
 
 static int global_init_done;
 static volatile __thread int __tf_depth;
-
-static size_t __init_buffer_offset;
-static char __init_buffer[INIT_BUF_SZ];
+static __thread unsigned long __tf_callsite;
+static __thread uint64_t __tf_latency;
 
 static int page_size = DEFAULT_PAGE_SIZE;
 static int phys_page_size = DEFAULT_PAGE_SIZE;
 
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE	23
+#endif
+
+#define POPULATE_WRITE_MIN_PAGES	16
+
+static int madv_populate_write = 1;
+
 static void * (*glibc_malloc)(size_t) 				= malloc;
 static void * (*glibc_calloc)(size_t, size_t) 			= calloc;
 static void * (*glibc_realloc)(void *, size_t) 			= realloc;
@@ -88,6 +115,16 @@ static int (*glibc_posix_memalign)(void **, size_t, size_t) 	= posix_memalign;
 #ifdef HAVE_ALIGNED_ALLOC
 static void *(*glibc_aligned_alloc)(size_t, size_t)		= aligned_alloc;
 #endif
+#ifdef HAVE_REALLOCARRAY
+static void *(*glibc_reallocarray)(void *, size_t, size_t)	= reallocarray;
+#endif
+#ifdef HAVE_FREE_SIZED
+static void (*glibc_free_sized)(void *, size_t)			= free_sized;
+#endif
+#ifdef HAVE_FREE_ALIGNED_SIZED
+static void (*glibc_free_aligned_sized)(void *, size_t, size_t)	= free_aligned_sized;
+#endif
+static size_t (*glibc_malloc_usable_size)(void *)		= malloc_usable_size;
 
 #ifndef __USE_FILE_OFFSET64
 static void * (*glibc_mmap)(void *, size_t, int, int,
@@ -97,6 +134,10 @@ static void * (*glibc_mmap)(void *, size_t, int, int,
 				int, off64_t)			= mmap;
 #endif
 static int (*glibc_munmap)(void *, size_t) 			= munmap;
+static void * (*glibc_mremap)(void *, size_t, size_t, int, ...)	= mremap;
+static int (*glibc_madvise)(void *, size_t, int)		= madvise;
+static int (*glibc_brk)(void *)					= brk;
+static void * (*glibc_sbrk)(intptr_t)				= sbrk;
 #ifdef HAVE_MMAP2
 static void * (*glibc_mmap2)(void *, size_t, int, int,
 				int, off_t)			= mmap2;
@@ -107,63 +148,16 @@ static int (*glibc_mlockall)(int)				= mlockall;
 static int (*glibc_munlockall)(void) 				= munlockall;
 static char * (*glibc_getenv)(const char *)			= getenv;
 static int (*glibc_dlclose)(void *)				= dlclose;
+static void * (*glibc_dlopen)(const char *, int)		= dlopen;
 
 static void __init_mtrace(void);
 
 #define TRACING_DISABLE()	__tf_depth++;
 #define TRACING_ENABLE()	__tf_depth--;
 
-static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
-
 static unsigned long alloc_min_wmark = 0;
 static unsigned long alloc_max_wmark = ULONG_MAX;
 
-static unsigned long memparse(const char *mem)
-{
-	char *end;
-
-	unsigned long ret = strtoul(mem, &end, 10);
-
-	switch (*end) {
-		case 'G':
-		case 'g':
-			ret <<= 10;
-		case 'M':
-		case 'm':
-			ret <<= 10;
-		case 'K':
-		case 'k':
-			ret <<= 10;
-		default:
-			break;
-	}
-
-	return ret;
-}
-
-/*
- * We need to serialize events that update/change RSS in /proc/self/statm.
- *
- * only in OPTS_MEM_GROW_MODE mode, because otherwise we don't care about
- * RSS value.
- */
-static void lock_tracer()
-{
-	if (!(opts.flags & OPTS_MEM_GROW_MODE))
-		return;
-
-	if (pthread_mutex_lock(&lock))
-		abort();
-}
-
-static void unlock_tracer()
-{
-	if (!(opts.flags & OPTS_MEM_GROW_MODE))
-		return;
-
-	pthread_mutex_unlock(&lock);
-}
-
 #ifdef HAVE_ATOMIC_BACKTRACE
 static __thread sigset_t old_sigset;
 static __thread sigset_t new_sigset;
@@ -204,43 +198,6 @@ static const char *event_name(int type)
 	return event_names[type].compact_name;
 }
 
-static unsigned long get_memsize(void)
-{
-/*
-          /proc/[pid]/statm
-              Provides information about memory usage, measured in pages.
-              The columns are:
-
-                  size       (1) total program size
-                             (same as VmSize in /proc/[pid]/status)
-                  resident   (2) resident set size
-                             (same as VmRSS in /proc/[pid]/status)
-                  shared     (3) number of resident shared pages (i.e., backed by a file)
-                             (same as RssFile+RssShmem in /proc/[pid]/status)
-                  text       (4) text (code)
-                  lib        (5) library (unused since Linux 2.6; always 0)
-                  data       (6) data + stack
-                  dt         (7) dirty pages (unused since Linux 2.6; always 0)
-*/
-
-	/* VSZ RSS */
-	unsigned long mem[2] = {0, 0};
-	char buf[64];
-
-	int fd = open("/proc/self/statm", O_RDONLY);
-	if (fd < 0)
-		return 0;
-
-	memset(buf, 0x00, sizeof(buf));
-	if (read(fd, buf, sizeof(buf)) >= sizeof(mem))
-		sscanf(buf, "%lu %lu", &mem[0], &mem[1]);
-
-	close(fd);
-
-	/* return RSS. in page_size units */
-	return mem[1];
-}
-
 /*
     https://sourceware.org/ml/libc-help/2009-06/msg00001.html
 
@@ -292,7 +249,12 @@ static void __init(void)
 	}
 }
 
-static int event_start_frame(void)
+/*
+ * Helpers that take `mode' are given either opts.flags or, by generated
+ * interposers, a constant reporting mode: see event_specialize().
+ */
+static inline __attribute__((always_inline))
+int __event_start_frame(unsigned long mode, unsigned long callsite)
 {
 	volatile int start;
 
@@ -300,18 +262,196 @@ static int event_start_frame(void)
 	start = __tf_depth - 1;
 
 	if (start == 0) {
+		__tf_callsite = callsite;
+		__tf_latency = 0;
+		if (mode & OPTS_MEM_GROW_MODE)
+			memgrow_start();
 		__block_all_signals();
+
+		/* profile mode doesn't write events to the trace */
+		if (mode & OPTS_PROFILE_MODE)
+			return 0;
+
 		output_event_pid();
 		output_event_timestamp();
 	}
 	return start == 0;
 }
 
+/*
+ * Must be expanded in the interposer itself, we want the address
+ * of its caller.
+ */
+#define event_start_frame()	\
+	__event_start_frame(opts.flags,	\
+			(unsigned long)__builtin_return_address(0))
+
+/*
+ * Pending control commands are handled by the first top level event
+ * that notices them.
+ */
+static int control_slow_path(void)
+{
+	if ((mtrace_ctl & CTL_PENDING) && !__tf_depth) {
+		TRACING_DISABLE();
+		control_process();
+		TRACING_ENABLE();
+	}
+
+	if ((mtrace_ctl & CTL_SNAPSHOT) && !__tf_depth) {
+		__atomic_and_fetch(&mtrace_ctl, ~CTL_SNAPSHOT,
+				__ATOMIC_RELAXED);
+		TRACING_DISABLE();
+		profile_snapshot(&opts, "signal");
+		TRACING_ENABLE();
+	}
+
+	return mtrace_ctl & (CTL_DISABLED | CTL_DISARMED);
+}
+
+static void thread_counters_init(void)
+{
+	if (__builtin_expect(!counters_tls, 0)) {
+		TRACING_DISABLE();
+		counters_register();
+		TRACING_ENABLE();
+	}
+}
+
+/*
+ * Events rejected by MTRACE_FILTER, or by disabled tracing, go straight
+ * to glibc, before we output anything. Nested events are hidden by the
+ * event frames anyway. Counters mode only counts events and rejects
+ * all of them, live stats count them and let them through.
+ */
+static int __event_rejected(int type, size_t __size, unsigned long callsite)
+{
+	if (__builtin_expect(mtrace_ctl, 0) && control_slow_path())
+		return 1;
+
+	if (__tf_depth)
+		return 0;
+
+	/* the size distribution is not affected by filters */
+	if (opts.flags & OPTS_SIZE_HISTOGRAM) {
+		thread_counters_init();
+		counters_hist(type, __size);
+	}
+
+	if (filter_reject(type, __size, callsite))
+		return 1;
+
+	if (opts.flags & (OPTS_COUNTERS_MODE | OPTS_LIVE_STATS)) {
+		thread_counters_init();
+		counters_inc(type, __size);
+		if (opts.flags & OPTS_LIVE_STATS)
+			livestats_callsite(callsite, __size);
+	}
+	return !!(opts.flags & OPTS_COUNTERS_MODE);
+}
+
+#define event_rejected(type, size)	\
+	__event_rejected(type, size, (unsigned long)__builtin_return_address(0))
+
 static int is_event_top_frame(void)
 {
 	return __tf_depth == 1;
 }
 
+static inline __attribute__((always_inline))
+int __is_event_traced(unsigned long mode)
+{
+	if (!is_event_top_frame() || (mode & OPTS_PROFILE_MODE))
+		return 0;
+
+	/* latency mode traces only slow calls */
+	if (mode & OPTS_LATENCY_MODE)
+		return __tf_latency >= latency_threshold;
+	return 1;
+}
+
+#define is_event_traced()	__is_event_traced(opts.flags)
+
+static inline __attribute__((always_inline))
+int __is_event_timed(unsigned long mode)
+{
+	return (mode & OPTS_LATENCY_MODE) && is_event_top_frame();
+}
+
+static void latency_event(int type, uint64_t ticks)
+{
+	thread_counters_init();
+	latency_inc(type, ticks);
+
+	/* fast call, drop the event header */
+	__tf_latency = ticks;
+	if (ticks < latency_threshold)
+		output_discard();
+}
+
+/*
+ * Latency mode times the real call of top level events, nothing else
+ * is done between the two reads of the cycle counter.
+ */
+#define __timed_call(mode, type, call)					\
+	do {								\
+		uint64_t __start;					\
+									\
+		if (!__is_event_timed(mode)) {				\
+			call;						\
+			break;						\
+		}							\
+		__start = latency_now();				\
+		call;							\
+		latency_event(type, latency_now() - __start);		\
+	} while (0)
+
+#define timed_call(type, call)	__timed_call(opts.flags, type, call)
+
+/*
+ * Profile mode aggregates allocations in memory instead of tracing
+ * them, the leak report needs only the pointer table. See profile.c
+ */
+static inline __attribute__((always_inline))
+int __is_event_profiled(unsigned long mode)
+{
+	/* the leak report is not a reporting mode */
+	if (!(mode & OPTS_PROFILE_MODE) && !(opts.flags & OPTS_LIVE_TABLE))
+		return 0;
+	return is_event_top_frame();
+}
+
+#define is_event_profiled()	__is_event_profiled(opts.flags)
+
+/*
+ * Frees go first, before the block can be reused by other threads.
+ * Allocations go last, a new stack adds records to the event output.
+ */
+static void profile_update(void *__old, void *__new, size_t __size)
+{
+	if (__old)
+		profile_free(__old);
+
+	if (!__new)
+		return;
+
+	if (opts.flags & OPTS_ALLOC_WMARK) {
+		if (__size < alloc_min_wmark || __size > alloc_max_wmark)
+			return;
+	}
+
+	profile_alloc(&opts, __new, __size);
+}
+
+#define __profile_event(mode, old, new, size)				\
+	do {								\
+		if (__is_event_profiled(mode))				\
+			profile_update(old, new, size);			\
+	} while (0)
+
+#define profile_event(old, new, size)					\
+	__profile_event(opts.flags, old, new, size)
+
 static int event_end_frame(void)
 {
 	if (is_event_top_frame()) {
@@ -324,40 +464,52 @@ static int event_end_frame(void)
 
 static int can_backtrace(size_t __size, int type)
 {
+	if (tag_current())
+		output("[T:%d]\n", tag_current());
+
 	if (opts.flags & OPTS_ALLOC_WMARK) {
 		if (type > MAX_STATS)
 			return 0;
 
-		return alloc_min_wmark <= __size &&
-			__size <= alloc_max_wmark;
+		if (__size < alloc_min_wmark || __size > alloc_max_wmark)
+			return 0;
+
+		/* watermarks alone, no reporting mode was requested */
+		if (!(opts.flags & OPTS_REPORTING_MODES))
+			return 1;
 	}
 
 	if (opts.flags & OPTS_MEM_GROW_MODE) {
+		unsigned long __faults;
 		unsigned long __memsz;
-		unsigned long __old_memsz;
 
-		__memsz = get_memsize();
-		if (__memsz == 0)
+		if (type > MAX_STATS)
 			return 0;
 
-		__old_memsz = opts.stats[type];
-		/* always update stats */
-		opts.stats[type] = __memsz;
+		__faults = memgrow_faults();
+		if (type != STATS_MMAP_SZ && __faults == 0)
+			return 0;
 
-		if (type > MAX_STATS)
+		__memsz = memgrow_rss();
+		if (__memsz == 0)
 			return 0;
+		if (__faults > __memsz)
+			__faults = __memsz;
 
-		if (type == STATS_MMAP_SZ || __memsz > __old_memsz) {
-			output("[m:%ld-%ld]\n",
-				__old_memsz * page_size,
-				__memsz * page_size);
-			return 1;
-		}
-		return 0;
+		/* RSS before and after the pages faulted in by this event */
+		output("[m:%ld-%ld]\n",
+			(__memsz - __faults) * page_size,
+			__memsz * page_size);
+		return 1;
 	}
 
-	if (opts.flags & OPTS_FULL_REPORT_MODE)
+	if (opts.flags & OPTS_LATENCY_MODE) {
+		output("[l:%lu]\n", latency_ns(__tf_latency));
 		return 1;
+	}
+
+	if (opts.flags & OPTS_FULL_REPORT_MODE)
+		return ratelimit_check(__tf_callsite);
 
 	if (opts.flags & OPTS_ALLOC_ONLY_MODE) {
 		if (type == STATS_MALLOC_SZ || type == STATS_MMAP_SZ)
@@ -379,550 +531,787 @@ static int can_backtrace(size_t __size, int type)
 	return 0;
 }
 
-static void *__init_alloc(size_t __size, size_t __alignment)
-{
-	size_t prev_offset = __init_buffer_offset;
-
-	__size = ALIGN(__size, __alignment);
-	__init_buffer_offset += __size;
-
-	if (__init_buffer_offset >= sizeof(__init_buffer)) {
-		fprintf(stderr, "ERROR: init buf size exhausted: "
-				"%zu requested, %zu available\n",
-				__init_buffer_offset, sizeof(__init_buffer));
-		abort();
-	}
-
-	return __init_buffer + prev_offset;
-}
-
+#ifdef HAVE_MEMSET
 /*
- * Force page-faults
+ * memset() before glibc_memset is known
  */
 static void *__init_memset(void *__s, int __c, size_t __n)
 {
 	volatile char *____s = __s;
-	volatile int i;
+	volatile size_t i;
 
 	for (i = 0 ; i < __n; i++)
-		____s[i] = 0x00;
+		____s[i] = (char)__c;
 	return (void *)____s;
 }
+#endif
 
-static void __init_free(void *ptr)
+#ifdef HAVE_MEMMOVE
+/*
+ * memmove() before glibc_memmove is known
+ */
+static void *__init_memmove(void *__dest, const void *__src, size_t __n)
 {
-	/* do nothing here */
+	volatile char *d = __dest;
+	const volatile char *s = __src;
+	size_t i;
+
+	if (d < s) {
+		for (i = 0; i < __n; i++)
+			d[i] = s[i];
+	} else {
+		for (i = __n; i > 0; i--)
+			d[i - 1] = s[i - 1];
+	}
+	return __dest;
 }
+#endif
 
-static void *forced_pgfault(void *__s, size_t __n)
+/*
+ * realloc() of a bootstrap block once we are initialized, the data
+ * moves to a block from `alloc'. Zero size frees the block, like glibc.
+ */
+static void *bootstrap_move(void *__ptr, size_t __size,
+			    void *(*alloc)(size_t))
 {
-	if (!(opts.flags & OPTS_MEM_GROW_MODE))
-		return __s;
+	size_t old = bootstrap_usable_size(__ptr);
+	void *ret;
+
+	if (!__size) {
+		bootstrap_free(__ptr);
+		return NULL;
+	}
 
-	if (!__s)
-		return __s;
+	ret = alloc(__size);
 
-	return __init_memset(__s, 0x00, __n);
+	if (ret) {
+		memcpy(ret, __ptr, old < __size ? old : __size);
+		bootstrap_free(__ptr);
+	}
+	return ret;
 }
 
-/* Allocate SIZE bytes of memory.  */
-void *malloc(size_t __size)
+static void touch_pages(unsigned long start, unsigned long end)
 {
-	void *ret;
+	unsigned long page_mask = ~((unsigned long)page_size - 1);
+	unsigned long addr;
 
-	__init();
-
-	if (!global_init_done)
-		return __init_alloc(__size, MIN_ALIGNMENT);
+	/* read and write back, the contents must not change */
+	for (addr = start; addr < end; addr = (addr & page_mask) + page_size) {
+		volatile char *p = (volatile char *)addr;
 
-	if (event_start_frame()) {
-		lock_tracer();
-		output("%s(%lu)", event_name(EVENT_MALLOC), __size);
+		*p = *p;
 	}
+}
 
-	ret = glibc_malloc(__size);
-	forced_pgfault(ret, __size);
+/*
+ * Force page-faults
+ *
+ * Touch one byte per page, in place. Large ranges are populated by
+ * the kernel with MADV_POPULATE_WRITE (Linux 5.14), which also
+ * preserves the contents.
+ */
+static void fault_in_range(void *__s, size_t __n)
+{
+	unsigned long page_mask = ~((unsigned long)page_size - 1);
+	unsigned long start = (unsigned long)__s;
+	unsigned long end = start + __n;
 
-	if (is_event_top_frame()) {
-		int trace;
+	if (!__s || !__n)
+		return;
 
-		output("=0x%x\n", ret);
-		trace = can_backtrace(__size, STATS_MALLOC_SZ);
-		unlock_tracer();
-		if (trace)
-			unwind_trace(&opts);
+	if (madv_populate_write &&
+			__n >= POPULATE_WRITE_MIN_PAGES * page_size) {
+		unsigned long pstart = ALIGN(start, (unsigned long)page_size);
+		unsigned long pend = end & page_mask;
+
+		if (!glibc_madvise((void *)pstart, pend - pstart,
+					MADV_POPULATE_WRITE)) {
+			touch_pages(start, pstart);
+			touch_pages(pend, end);
+			return;
+		}
+
+		/* old kernel, don't try again */
+		if (errno == EINVAL)
+			madv_populate_write = 0;
 	}
-	event_end_frame();
-	return ret;
+
+	touch_pages(start, end);
 }
 
-/* Allocate NMEMB elements of SIZE bytes each, all initialized to 0.  */
-void *calloc(size_t __nmemb, size_t __size)
-{
-	void *ret;
+#define __forced_pgfault(mode, s, n)					\
+	do {								\
+		if ((mode) & OPTS_MEM_GROW_MODE)			\
+			fault_in_range(s, n);				\
+	} while (0)
 
-	__init();
+#define forced_pgfault(s, n)	__forced_pgfault(opts.flags, s, n)
 
-	if (!global_init_done)
-		return __init_alloc(__nmemb * __size, MIN_ALIGNMENT);
+static int madvise_releases(int advice)
+{
+	switch (advice) {
+	case MADV_DONTNEED:
+	case MADV_REMOVE:
+#ifdef MADV_FREE
+	case MADV_FREE:
+#endif
+		return 1;
+	}
+	return 0;
+}
 
-	if (event_start_frame()) {
-		lock_tracer();
-		output("%s(%lu, %lu)",
-			event_name(EVENT_CALLOC),
-			__nmemb,
-			__size);
+/*
+ * Generated interposers, see include/interposers.def
+ *
+ * The event path is expanded once per reporting mode that changes it,
+ * with `mode' a constant: checks of the other modes drop out at compile
+ * time. Modes that differ only in can_backtrace() share the generic
+ * expansion. Rejected events never get that far.
+ */
+#define event_specialize(event, ...)					\
+	switch (opts.flags & (OPTS_PROFILE_MODE |			\
+			      OPTS_LATENCY_MODE |			\
+			      OPTS_MEM_GROW_MODE)) {			\
+	case OPTS_PROFILE_MODE:						\
+		event(OPTS_PROFILE_MODE, __VA_ARGS__);			\
+		break;							\
+	case OPTS_LATENCY_MODE:						\
+		event(OPTS_LATENCY_MODE, __VA_ARGS__);			\
+		break;							\
+	case OPTS_MEM_GROW_MODE:					\
+		event(OPTS_MEM_GROW_MODE, __VA_ARGS__);			\
+		break;							\
+	default:							\
+		event(0, __VA_ARGS__);					\
+		break;							\
 	}
 
-	ret = glibc_calloc(__nmemb, __size);
-	forced_pgfault(ret, __nmemb * __size);
+/* (a, b) expands to `, a, b', () to nothing */
+#define EVENT_ARGS(...)		, ##__VA_ARGS__
+
+#define early_abort()							\
+	do {								\
+		__init();						\
+		if (!global_init_done)					\
+			abort();					\
+	} while (0)
+
+#define early_return(val)						\
+	do {								\
+		__init();						\
+		if (!global_init_done)					\
+			return val;					\
+	} while (0)
+
+#define early_usable_size(ptr)						\
+	do {								\
+		__init();						\
+		if (!global_init_done || bootstrap_owns(ptr))		\
+			return bootstrap_usable_size(ptr);		\
+	} while (0)
+
+#define early_noinit(val)						\
+	do {								\
+		if (!global_init_done)					\
+			return val;					\
+	} while (0)
+
+#define ALLOC_EVENT(mode, id, name, args, fmt, fmt_args, size)		\
+	do {								\
+		if (__event_start_frame(mode, callsite))		\
+			output("%s" fmt, event_name(EVENT_##id)		\
+					EVENT_ARGS fmt_args);		\
+									\
+		__timed_call(mode, EVENT_##id, ret = glibc_##name args);\
+		__forced_pgfault(mode, ret, size);			\
+									\
+		if (__is_event_traced(mode)) {				\
+			output("=0x%x\n", ret);				\
+			if (can_backtrace(size, STATS_MALLOC_SZ))	\
+				unwind_trace(&opts);			\
+		}							\
+		__profile_event(mode, NULL, ret, size);			\
+		event_end_frame();					\
+	} while (0)
+
+#define INTERPOSE_ALLOC(id, name, params, args, fmt, fmt_args,		\
+			size, align)					\
+void *name params							\
+{									\
+	unsigned long callsite;						\
+	void *ret;							\
+									\
+	__init();							\
+									\
+	if (!global_init_done)						\
+		return bootstrap_alloc(size, align);			\
+									\
+	callsite = (unsigned long)__builtin_return_address(0);		\
+	if (__event_rejected(EVENT_##id, size, callsite)) {		\
+		TRACING_DISABLE();					\
+		ret = glibc_##name args;				\
+		TRACING_ENABLE();					\
+		return ret;						\
+	}								\
+									\
+	event_specialize(ALLOC_EVENT, id, name, args, fmt, fmt_args,	\
+			 size)						\
+	return ret;							\
+}
 
-	if (is_event_top_frame()) {
-		int trace;
+#define FREE_EVENT(mode, id, name, args, fmt, fmt_args, ptr)		\
+	do {								\
+		if (__event_start_frame(mode, callsite))		\
+			output("%s" fmt "\n", event_name(EVENT_##id)	\
+					EVENT_ARGS fmt_args);		\
+									\
+		__profile_event(mode, ptr, NULL, 0);			\
+		__timed_call(mode, EVENT_##id, glibc_##name args);	\
+									\
+		if (__is_event_traced(mode) &&				\
+				can_backtrace(0, STATS_FREE))		\
+			unwind_trace(&opts);				\
+		event_end_frame();					\
+	} while (0)
+
+#define INTERPOSE_FREE(id, name, params, args, fmt, fmt_args,		\
+		       ptr, size)					\
+void name params							\
+{									\
+	unsigned long callsite;						\
+									\
+	__init();							\
+									\
+	/* bootstrap blocks never reach glibc */			\
+	if (!global_init_done || bootstrap_owns(ptr)) {			\
+		bootstrap_free(ptr);					\
+		return;							\
+	}								\
+									\
+	callsite = (unsigned long)__builtin_return_address(0);		\
+	if (__event_rejected(EVENT_##id, size, callsite)) {		\
+		TRACING_DISABLE();					\
+		glibc_##name args;					\
+		TRACING_ENABLE();					\
+		return;							\
+	}								\
+									\
+	event_specialize(FREE_EVENT, id, name, args, fmt, fmt_args, ptr)\
+}
 
-		output("=0x%x\n", ret);
-		trace = can_backtrace(__size * __nmemb, STATS_MALLOC_SZ);
-		unlock_tracer();
-		if (trace)
-			unwind_trace(&opts);
-	}
-	event_end_frame();
-	return ret;
+#define AUX_EVENT(mode, id, name, args, fmt, fmt_args, ret_fmt,	\
+		  size, stats)						\
+	do {								\
+		if (__event_start_frame(mode, callsite))		\
+			output("%s" fmt, event_name(EVENT_##id)		\
+					EVENT_ARGS fmt_args);		\
+									\
+		__timed_call(mode, EVENT_##id, ret = glibc_##name args);\
+									\
+		if (__is_event_traced(mode)) {				\
+			output(ret_fmt, ret);				\
+			if (can_backtrace(size, stats))			\
+				unwind_trace(&opts);			\
+		}							\
+		event_end_frame();					\
+	} while (0)
+
+#define INTERPOSE_AUX(id, type, name, params, args, fmt, fmt_args,	\
+		      ret_fmt, size, stats, early)			\
+type name params							\
+{									\
+	unsigned long callsite;						\
+	type ret;							\
+									\
+	early;								\
+									\
+	callsite = (unsigned long)__builtin_return_address(0);		\
+	if (__event_rejected(EVENT_##id, size, callsite)) {		\
+		TRACING_DISABLE();					\
+		ret = glibc_##name args;				\
+		TRACING_ENABLE();					\
+		return ret;						\
+	}								\
+									\
+	event_specialize(AUX_EVENT, id, name, args, fmt, fmt_args,	\
+			 ret_fmt, size, stats)				\
+	return ret;							\
 }
 
+#include <interposers.def>
+
 /* Re-allocate the previously allocated block in __ptr, making the new
    block SIZE bytes long.  */
 void *realloc(void *__ptr, size_t __size)
 {
+	struct live_ptr old;
+	int tracked = 0;
 	void *ret;
 
-	if (!global_init_done) {
-		__init_free(__ptr);
-		return __init_alloc(__size, MIN_ALIGNMENT);
+	__init();
+
+	if (!global_init_done)
+		return bootstrap_realloc(__ptr, __size);
+
+	if (bootstrap_owns(__ptr))
+		return bootstrap_move(__ptr, __size, malloc);
+
+	if (event_rejected(EVENT_REALLOC, __size)) {
+		TRACING_DISABLE();
+		ret = glibc_realloc(__ptr, __size);
+		TRACING_ENABLE();
+		return ret;
 	}
 
 	if (event_start_frame()) {
-		lock_tracer();
 		output("%s(0x%x, %lu)",
 			event_name(EVENT_REALLOC),
 			__ptr,
 			__size);
 	}
 
-	ret = glibc_realloc(__ptr, __size);
+	/*
+	 * The old block goes first. A failed realloc() leaves it alone and
+	 * it goes back, realloc(ptr, 0) frees it.
+	 */
+	if (is_event_profiled())
+		tracked = profile_free_start(__ptr, &old);
+	timed_call(EVENT_REALLOC, ret = glibc_realloc(__ptr, __size));
+	if (tracked)
+		profile_free_end(&old, !ret && __size);
+	forced_pgfault(ret, __size);
 
-	if (is_event_top_frame()) {
+	if (is_event_traced()) {
 		int trace;
 
 		output("=0x%x\n", ret);
 		trace = can_backtrace(__size, STATS_MALLOC_SZ);
-		unlock_tracer();
 		if (trace)
 			unwind_trace(&opts);
 	}
+	profile_event(NULL, ret, __size);
 	event_end_frame();
 	return ret;
 }
 
-/* Free a block allocated by `malloc', `realloc' or `calloc'.  */
-void free(void *__ptr)
+#ifdef HAVE_REALLOCARRAY
+void *reallocarray(void *__ptr, size_t __nmemb, size_t __size)
 {
-	if (!global_init_done) {
-		__init_free(__ptr);
-		return;
-	}
+	struct live_ptr old;
+	int tracked = 0;
+	size_t total;
+	void *ret;
 
-	if (event_start_frame()) {
-		lock_tracer();
-		output("%s(0x%x)\n", event_name(EVENT_FREE), __ptr);
-	}
+	/* glibc fails with ENOMEM, account nothing */
+	if (__builtin_mul_overflow(__nmemb, __size, &total))
+		total = 0;
 
-	glibc_free(__ptr);
+	__init();
 
-	if (is_event_top_frame()) {
-		int trace = can_backtrace(0, STATS_FREE);
+	if (!global_init_done)
+		return bootstrap_realloc(__ptr, total);
 
-		unlock_tracer();
-		if (trace)
-			unwind_trace(&opts);
+	if (bootstrap_owns(__ptr)) {
+		/* an overflow is not a zero size, the block stays */
+		if (!total && __nmemb && __size) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		return bootstrap_move(__ptr, total, malloc);
 	}
-	event_end_frame();
-}
 
-#ifdef HAVE_CFREE
-/* Free a block allocated by `calloc'. */
-void cfree(void *__ptr)
-{
-	if (!global_init_done) {
-		__init_free(__ptr);
-		return;
+	if (event_rejected(EVENT_REALLOCARRAY, total)) {
+		TRACING_DISABLE();
+		ret = glibc_reallocarray(__ptr, __nmemb, __size);
+		TRACING_ENABLE();
+		return ret;
 	}
 
 	if (event_start_frame()) {
-		lock_tracer();
-		output("%s(0x%x)\n", event_name(EVENT_CFREE), __ptr);
+		output("%s(0x%x, %lu, %lu)",
+			event_name(EVENT_REALLOCARRAY),
+			__ptr,
+			__nmemb,
+			__size);
 	}
 
-	glibc_cfree(__ptr);
-
-	if (is_event_top_frame()) {
-		int trace = can_backtrace(0, STATS_FREE);
+	/*
+	 * The old block goes first. A failed reallocarray(), including an
+	 * overflow, puts it back, a zero sized one frees it.
+	 */
+	if (is_event_profiled())
+		tracked = profile_free_start(__ptr, &old);
+	timed_call(EVENT_REALLOCARRAY,
+		   ret = glibc_reallocarray(__ptr, __nmemb, __size));
+	if (tracked)
+		profile_free_end(&old, !ret && __nmemb && __size);
+	forced_pgfault(ret, total);
+
+	if (is_event_traced()) {
+		int trace;
 
-		unlock_tracer();
+		output("=0x%x\n", ret);
+		trace = can_backtrace(total, STATS_MALLOC_SZ);
 		if (trace)
 			unwind_trace(&opts);
 	}
+	profile_event(NULL, ret, total);
 	event_end_frame();
+	return ret;
 }
 #endif
 
-/* Allocate SIZE bytes allocated to ALIGNMENT bytes.  */
-void *memalign(size_t __alignment, size_t __size)
+#ifdef HAVE_POSIX_MEMALIGN
+int posix_memalign(void **__memptr, size_t __alignment, size_t __size)
 {
-	void *ret;
+	int ret;
 
 	__init();
 
-	if (!global_init_done)
-		return __init_alloc(__size, __alignment);
+	if (!global_init_done) {
+		*__memptr = bootstrap_alloc(__size, __alignment);
+		return *__memptr ? 0 : ENOMEM;
+	}
 
-	if (event_start_frame()) {
-		lock_tracer();
-		output("%s(%lu, %lu)", event_name(EVENT_MEMALIGN),
-				__alignment, __size);
-	}
-
-	ret = glibc_memalign(__alignment, __size);
-	forced_pgfault(ret, ALIGN(__size, __alignment));
-
-	if (is_event_top_frame()) {
-		int trace;
-
-		output("=0x%x\n", ret);
-		trace = can_backtrace(ALIGN(__size, __alignment),
-				STATS_MALLOC_SZ);
-		unlock_tracer();
-		if (trace)
-			unwind_trace(&opts);
-	}
-	event_end_frame();
-	return ret;
-}
-
-#ifdef HAVE_POSIX_MEMALIGN
-int posix_memalign(void **__memptr, size_t __alignment, size_t __size)
-{
-	int ret;
-
-	__init();
-
-	if (!global_init_done) {
-		*__memptr = __init_alloc(__size, __alignment);
-		return 0;
+	if (event_rejected(EVENT_POSIX_MEMALIGN, __size)) {
+		TRACING_DISABLE();
+		ret = glibc_posix_memalign(__memptr, __alignment,
+				__size);
+		TRACING_ENABLE();
+		return ret;
 	}
 
 	if (event_start_frame()) {
-		lock_tracer();
 		output("%s(%lu, %lu)", event_name(EVENT_POSIX_MEMALIGN),
 				__alignment, __size);
 	}
 
-	ret = glibc_posix_memalign(__memptr, __alignment, __size);
-	forced_pgfault(*__memptr, ALIGN(__size, __alignment));
+	timed_call(EVENT_POSIX_MEMALIGN,
+		   ret = glibc_posix_memalign(__memptr, __alignment, __size));
+	/* *__memptr is not set on failure, the block ends at __size */
+	if (!ret)
+		forced_pgfault(*__memptr, __size);
 
-	if (is_event_top_frame()) {
+	if (is_event_traced()) {
 		int trace;
 
 		output("=0x%x\n", *__memptr);
 		trace = can_backtrace(ALIGN(__size, __alignment),
 				STATS_MALLOC_SZ);
-		unlock_tracer();
 		if (trace)
 			unwind_trace(&opts);
 	}
+	profile_event(NULL, ret ? NULL : *__memptr, __size);
 	event_end_frame();
 	return ret;
 }
 #endif
 
-#ifdef HAVE_ALIGNED_ALLOC
-void *aligned_alloc(size_t __alignment, size_t __size)
+/* Map addresses starting near ADDR and extending for LEN bytes.  from
+   OFFSET into the file FD describes according to PROT and FLAGS.  If ADDR
+   is nonzero, it is the desired mapping address.  If the MAP_FIXED bit is
+   set in FLAGS, the mapping will be at ADDR exactly (which must be
+   page-aligned); otherwise the system chooses a convenient nearby address.
+   The return value is the actual mapping address chosen or MAP_FAILED
+   for errors (in which case `errno' is set).  A successful `mmap' call
+   deallocates any previous mapping for the affected region.  */
+
+#ifndef __USE_FILE_OFFSET64
+void *mmap(void *__addr, size_t __len, int __prot,
+		   int __flags, int __fd, __off_t __offset)
 {
 	void *ret;
 
 	__init();
 
 	if (!global_init_done)
-		return __init_alloc(__size, __alignment);
+		abort();
+
+	if (event_rejected(EVENT_MMAP, __len)) {
+		TRACING_DISABLE();
+		ret = glibc_mmap(__addr, __len, __prot,
+				__flags, __fd, __offset);
+		TRACING_ENABLE();
+		return ret;
+	}
 
 	if (event_start_frame()) {
-		lock_tracer();
-		output("%s(%lu, %lu)", event_name(EVENT_ALIGNED_ALLOC),
-				__alignment, __size);
+		output("%s(0x%x, %lu, %d, %d, %d, %lu)",
+			event_name(EVENT_MMAP),
+			__addr, __len, __prot, __flags,
+			__fd, __offset);
 	}
 
-	ret = glibc_aligned_alloc(__alignment, __size);
-	forced_pgfault(ret, ALIGN(__size, __alignment));
+	timed_call(EVENT_MMAP,
+		   ret = glibc_mmap(__addr, __len, __prot, __flags, __fd, __offset));
 
-	if (is_event_top_frame()) {
+	if (__prot & PROT_EXEC)
+		maps_cache_deferred_flush();
+
+	if (is_event_traced()) {
 		int trace;
 
 		output("=0x%x\n", ret);
-		trace = can_backtrace(ALIGN(__size, __alignment),
-				STATS_MALLOC_SZ);
-		unlock_tracer();
+		trace = can_backtrace(__len, STATS_MMAP_SZ);
 		if (trace)
 			unwind_trace(&opts);
 	}
+	if (ret != MAP_FAILED && (__flags & MAP_ANONYMOUS))
+		profile_event(NULL, ret, __len);
 	event_end_frame();
 	return ret;
 }
-#endif
-
-#ifdef HAVE_VALLOC
-/* Allocate SIZE bytes on a page boundary.  */
-void *valloc(size_t __size)
+#else
+void *mmap(void *__addr, size_t __len, int __prot,
+		   int __flags, int __fd, __off64_t __offset)
 {
 	void *ret;
 
 	__init();
 
 	if (!global_init_done)
-		return __init_alloc(__size, page_size);
+		abort();
+
+	if (event_rejected(EVENT_MMAP, __len)) {
+		TRACING_DISABLE();
+		ret = glibc_mmap(__addr, __len, __prot,
+				__flags, __fd, __offset);
+		TRACING_ENABLE();
+		return ret;
+	}
 
 	if (event_start_frame()) {
-		lock_tracer();
-		output("%s(%lu)", event_name(EVENT_VALLOC), __size);
+		output("%s(0x%x, %lu, %d, %d, %d, %llu)",
+			event_name(EVENT_MMAP),
+			__addr, __len, __prot, __flags,
+			__fd, __offset);
 	}
 
-	ret = glibc_valloc(__size);
-	forced_pgfault(ret, ALIGN(__size, page_size));
+	timed_call(EVENT_MMAP,
+		   ret = glibc_mmap(__addr, __len, __prot, __flags, __fd, __offset));
 
-	if (is_event_top_frame()) {
+	if (__prot & PROT_EXEC)
+		maps_cache_deferred_flush();
+
+	if (is_event_traced()) {
 		int trace;
 
 		output("=0x%x\n", ret);
-		trace = can_backtrace(ALIGN(__size, page_size),
-				STATS_MALLOC_SZ);
-		unlock_tracer();
+		trace = can_backtrace(__len, STATS_MMAP_SZ);
 		if (trace)
 			unwind_trace(&opts);
 	}
+	if (ret != MAP_FAILED && (__flags & MAP_ANONYMOUS))
+		profile_event(NULL, ret, __len);
 	event_end_frame();
 	return ret;
 }
 #endif
 
-#ifdef HAVE_PVALLOC
-/* Equivalent to valloc(minimum-page-that-holds(n)), that is, round up
-   __size to nearest pagesize. */
-void *pvalloc(size_t __size)
+/* Deallocate any mapping for the region starting at ADDR and extending LEN
+   bytes.  Returns 0 if successful, -1 for errors (and sets errno).  */
+int munmap(void *__addr, size_t __len)
 {
-	void *ret;
+	struct live_ptr old;
+	int tracked = 0;
+	int ret;
 
 	__init();
 
 	if (!global_init_done)
-		return __init_alloc(__size, phys_page_size);
-
-	if (event_start_frame()) {
-		lock_tracer();
-		output("%s(%lu)", event_name(EVENT_PVALLOC), __size);
-	}
-
-	ret = glibc_pvalloc(__size);
-	forced_pgfault(ret, ALIGN(__size, phys_page_size));
-
-	if (is_event_top_frame()) {
-		int trace;
+		abort();
 
-		output("=0x%x\n", ret);
-		trace = can_backtrace(ALIGN(__size, phys_page_size),
-				STATS_MALLOC_SZ);
-		unlock_tracer();
-		if (trace)
-			unwind_trace(&opts);
+	if (event_rejected(EVENT_MUNMAP, __len)) {
+		TRACING_DISABLE();
+		if (is_event_profiled())
+			tracked = profile_munmap_start(__addr, __len, &old);
+		ret = glibc_munmap(__addr, __len);
+		if (tracked)
+			profile_munmap_end(&old, __len, ret != 0);
+		TRACING_ENABLE();
+		return ret;
 	}
-	event_end_frame();
-	return ret;
-}
-#endif
-
-#ifdef HAVE_MEMSET
-/* Set N bytes of S to C.  */
-void *memset(void *__s, int __c, size_t __n)
-{
-	void *ret;
-
-	/*
-	 * We can't __init() here. Need to do memset() manually.
-	 */
-	if (!global_init_done)
-		return __init_memset(__s, __c, __n);
 
 	if (event_start_frame()) {
-		lock_tracer();
-		output("%s(0x%x, %d, %lu)",
-			event_name(EVENT_MEMSET),
-			__s,
-			__c,
-			__n);
+		output("%s(0x%x, %lu)",
+			event_name(EVENT_MUNMAP),
+			__addr,
+			__len);
 	}
 
-	ret = glibc_memset(__s, __c, __n);
+	if (is_event_profiled())
+		tracked = profile_munmap_start(__addr, __len, &old);
+	timed_call(EVENT_MUNMAP, ret = glibc_munmap(__addr, __len));
+	if (tracked)
+		profile_munmap_end(&old, __len, ret != 0);
 
-	if (is_event_top_frame()) {
+	if (is_event_traced()) {
 		int trace;
 
-		output("=0x%x\n", ret);
-		trace = can_backtrace(__n, STATS_MALLOC_SZ);
-		unlock_tracer();
+		output("=%d\n", ret);
+		trace = can_backtrace(0, STATS_FREE);
 		if (trace)
 			unwind_trace(&opts);
 	}
 	event_end_frame();
 	return ret;
 }
-#endif
 
-#ifdef HAVE_MEMMOVE
-/* Copy N bytes of SRC to DEST, guaranteeing
-   correct behavior for overlapping strings.  */
-void *memmove(void *__dest, const void *__src, size_t __n)
+/* Remap pages mapped by the range [ADDR,ADDR+OLD_LEN) to new length
+   NEW_LEN.  If MREMAP_MAYMOVE is set in FLAGS the returned address
+   may differ from ADDR.  If MREMAP_FIXED is set in FLAGS the function
+   takes another parameter which is a fixed address at which the block
+   resides after a successful call.  */
+void *mremap(void *__addr, size_t __old_len, size_t __new_len,
+	     int __flags, ...)
 {
+	void *__new_addr = NULL;
+	struct live_ptr old;
+	int tracked = 0;
 	void *ret;
+	va_list ap;
 
-	__init();
-
-	if (event_start_frame()) {
-		output("%s(0x%x, 0x%x, %lu)",
-			event_name(EVENT_MEMMOVE),
-			__dest,
-			__src,
-			__n);
-	}
-
-	ret = glibc_memmove(__dest, __src, __n);
-
-	if (is_event_top_frame()) {
-		output("=0x%x\n", ret);
-
-		if (can_backtrace(0, STATS_AUX))
-			unwind_trace(&opts);
+	if (__flags & MREMAP_FIXED) {
+		va_start(ap, __flags);
+		__new_addr = va_arg(ap, void *);
+		va_end(ap);
 	}
-	event_end_frame();
-	return ret;
-}
-#endif
-
-/* Map addresses starting near ADDR and extending for LEN bytes.  from
-   OFFSET into the file FD describes according to PROT and FLAGS.  If ADDR
-   is nonzero, it is the desired mapping address.  If the MAP_FIXED bit is
-   set in FLAGS, the mapping will be at ADDR exactly (which must be
-   page-aligned); otherwise the system chooses a convenient nearby address.
-   The return value is the actual mapping address chosen or MAP_FAILED
-   for errors (in which case `errno' is set).  A successful `mmap' call
-   deallocates any previous mapping for the affected region.  */
-
-#ifndef __USE_FILE_OFFSET64
-void *mmap(void *__addr, size_t __len, int __prot,
-		   int __flags, int __fd, __off_t __offset)
-{
-	void *ret;
 
 	__init();
 
 	if (!global_init_done)
 		abort();
 
-	if (event_start_frame()) {
-		lock_tracer();
-		output("%s(0x%x, %lu, %d, %d, %d, %lu)",
-			event_name(EVENT_MMAP),
-			__addr, __len, __prot, __flags,
-			__fd, __offset);
+	/*
+	 * There is no stack to re-add a rejected mapping with, only a
+	 * failed mremap() puts it back.
+	 */
+	if (event_rejected(EVENT_MREMAP, __new_len)) {
+		TRACING_DISABLE();
+		if (is_event_profiled())
+			tracked = profile_munmap_start(__addr, __old_len,
+					&old);
+		ret = glibc_mremap(__addr, __old_len, __new_len, __flags,
+				__new_addr);
+		if (tracked)
+			profile_munmap_end(&old, __old_len,
+					ret == MAP_FAILED);
+		TRACING_ENABLE();
+		return ret;
 	}
 
-	ret = glibc_mmap(__addr, __len, __prot, __flags, __fd, __offset);
-
-	if (__prot & PROT_EXEC)
-		maps_cache_deferred_flush();
+	if (event_start_frame()) {
+		output("%s(0x%x, %lu, %lu, %d)",
+			event_name(EVENT_MREMAP),
+			__addr, __old_len, __new_len, __flags);
+	}
 
-	if (is_event_top_frame()) {
+	/*
+	 * Like realloc(), the old mapping goes first. Only mappings we
+	 * knew about are re-added, a failed mremap() puts the old one
+	 * back.
+	 */
+	if (is_event_profiled())
+		tracked = profile_munmap_start(__addr, __old_len, &old);
+	timed_call(EVENT_MREMAP,
+		   ret = glibc_mremap(__addr, __old_len, __new_len, __flags,
+				      __new_addr));
+	if (tracked)
+		profile_munmap_end(&old, __old_len, ret == MAP_FAILED);
+
+	/* only the grown part can fault in new pages */
+	if (ret != MAP_FAILED && __new_len > __old_len)
+		forced_pgfault((char *)ret + __old_len, __new_len - __old_len);
+
+	if (is_event_traced()) {
 		int trace;
 
 		output("=0x%x\n", ret);
-		trace = can_backtrace(__len, STATS_MMAP_SZ);
-		unlock_tracer();
+		trace = can_backtrace(__new_len, STATS_MMAP_SZ);
 		if (trace)
 			unwind_trace(&opts);
 	}
+	if (ret != MAP_FAILED && tracked)
+		profile_event(NULL, ret, __new_len);
 	event_end_frame();
 	return ret;
 }
-#else
-void *mmap(void *__addr, size_t __len, int __prot,
-		   int __flags, int __fd, __off64_t __offset)
+
+/*
+ * Heap growth of allocators that manage the program break themselves,
+ * glibc malloc() calls its internal __sbrk() and is not seen here.
+ */
+int brk(void *__addr)
 {
-	void *ret;
+	intptr_t incr;
+	int ret;
 
 	__init();
 
 	if (!global_init_done)
 		abort();
 
-	if (event_start_frame()) {
-		lock_tracer();
-		output("%s(0x%x, %lu, %d, %d, %d, %llu)",
-			event_name(EVENT_MMAP),
-			__addr, __len, __prot, __flags,
-			__fd, __offset);
+	incr = (char *)__addr - (char *)glibc_sbrk(0);
+	if (event_rejected(EVENT_BRK, incr > 0 ? incr : 0)) {
+		TRACING_DISABLE();
+		ret = glibc_brk(__addr);
+		TRACING_ENABLE();
+		return ret;
 	}
 
-	ret = glibc_mmap(__addr, __len, __prot, __flags, __fd, __offset);
+	if (event_start_frame()) {
+		output("%s(0x%x, %ld)", event_name(EVENT_BRK), __addr,
+				(long)incr);
+	}
 
-	if (__prot & PROT_EXEC)
-		maps_cache_deferred_flush();
+	timed_call(EVENT_BRK, ret = glibc_brk(__addr));
+	if (!ret && incr > 0)
+		forced_pgfault((char *)__addr - incr, incr);
 
-	if (is_event_top_frame()) {
+	if (is_event_traced()) {
 		int trace;
 
-		output("=0x%x\n", ret);
-		trace = can_backtrace(__len, STATS_MMAP_SZ);
-		unlock_tracer();
+		output("=%d\n", ret);
+		trace = can_backtrace(incr > 0 ? incr : 0,
+				incr > 0 ? STATS_MMAP_SZ : STATS_FREE);
 		if (trace)
 			unwind_trace(&opts);
 	}
 	event_end_frame();
 	return ret;
 }
-#endif
 
-/* Deallocate any mapping for the region starting at ADDR and extending LEN
-   bytes.  Returns 0 if successful, -1 for errors (and sets errno).  */
-int munmap(void *__addr, size_t __len)
+void *sbrk(intptr_t __incr)
 {
-	int ret;
+	void *ret;
+
+	__init();
 
 	if (!global_init_done)
 		abort();
 
+	if (event_rejected(EVENT_SBRK, __incr > 0 ? __incr : 0)) {
+		TRACING_DISABLE();
+		ret = glibc_sbrk(__incr);
+		TRACING_ENABLE();
+		return ret;
+	}
+
 	if (event_start_frame()) {
-		lock_tracer();
-		output("%s(0x%x, %lu)",
-			event_name(EVENT_MUNMAP),
-			__addr,
-			__len);
+		output("%s(%ld)", event_name(EVENT_SBRK), (long)__incr);
 	}
 
-	ret = glibc_munmap(__addr, __len);
+	timed_call(EVENT_SBRK, ret = glibc_sbrk(__incr));
+	if (ret != (void *)-1 && __incr > 0)
+		forced_pgfault(ret, __incr);
 
-	if (is_event_top_frame()) {
+	if (is_event_traced()) {
 		int trace;
 
-		output("=%d\n", ret);
-		trace = can_backtrace(0, STATS_FREE);
-		unlock_tracer();
+		output("=0x%x\n", ret);
+		trace = can_backtrace(__incr > 0 ? __incr : 0,
+				__incr > 0 ? STATS_MMAP_SZ : STATS_FREE);
 		if (trace)
 			unwind_trace(&opts);
 	}
@@ -941,144 +1330,273 @@ void *mmap2(void *__addr, size_t __len, int __prot,
 	if (!global_init_done)
 		abort();
 
+	if (event_rejected(EVENT_MMAP2, __len)) {
+		TRACING_DISABLE();
+		ret = glibc_mmap2(__addr, __len, __prot,
+				__flags, __fd, __offset);
+		TRACING_ENABLE();
+		return ret;
+	}
+
 	if (event_start_frame()) {
-		lock_tracer();
 		output("%s(0x%x, %lu, %d, %d, %d, %llu)",
 			event_name(EVENT_MMAP2),
 			__addr, __len, __prot, __flags,
 			__fd, __offset);
 	}
 
-	ret = glibc_mmap2(__addr, __len, __prot, __flags, __fd, __offset);
+	timed_call(EVENT_MMAP2,
+		   ret = glibc_mmap2(__addr, __len, __prot, __flags, __fd, __offset));
 
 	if (__prot & PROT_EXEC)
 		maps_cache_deferred_flush();
 
-	if (is_event_top_frame()) {
+	if (is_event_traced()) {
 		int trace;
 
 		output("=0x%x\n", ret);
 		trace = can_backtrace(__len, STATS_MMAP_SZ);
-		unlock_tracer();
 		if (trace)
 			unwind_trace(&opts);
 	}
+	if (ret != MAP_FAILED && (__flags & MAP_ANONYMOUS))
+		profile_event(NULL, ret, __len);
 	event_end_frame();
 	return ret;
 }
 #endif
 
-/* Guarantee all whole pages mapped by the range [ADDR,ADDR+LEN) to
-   be memory resident.  */
-int mlock(const void *__addr, size_t __len)
-{
-	int ret;
-
-	__init();
 
-	if (!global_init_done)
-		abort();
-
-	if (event_start_frame()) {
-		output("%s(0x%x, %lu)",
-			event_name(EVENT_MLOCK),
-			__addr,
-			__len);
-	}
+/*
+ * C++ operator new and delete.
+ *
+ * The libstdc++ operators are loops around malloc() and aligned_alloc()
+ * that call the new handler, and throw, on failure. We allocate here,
+ * so C++ events get their own types and one frame less to unwind, and
+ * leave failures to the real operators, after the event frame is over.
+ * Delete is free(), the sized variants pass the size to the counters.
+ */
+#if __SIZEOF_SIZE_T__ == 8
+#define CXX_SIZE	"m"
+#else
+#define CXX_SIZE	"j"
+#endif
 
-	ret = glibc_mlock(__addr, __len);
+#define CXX_NOTHROW	"RKSt9nothrow_t"
+#define CXX_ALIGN	"St11align_val_t"
 
-	if (is_event_top_frame()) {
-		output("=%d\n", ret);
+#define cxx_callsite()	((unsigned long)__builtin_return_address(0))
 
-		if (can_backtrace(__len, STATS_MLOCK))
-			unwind_trace(&opts);
-	}
-	event_end_frame();
-	return ret;
+static void *cxx_alloc(size_t __size, size_t __alignment)
+{
+	if (!__alignment)
+		return glibc_malloc(__size);
+	return glibc_memalign(__alignment, __size);
 }
 
-/* Unlock whole pages previously mapped by the range [ADDR,ADDR+LEN).  */
-int munlock(const void *__addr, size_t __len)
+static inline __attribute__((always_inline))
+void *cxx_new(int type, size_t __size, size_t __alignment,
+	      unsigned long callsite)
 {
-	int ret;
+	void *ret;
+
+	__init();
 
 	if (!global_init_done)
-		abort();
+		return bootstrap_alloc(__size, __alignment);
 
-	if (event_start_frame()) {
-		output("%s(0x%x, %lu)",
-			event_name(EVENT_MUNLOCK),
-			__addr,
-			__len);
+	if (__event_rejected(type, __size, callsite)) {
+		TRACING_DISABLE();
+		ret = cxx_alloc(__size, __alignment);
+		TRACING_ENABLE();
+		return ret;
 	}
 
-	ret = glibc_munlock(__addr, __len);
+	if (__event_start_frame(opts.flags, callsite)) {
+		output("%s(%lu, %lu)", event_name(type), __size, __alignment);
+	}
 
-	if (is_event_top_frame()) {
-		output("=%d\n", ret);
+	timed_call(type, ret = cxx_alloc(__size, __alignment));
+	forced_pgfault(ret, __size);
 
-		if (can_backtrace(__len, STATS_MLOCK))
+	if (is_event_traced()) {
+		int trace;
+
+		output("=0x%x\n", ret);
+		trace = can_backtrace(__size, STATS_MALLOC_SZ);
+		if (trace)
 			unwind_trace(&opts);
 	}
+	profile_event(NULL, ret, __size);
 	event_end_frame();
 	return ret;
 }
 
-/* Cause all currently mapped pages of the process to be memory resident
-   until unlocked by a call to the `munlockall', until the process exits,
-   or until the process calls `execve'.  */
-int mlockall(int __flags)
+static inline __attribute__((always_inline))
+void cxx_delete(int type, void *__ptr, size_t __size, unsigned long callsite)
 {
-	int ret;
-
-	__init();
+	if (!global_init_done || bootstrap_owns(__ptr)) {
+		bootstrap_free(__ptr);
+		return;
+	}
 
-	if (!global_init_done)
-		abort();
+	if (__event_rejected(type, __size, callsite)) {
+		TRACING_DISABLE();
+		glibc_free(__ptr);
+		TRACING_ENABLE();
+		return;
+	}
 
-	if (event_start_frame()) {
-		output("%s(%d)", event_name(EVENT_MLOCKALL), __flags);
+	if (__event_start_frame(opts.flags, callsite)) {
+		output("%s(0x%x, %lu)\n", event_name(type), __ptr, __size);
 	}
 
-	ret = glibc_mlockall(__flags);
+	profile_event(__ptr, NULL, 0);
+	timed_call(type, glibc_free(__ptr));
 
-	if (is_event_top_frame()) {
-		output("=%d\n", ret);
+	if (is_event_traced()) {
+		int trace = can_backtrace(0, STATS_FREE);
 
-		if (can_backtrace(0, STATS_MLOCK))
+		if (trace)
 			unwind_trace(&opts);
 	}
 	event_end_frame();
-	return ret;
 }
 
-
-/* All currently mapped pages of the process' address space become
-   unlocked.  */
-int munlockall(void)
+/*
+ * The failure path: the real operator runs the new handler and throws
+ * or, for nothrow variants, returns NULL. Without a C++ runtime there
+ * is nobody to throw bad_alloc.
+ */
+static void *cxx_next(const char *sym, int nothrow)
 {
-	int ret;
+	void *fn = dlsym(RTLD_NEXT, sym);
 
-	if (!global_init_done)
+	if (!fn && !nothrow) {
+		fprintf(stderr, "ERROR: out of memory in %s\n", sym);
 		abort();
-
-	if (event_start_frame()) {
-		output("%s()", event_name(EVENT_MUNLOCKALL));
 	}
+	return fn;
+}
+
+typedef void *(*cxx_new_t)(size_t);
+typedef void *(*cxx_new_nothrow_t)(size_t, const void *);
+typedef void *(*cxx_new_align_t)(size_t, size_t);
+typedef void *(*cxx_new_align_nothrow_t)(size_t, size_t, const void *);
+
+#define CXX_NEW(fn, sym, type)						\
+void *fn(size_t __size) __asm__(sym);					\
+void *fn(size_t __size)							\
+{									\
+	void *ret = cxx_new(type, __size, 0, cxx_callsite());		\
+									\
+	if (!ret)							\
+		ret = ((cxx_new_t)cxx_next(sym, 0))(__size);		\
+	return ret;							\
+}
 
-	ret = glibc_munlockall();
+#define CXX_NEW_NOTHROW(fn, sym, type)					\
+void *fn(size_t __size, const void *__nt) __asm__(sym);		\
+void *fn(size_t __size, const void *__nt)				\
+{									\
+	cxx_new_nothrow_t next;						\
+	void *ret = cxx_new(type, __size, 0, cxx_callsite());		\
+									\
+	if (!ret && (next = cxx_next(sym, 1)))				\
+		ret = next(__size, __nt);				\
+	return ret;							\
+}
 
-	if (is_event_top_frame()) {
-		output("=%d\n", ret);
+#define CXX_NEW_ALIGN(fn, sym, type)					\
+void *fn(size_t __size, size_t __alignment) __asm__(sym);		\
+void *fn(size_t __size, size_t __alignment)				\
+{									\
+	void *ret = cxx_new(type, __size, __alignment, cxx_callsite());	\
+									\
+	if (!ret)							\
+		ret = ((cxx_new_align_t)cxx_next(sym, 0))(__size,	\
+				__alignment);				\
+	return ret;							\
+}
 
-		if (can_backtrace(0, STATS_MLOCK))
-			unwind_trace(&opts);
-	}
-	event_end_frame();
-	return ret;
+#define CXX_NEW_ALIGN_NOTHROW(fn, sym, type)				\
+void *fn(size_t __size, size_t __alignment, const void *__nt)		\
+	__asm__(sym);							\
+void *fn(size_t __size, size_t __alignment, const void *__nt)		\
+{									\
+	cxx_new_align_nothrow_t next;					\
+	void *ret = cxx_new(type, __size, __alignment, cxx_callsite());	\
+									\
+	if (!ret && (next = cxx_next(sym, 1)))				\
+		ret = next(__size, __alignment, __nt);			\
+	return ret;							\
 }
 
+/*
+ * The alignment and nothrow arguments of delete carry nothing for us,
+ * they are declared by the caller of the macro and left unused.
+ */
+#define CXX_UNUSED_ARGS_BEGIN						\
+	_Pragma("GCC diagnostic push")					\
+	_Pragma("GCC diagnostic ignored \"-Wunused-parameter\"")
+
+#define CXX_UNUSED_ARGS_END						\
+	_Pragma("GCC diagnostic pop")
+
+#define CXX_DELETE(fn, sym, type, ...)					\
+void fn(void *__ptr, ##__VA_ARGS__) __asm__(sym);			\
+CXX_UNUSED_ARGS_BEGIN							\
+void fn(void *__ptr, ##__VA_ARGS__)					\
+{									\
+	cxx_delete(type, __ptr, 0, cxx_callsite());			\
+}									\
+CXX_UNUSED_ARGS_END
+
+#define CXX_DELETE_SIZED(fn, sym, type, ...)				\
+void fn(void *__ptr, size_t __size, ##__VA_ARGS__) __asm__(sym);	\
+CXX_UNUSED_ARGS_BEGIN							\
+void fn(void *__ptr, size_t __size, ##__VA_ARGS__)			\
+{									\
+	cxx_delete(type, __ptr, __size, cxx_callsite());		\
+}									\
+CXX_UNUSED_ARGS_END
+
+CXX_NEW(cxx_new_scalar, "_Znw" CXX_SIZE, EVENT_NEW)
+CXX_NEW(cxx_new_array, "_Zna" CXX_SIZE, EVENT_NEW_ARRAY)
+CXX_NEW_NOTHROW(cxx_new_scalar_nothrow, "_Znw" CXX_SIZE CXX_NOTHROW,
+		EVENT_NEW)
+CXX_NEW_NOTHROW(cxx_new_array_nothrow, "_Zna" CXX_SIZE CXX_NOTHROW,
+		EVENT_NEW_ARRAY)
+CXX_NEW_ALIGN(cxx_new_scalar_align, "_Znw" CXX_SIZE CXX_ALIGN, EVENT_NEW)
+CXX_NEW_ALIGN(cxx_new_array_align, "_Zna" CXX_SIZE CXX_ALIGN,
+		EVENT_NEW_ARRAY)
+CXX_NEW_ALIGN_NOTHROW(cxx_new_scalar_align_nothrow,
+		"_Znw" CXX_SIZE CXX_ALIGN CXX_NOTHROW, EVENT_NEW)
+CXX_NEW_ALIGN_NOTHROW(cxx_new_array_align_nothrow,
+		"_Zna" CXX_SIZE CXX_ALIGN CXX_NOTHROW, EVENT_NEW_ARRAY)
+
+CXX_DELETE(cxx_delete_scalar, "_ZdlPv", EVENT_DELETE)
+CXX_DELETE(cxx_delete_array, "_ZdaPv", EVENT_DELETE_ARRAY)
+CXX_DELETE(cxx_delete_scalar_nothrow, "_ZdlPv" CXX_NOTHROW, EVENT_DELETE,
+		const void *__nt)
+CXX_DELETE(cxx_delete_array_nothrow, "_ZdaPv" CXX_NOTHROW,
+		EVENT_DELETE_ARRAY, const void *__nt)
+CXX_DELETE(cxx_delete_scalar_align, "_ZdlPv" CXX_ALIGN, EVENT_DELETE,
+		size_t __alignment)
+CXX_DELETE(cxx_delete_array_align, "_ZdaPv" CXX_ALIGN, EVENT_DELETE_ARRAY,
+		size_t __alignment)
+CXX_DELETE(cxx_delete_scalar_align_nothrow, "_ZdlPv" CXX_ALIGN CXX_NOTHROW,
+		EVENT_DELETE, size_t __alignment, const void *__nt)
+CXX_DELETE(cxx_delete_array_align_nothrow, "_ZdaPv" CXX_ALIGN CXX_NOTHROW,
+		EVENT_DELETE_ARRAY, size_t __alignment, const void *__nt)
+CXX_DELETE_SIZED(cxx_delete_scalar_sized, "_ZdlPv" CXX_SIZE, EVENT_DELETE)
+CXX_DELETE_SIZED(cxx_delete_array_sized, "_ZdaPv" CXX_SIZE,
+		EVENT_DELETE_ARRAY)
+CXX_DELETE_SIZED(cxx_delete_scalar_sized_align, "_ZdlPv" CXX_SIZE CXX_ALIGN,
+		EVENT_DELETE, size_t __alignment)
+CXX_DELETE_SIZED(cxx_delete_array_sized_align, "_ZdaPv" CXX_SIZE CXX_ALIGN,
+		EVENT_DELETE_ARRAY, size_t __alignment)
+
 char *getenv(const char *name)
 {
 #ifdef HAVE_TIZEN_WORKAROUND
@@ -1131,6 +1649,103 @@ char *getenv(const char *name)
 	return glibc_getenv(name);
 }
 
+/*
+ * Release and resize calls of modules that are not traced, MTRACE_MODULES.
+ * They may get blocks of the bootstrap arena.
+ */
+static void untraced_free(void *__ptr)
+{
+	if (bootstrap_owns(__ptr)) {
+		bootstrap_free(__ptr);
+		return;
+	}
+	glibc_free(__ptr);
+}
+
+static void *untraced_realloc(void *__ptr, size_t __size)
+{
+	if (bootstrap_owns(__ptr))
+		return bootstrap_move(__ptr, __size, glibc_malloc);
+	return glibc_realloc(__ptr, __size);
+}
+
+#ifdef HAVE_REALLOCARRAY
+static void *untraced_reallocarray(void *__ptr, size_t __nmemb, size_t __size)
+{
+	size_t total;
+
+	if (!bootstrap_owns(__ptr))
+		return glibc_reallocarray(__ptr, __nmemb, __size);
+	if (__builtin_mul_overflow(__nmemb, __size, &total)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	return bootstrap_move(__ptr, total, glibc_malloc);
+}
+#endif
+
+#ifdef HAVE_CFREE
+static void untraced_cfree(void *__ptr)
+{
+	if (bootstrap_owns(__ptr)) {
+		bootstrap_free(__ptr);
+		return;
+	}
+	glibc_cfree(__ptr);
+}
+#endif
+
+#ifdef HAVE_FREE_SIZED
+static void untraced_free_sized(void *__ptr, size_t __size)
+{
+	if (bootstrap_owns(__ptr)) {
+		bootstrap_free(__ptr);
+		return;
+	}
+	glibc_free_sized(__ptr, __size);
+}
+#endif
+
+#ifdef HAVE_FREE_ALIGNED_SIZED
+static void untraced_free_aligned_sized(void *__ptr, size_t __alignment,
+					size_t __size)
+{
+	if (bootstrap_owns(__ptr)) {
+		bootstrap_free(__ptr);
+		return;
+	}
+	glibc_free_aligned_sized(__ptr, __alignment, __size);
+}
+#endif
+
+static size_t untraced_malloc_usable_size(void *__ptr)
+{
+	if (bootstrap_owns(__ptr))
+		return bootstrap_usable_size(__ptr);
+	return glibc_malloc_usable_size(__ptr);
+}
+
+/*
+ * Modules loaded at runtime are not patched yet, MTRACE_MODULES.
+ */
+void *dlopen(const char *file, int mode)
+{
+	void *ret;
+
+	__init();
+
+	if (!global_init_done)
+		abort();
+
+	ret = glibc_dlopen(file, mode);
+	if (ret) {
+		TRACING_DISABLE();
+		got_patch();
+		TRACING_ENABLE();
+	}
+	return ret;
+}
+
 int dlclose(void *handle)
 {
 	int ret;
@@ -1151,11 +1766,141 @@ int dlclose(void *handle)
 	return ret;
 }
 
+/*
+ * Annotation API, see include/mtrace.h. Tags of a thread form a stack,
+ * pushes beyond TAG_MAX_DEPTH are only counted, so that pops stay
+ * balanced.
+ */
+int mtrace_push_tag(const char *name)
+{
+	int id = 0;
+
+	__init();
+
+	if (global_init_done && name) {
+		TRACING_DISABLE();
+		id = tag_get(&opts, name);
+		TRACING_ENABLE();
+	}
+
+	if (tag_depth < TAG_MAX_DEPTH)
+		tag_stack[tag_depth] = id;
+	tag_depth++;
+	return id;
+}
+
+void mtrace_pop_tag(void)
+{
+	if (tag_depth)
+		tag_depth--;
+}
+
+void mtrace_mark(const char *name)
+{
+	__init();
+
+	if (!global_init_done || !name)
+		return;
+
+	TRACING_DISABLE();
+	tag_mark(&opts, name);
+	TRACING_ENABLE();
+}
+
+static void sampler_thread_init(void)
+{
+	TRACING_DISABLE();
+}
+
+static int control_command(const char *cmd, const char *arg)
+{
+	if (!strcmp(cmd, "enable")) {
+		control_enable(1);
+	} else if (!strcmp(cmd, "disable")) {
+		control_enable(0);
+	} else if (!strcmp(cmd, "arm")) {
+		trigger_arm(1);
+	} else if (!strcmp(cmd, "disarm")) {
+		trigger_arm(0);
+	} else if (!strcmp(cmd, "mode")) {
+		int mode;
+
+		if (!strcmp(arg, "atop"))
+			mode = OPTS_ALLOC_TOP_MODE;
+		else if (!strcmp(arg, "full"))
+			mode = OPTS_FULL_REPORT_MODE;
+		else if (!strcmp(arg, "alloc"))
+			mode = OPTS_ALLOC_ONLY_MODE;
+		else if (!strcmp(arg, "grow"))
+			mode = OPTS_MEM_GROW_MODE;
+		else if (!strcmp(arg, "profile"))
+			mode = OPTS_PROFILE_MODE;
+		else if (!strcmp(arg, "counters"))
+			mode = OPTS_COUNTERS_MODE;
+		else if (!strcmp(arg, "latency"))
+			mode = OPTS_LATENCY_MODE;
+		else if (!strcmp(arg, "none"))
+			mode = 0;
+		else
+			return -1;
+
+		/* set up once, switching back and forth costs nothing */
+		if (mode == OPTS_LATENCY_MODE)
+			latency_setup(&opts);
+		if (mode == OPTS_PROFILE_MODE) {
+			profile_setup(&opts);
+			sampler_start(sampler_thread_init);
+		}
+		opts.flags = (opts.flags & ~OPTS_REPORTING_MODES) | mode;
+	} else if (!strcmp(cmd, "minwmark")) {
+		alloc_min_wmark = memparse(arg);
+		opts.flags |= OPTS_ALLOC_WMARK;
+	} else if (!strcmp(cmd, "maxwmark")) {
+		alloc_max_wmark = memparse(arg);
+		opts.flags |= OPTS_ALLOC_WMARK;
+	} else if (!strcmp(cmd, "nowmark")) {
+		alloc_min_wmark = 0;
+		alloc_max_wmark = ULONG_MAX;
+		opts.flags &= ~OPTS_ALLOC_WMARK;
+	} else if (!strcmp(cmd, "depth")) {
+		int dep = atoi(arg);
+
+		if (dep < 0)
+			dep = 0;
+		unwind_set_depth(dep);
+	} else if (!strcmp(cmd, "histogram")) {
+		counters_hist_dump(&opts);
+	} else if (!strcmp(cmd, "snapshot")) {
+		profile_snapshot(&opts, "control");
+	} else if (!strcmp(cmd, "rotate")) {
+		mtrace_rotate_file(&opts);
+	} else if (!strcmp(cmd, "flush")) {
+		if (opts.flags & OPTS_FULL_REPORT_MODE)
+			ratelimit_flush(&opts);
+		if (opts.flags & OPTS_PROFILE_MODE)
+			profile_dump(&opts);
+		if (opts.flags & OPTS_COUNTERS_MODE)
+			counters_dump(&opts);
+		if (opts.flags & OPTS_LATENCY_MODE)
+			latency_dump(&opts);
+		fflush(opts.fd);
+	} else {
+		return -1;
+	}
+
+	/* leave a mark in the trace */
+	output("[ctl:%s%s%s]\n", cmd, *arg ? " " : "", arg);
+	output_commit(&opts);
+	return 0;
+}
+
 /*
  * __attribute__ constructor does not work. read __init() comment.
  */
 static void __init_mtrace(void)
 {
+	int reporting_mode = 0;
+
 	if (global_init_done == 1)
 		return;
 
@@ -1179,6 +1924,16 @@ static void __init_mtrace(void)
 #ifdef HAVE_ALIGNED_ALLOC
 	glibc_aligned_alloc	= dlsym(RTLD_NEXT, "aligned_alloc");
 #endif
+#ifdef HAVE_REALLOCARRAY
+	glibc_reallocarray	= dlsym(RTLD_NEXT, "reallocarray");
+#endif
+#ifdef HAVE_FREE_SIZED
+	glibc_free_sized	= dlsym(RTLD_NEXT, "free_sized");
+#endif
+#ifdef HAVE_FREE_ALIGNED_SIZED
+	glibc_free_aligned_sized = dlsym(RTLD_NEXT, "free_aligned_sized");
+#endif
+	glibc_malloc_usable_size = dlsym(RTLD_NEXT, "malloc_usable_size");
 #ifdef HAVE_VALLOC
 	glibc_valloc		= dlsym(RTLD_NEXT, "valloc");
 #endif
@@ -1194,6 +1949,10 @@ static void __init_mtrace(void)
 
 	glibc_mmap		= dlsym(RTLD_NEXT, "mmap");
 	glibc_munmap		= dlsym(RTLD_NEXT, "munmap");
+	glibc_mremap		= dlsym(RTLD_NEXT, "mremap");
+	glibc_madvise		= dlsym(RTLD_NEXT, "madvise");
+	glibc_brk		= dlsym(RTLD_NEXT, "brk");
+	glibc_sbrk		= dlsym(RTLD_NEXT, "sbrk");
 #ifdef HAVE_MMAP2
 	glibc_mmap2		= dlsym(RTLD_NEXT, "mmap2");
 #endif
@@ -1203,6 +1962,7 @@ static void __init_mtrace(void)
 	glibc_munlockall	= dlsym(RTLD_NEXT, "munlockall");
 	glibc_getenv            = dlsym(RTLD_NEXT, "getenv");
 	glibc_dlclose		= dlsym(RTLD_NEXT, "dlclose");
+	glibc_dlopen		= dlsym(RTLD_NEXT, "dlopen");
 
 	early_lookup_init();
 	early_maps_cache_init();
@@ -1228,15 +1988,27 @@ static void __init_mtrace(void)
 		char *mode = getenv("MTRACE_REPORTING_MODE");
 
 		if (!strcmp(mode, "atop")) {
-			opts.flags = OPTS_ALLOC_TOP_MODE;
+			reporting_mode = OPTS_ALLOC_TOP_MODE;
 		}
 
 		if (!strcmp(mode, "full")) {
-			opts.flags = OPTS_FULL_REPORT_MODE;
+			reporting_mode = OPTS_FULL_REPORT_MODE;
 		}
 
 		if (!strcmp(mode, "alloc")) {
-			opts.flags = OPTS_ALLOC_ONLY_MODE;
+			reporting_mode = OPTS_ALLOC_ONLY_MODE;
+		}
+
+		if (!strcmp(mode, "profile")) {
+			reporting_mode = OPTS_PROFILE_MODE;
+		}
+
+		if (!strcmp(mode, "counters")) {
+			reporting_mode = OPTS_COUNTERS_MODE;
+		}
+
+		if (!strcmp(mode, "latency")) {
+			reporting_mode = OPTS_LATENCY_MODE;
 		}
 	}
 
@@ -1244,16 +2016,215 @@ static void __init_mtrace(void)
 		char *wmark = getenv("MTRACE_ALLOC_MINWMARK");
 
 		alloc_min_wmark = memparse(wmark);
-		opts.flags = OPTS_ALLOC_WMARK;
+		opts.flags |= OPTS_ALLOC_WMARK;
 	}
 
 	if (getenv("MTRACE_ALLOC_MAXWMARK")) {
 		char *wmark = getenv("MTRACE_ALLOC_MAXWMARK");
 
 		alloc_max_wmark = memparse(wmark);
-		opts.flags = OPTS_ALLOC_WMARK;
+		opts.flags |= OPTS_ALLOC_WMARK;
+	}
+
+	/*
+	 * Watermarks used to replace the reporting mode. Keep it that way
+	 * when no mode was requested explicitly, otherwise they narrow
+	 * down the requested mode.
+	 */
+	if (!reporting_mode && !(opts.flags & OPTS_ALLOC_WMARK))
+		reporting_mode = OPTS_MEM_GROW_MODE;
+	opts.flags = (opts.flags & ~OPTS_REPORTING_MODES) | reporting_mode;
+
+	if (getenv("MTRACE_META_LIMIT"))
+		meta_setup(memparse(getenv("MTRACE_META_LIMIT")));
+
+	memgrow_setup(getenv("MTRACE_MEMGROW_BACKEND"));
+
+	if (getenv("MTRACE_FILTER"))
+		filter_compile(getenv("MTRACE_FILTER"));
+
+	if (getenv("MTRACE_MODULES") && !got_setup(getenv("MTRACE_MODULES"))) {
+		got_override("free", untraced_free);
+		got_override("realloc", untraced_realloc);
+#ifdef HAVE_REALLOCARRAY
+		got_override("reallocarray", untraced_reallocarray);
+#endif
+#ifdef HAVE_CFREE
+		got_override("cfree", untraced_cfree);
+#endif
+#ifdef HAVE_FREE_SIZED
+		got_override("free_sized", untraced_free_sized);
+#endif
+#ifdef HAVE_FREE_ALIGNED_SIZED
+		got_override("free_aligned_sized", untraced_free_aligned_sized);
+#endif
+		got_override("malloc_usable_size", untraced_malloc_usable_size);
+	}
+
+	if (getenv("MTRACE_CONTROL")) {
+		int sig = SIGUSR2;
+
+		if (getenv("MTRACE_CONTROL_SIGNAL"))
+			sig = atoi(getenv("MTRACE_CONTROL_SIGNAL"));
+
+		control_init(getenv("MTRACE_CONTROL"), sig, control_command);
+	}
+
+	if (getenv("MTRACE_DISABLED"))
+		control_enable(0);
+
+	ratelimit_setup(&opts, getenv("MTRACE_RATELIMIT"));
+
+	trigger_setup(&opts);
+	heapstat_setup(&opts);
+
+	if (opts.flags & OPTS_PROFILE_MODE)
+		profile_setup(&opts);
+
+	if (opts.flags & OPTS_LATENCY_MODE)
+		latency_setup(&opts);
+
+	if (getenv("MTRACE_SIZE_HISTOGRAM"))
+		opts.flags |= OPTS_SIZE_HISTOGRAM;
+
+	counters_setup(&opts);
+
+	if (getenv("MTRACE_LIVE_STATS"))
+		livestats_setup(&opts);
+
+	if (getenv("MTRACE_LEAK_REPORT"))
+		opts.flags |= OPTS_LIVE_TABLE;
+
+	/* cold memory and NUMA samplers walk the pointer table */
+	if (getenv("MTRACE_COLD_MIN_SIZE")) {
+		opts.flags |= OPTS_LIVE_TABLE;
+		cold_setup(&opts, memparse(getenv("MTRACE_COLD_MIN_SIZE")));
+	}
+
+	if (getenv("MTRACE_NUMA_MIN_SIZE")) {
+		opts.flags |= OPTS_LIVE_TABLE;
+		numa_setup(&opts, memparse(getenv("MTRACE_NUMA_MIN_SIZE")));
 	}
 
+	if (getenv("MTRACE_SNAPSHOT_SIGNAL"))
+		control_snapshot_init(atoi(getenv("MTRACE_SNAPSHOT_SIGNAL")));
+
 	if (getenv("MTRACE_HUMAN_READABLE"))
 		opts.flags |= OPTS_HUMAN_READABLE;
 }
+
+/*
+ * The tracer's locks are taken before fork() and released on both
+ * sides, so the child never inherits one held by a thread that didn't
+ * make it. Outer locks first: a command takes the dump locks, a
+ * profile dump takes the shards, and symbols, maps entries and live
+ * blocks all allocate from meta, which goes last. The bootstrap lock
+ * is a leaf.
+ */
+static void mtrace_fork_prepare(void)
+{
+	TRACING_DISABLE();
+	control_fork_prepare();
+	counters_fork_prepare();
+	latency_fork_prepare();
+	heapstat_fork_prepare();
+	profile_fork_prepare();
+	got_fork_prepare();
+	symbol_lookup_fork_prepare();
+	maps_cache_fork_prepare();
+	meta_fork_prepare();
+	bootstrap_fork_prepare();
+}
+
+static void mtrace_fork_parent(void)
+{
+	bootstrap_fork_parent();
+	meta_fork_parent();
+	maps_cache_fork_parent();
+	symbol_lookup_fork_parent();
+	got_fork_parent();
+	profile_fork_parent();
+	heapstat_fork_parent();
+	latency_fork_parent();
+	counters_fork_parent();
+	control_fork_parent();
+	TRACING_ENABLE();
+}
+
+/*
+ * Only the forking thread makes it to the child of a fork(). The locks
+ * taken in mtrace_fork_prepare() are released, per-thread caches are
+ * dropped, and the child gets a trace file, a live statistics segment
+ * and a sampler thread of its own.
+ */
+static void mtrace_fork_child(void)
+{
+	bootstrap_fork_child();
+	meta_fork_child();
+
+	/* the new trace file first, then what the child must know */
+	output_fork_child(&opts);
+	lineage_fork_child(&opts);
+	maps_cache_fork_child();
+	symbol_lookup_fork_child(&opts);
+	profile_fork_child(&opts);
+
+	ratelimit_fork_child();
+	counters_fork_child();
+	latency_fork_child();
+	heapstat_fork_child();
+	memgrow_fork_child();
+	cold_fork_child();
+	livestats_fork_child();
+	control_fork_child();
+	got_fork_child();
+
+	sampler_fork_child();
+	sampler_start(sampler_thread_init);
+	TRACING_ENABLE();
+}
+
+/*
+ * This is not an init function, __init() still handles early calls.
+ * We only need a place to start the sampler thread and to patch the
+ * modules once libc and libpthread are initialized.
+ */
+static void __attribute__((constructor)) __start_mtrace(void)
+{
+	__init();
+
+	if (!global_init_done)
+		return;
+
+	TRACING_DISABLE();
+	lineage_start(&opts);
+	pthread_atfork(mtrace_fork_prepare, mtrace_fork_parent,
+			mtrace_fork_child);
+	sampler_start(sampler_thread_init);
+	got_patch();
+	TRACING_ENABLE();
+}
+
+static void __attribute__((destructor)) __fini_mtrace(void)
+{
+	if (!global_init_done)
+		return;
+
+	TRACING_DISABLE();
+	if (opts.flags & OPTS_FULL_REPORT_MODE)
+		ratelimit_flush(&opts);
+	if (opts.flags & OPTS_PROFILE_MODE)
+		profile_dump(&opts);
+	if (opts.flags & OPTS_LIVE_TABLE)
+		profile_snapshot(&opts, "exit");
+	if (opts.flags & OPTS_COUNTERS_MODE)
+		counters_dump(&opts);
+	if (opts.flags & OPTS_LATENCY_MODE)
+		latency_dump(&opts);
+	if (opts.flags & OPTS_SIZE_HISTOGRAM)
+		counters_hist_dump(&opts);
+	heapstat_dump();
+	meta_dump(&opts);
+	livestats_exit();
+	TRACING_ENABLE();
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2017 Sergey Senozhatsky
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "config.h"
+#include <output.h>
+#include <lineage.h>
+
+/*
+ * Process lineage.
+ *
+ * The child of a fork() writes a trace file of its own. Every trace
+ * file names the process it belongs to:
+ *	[proc:PID:PPID:HOW:SEC.USEC:NAME]
+ * HOW is `fork' in the child of a traced process, `exec' when a traced
+ * process has replaced its image, `start' otherwise. The parser builds
+ * a process tree out of a directory of trace files.
+ *
+ * exec() is recognized by the new image: the pid of the traced image
+ * is kept in the environment, in a buffer of our own, which the child
+ * of a fork() updates without allocating.
+ *
+ * The variable is part of the application's environment: it shows in
+ * `environ' and is inherited by every child, traced or not. An image
+ * started with an envp of the application's own making doesn't have
+ * it, and is recorded as `start' rather than `exec'.
+ */
+
+#define LINEAGE_ENV	"MTRACE_LINEAGE_PID"
+
+static char lineage_env[sizeof(LINEAGE_ENV) + 16];
+
+static void lineage_output(struct options *opts, const char *how)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	output("[proc:%d:%d:%s:%lu.%06d:%s]\n", getpid(), getppid(), how,
+			(unsigned long)tv.tv_sec,
+			(int)tv.tv_usec,
+			program_invocation_short_name);
+	output_commit(opts);
+}
+
+static void lineage_env_update(void)
+{
+	snprintf(lineage_env, sizeof(lineage_env), LINEAGE_ENV "=%d",
+			getpid());
+}
+
+/*
+ * Returns 1 if this image replaced a traced one. Early init calls it
+ * too, it doesn't allocate.
+ */
+int lineage_exec(void)
+{
+	const char *pid = getenv(LINEAGE_ENV);
+
+	return pid && atoi(pid) == getpid();
+}
+
+void lineage_start(struct options *opts)
+{
+	const char *how = "start";
+
+	if (lineage_exec())
+		how = "exec";
+
+	lineage_env_update();
+	putenv(lineage_env);
+	lineage_output(opts, how);
+}
+
+void lineage_fork_child(struct options *opts)
+{
+	lineage_env_update();
+	lineage_output(opts, "fork");
+}
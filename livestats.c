@@ -0,0 +1,414 @@
+/*
+ * Copyright (C) 2017 Sergey Senozhatsky
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "config.h"
+#include <sampler.h>
+#include <counters.h>
+#include <event_names.h>
+#include <livestats.h>
+
+/*
+ * Live statistics.
+ *
+ * Events are counted in the per-thread counters blocks (see counters.c)
+ * and, per callsite, in a small shared table. The sampler thread turns
+ * them into totals and per second rates every `interval' seconds and
+ * publishes the result in a shared memory segment, together with the
+ * busiest threads and callsites. The segment is read-only for everyone
+ * but the traced process, mtrace-top displays it. No trace output.
+ */
+
+#define LIVESTATS_DEF_INTERVAL	1
+
+#define CALLSITE_TABLE_SZ	1024
+#define CALLSITE_MAX_PROBES	8
+#define MAX_THREADS		4096
+
+#define NR_EVENTS	EVENT_MAX
+
+_Static_assert(EVENT_MAX <= LIVESTATS_EVENTS,
+	       "live statistics segment is too small for all events");
+
+struct callsite_slot {
+	unsigned long	addr;
+	unsigned long	calls;
+	unsigned long	bytes;
+
+	/* owned by the sampler */
+	unsigned long	last_calls;
+	unsigned long	last_bytes;
+	char		sym[LIVESTATS_SYM_SZ];
+};
+
+struct rate {
+	int		idx;
+	unsigned long	calls;
+	unsigned long	bytes;
+};
+
+/* the last slot takes callsites that don't fit into the table */
+static struct callsite_slot callsites[CALLSITE_TABLE_SZ + 1];
+
+static struct livestats *ls;
+static char ls_path[64];
+static unsigned long ls_interval_ms;
+
+static unsigned long last_calls[EVENT_MAX];
+static unsigned long last_bytes[EVENT_MAX];
+static unsigned long last_ms;
+
+static struct rate rates[MAX_THREADS];
+static struct livestats_thread threads[MAX_THREADS];
+
+static unsigned long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL;
+}
+
+/*
+ * Called on every counted event, by any thread.
+ */
+void livestats_callsite(unsigned long callsite, size_t size)
+{
+	struct callsite_slot *slot = &callsites[CALLSITE_TABLE_SZ];
+	unsigned long hash = callsite >> 4;
+	int i;
+
+	for (i = 0; i < CALLSITE_MAX_PROBES; i++) {
+		struct callsite_slot *s;
+		unsigned long old;
+
+		s = &callsites[(hash + i) & (CALLSITE_TABLE_SZ - 1)];
+		old = __atomic_load_n(&s->addr, __ATOMIC_RELAXED);
+		if (old == callsite) {
+			slot = s;
+			break;
+		}
+
+		if (!old && __atomic_compare_exchange_n(&s->addr, &old,
+					callsite, 0, __ATOMIC_RELAXED,
+					__ATOMIC_RELAXED)) {
+			slot = s;
+			break;
+		}
+
+		/* lost the race, maybe to the same callsite */
+		if (old == callsite) {
+			slot = s;
+			break;
+		}
+	}
+
+	__atomic_fetch_add(&slot->calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&slot->bytes, size, __ATOMIC_RELAXED);
+}
+
+static unsigned long per_sec(unsigned long delta, unsigned long elapsed)
+{
+	return elapsed ? delta * 1000 / elapsed : 0;
+}
+
+static int rate_cmp(const void *a, const void *b)
+{
+	const struct rate *ra = a, *rb = b;
+
+	if (ra->bytes != rb->bytes)
+		return ra->bytes < rb->bytes ? 1 : -1;
+	if (ra->calls != rb->calls)
+		return ra->calls < rb->calls ? 1 : -1;
+	return 0;
+}
+
+static void resolve_callsite(struct callsite_slot *slot)
+{
+	const char *obj;
+	Dl_info info;
+
+	if (slot->sym[0])
+		return;
+
+	if (slot == &callsites[CALLSITE_TABLE_SZ]) {
+		snprintf(slot->sym, sizeof(slot->sym), "(other)");
+		return;
+	}
+
+	if (!dladdr((void *)slot->addr, &info) || !info.dli_fname) {
+		snprintf(slot->sym, sizeof(slot->sym), "?");
+		return;
+	}
+
+	if (info.dli_sname) {
+		snprintf(slot->sym, sizeof(slot->sym), "%s+0x%lx",
+				info.dli_sname,
+				slot->addr - (unsigned long)info.dli_saddr);
+		return;
+	}
+
+	obj = strrchr(info.dli_fname, '/');
+	snprintf(slot->sym, sizeof(slot->sym), "%s+0x%lx",
+			obj ? obj + 1 : info.dli_fname,
+			slot->addr - (unsigned long)info.dli_fbase);
+}
+
+static int update_threads(unsigned long elapsed, unsigned long *calls,
+			  unsigned long *bytes)
+{
+	struct counters_block *cb;
+	int nr = 0, i, type;
+
+	for (cb = counters_list(); cb; cb = cb->next) {
+		unsigned long c = 0, b = 0;
+		int tid = __atomic_load_n(&cb->tid, __ATOMIC_ACQUIRE);
+
+		for (type = 0; type < EVENT_MAX; type++) {
+			unsigned long tc, tb;
+
+			tc = __atomic_load_n(&cb->calls[type],
+					__ATOMIC_RELAXED);
+			tb = __atomic_load_n(&cb->bytes[type],
+					__ATOMIC_RELAXED);
+			calls[type] += tc;
+			bytes[type] += tb;
+			c += tc;
+			b += tb;
+		}
+
+		/* exited threads keep their totals, but have no rate */
+		if (tid > 0 && nr < MAX_THREADS) {
+			threads[nr].tid = tid;
+			threads[nr].calls = c;
+			threads[nr].bytes = b;
+			rates[nr].idx = nr;
+			rates[nr].calls = per_sec(c - cb->live_calls, elapsed);
+			rates[nr].bytes = per_sec(b - cb->live_bytes, elapsed);
+			nr++;
+		}
+
+		cb->live_calls = c;
+		cb->live_bytes = b;
+	}
+
+	qsort(rates, nr, sizeof(rates[0]), rate_cmp);
+
+	if (nr > LIVESTATS_THREADS)
+		nr = LIVESTATS_THREADS;
+	for (i = 0; i < nr; i++) {
+		ls->threads[i] = threads[rates[i].idx];
+		ls->threads[i].calls_rate = rates[i].calls;
+		ls->threads[i].bytes_rate = rates[i].bytes;
+	}
+	return nr;
+}
+
+static int update_callsites(unsigned long elapsed)
+{
+	int nr = 0, i;
+
+	for (i = 0; i <= CALLSITE_TABLE_SZ; i++) {
+		struct callsite_slot *slot = &callsites[i];
+		unsigned long c, b;
+
+		c = __atomic_load_n(&slot->calls, __ATOMIC_RELAXED);
+		b = __atomic_load_n(&slot->bytes, __ATOMIC_RELAXED);
+		if (c == slot->last_calls)
+			continue;
+
+		rates[nr].idx = i;
+		rates[nr].calls = per_sec(c - slot->last_calls, elapsed);
+		rates[nr].bytes = per_sec(b - slot->last_bytes, elapsed);
+		nr++;
+
+		slot->last_calls = c;
+		slot->last_bytes = b;
+	}
+
+	qsort(rates, nr, sizeof(rates[0]), rate_cmp);
+
+	if (nr > LIVESTATS_CALLSITES)
+		nr = LIVESTATS_CALLSITES;
+	for (i = 0; i < nr; i++) {
+		struct callsite_slot *slot = &callsites[rates[i].idx];
+
+		resolve_callsite(slot);
+		ls->callsites[i].addr = slot->addr;
+		ls->callsites[i].calls_rate = rates[i].calls;
+		ls->callsites[i].bytes_rate = rates[i].bytes;
+		memcpy(ls->callsites[i].sym, slot->sym, sizeof(slot->sym));
+	}
+	return nr;
+}
+
+static void livestats_update(void)
+{
+	unsigned long calls[EVENT_MAX] = { 0 };
+	unsigned long bytes[EVENT_MAX] = { 0 };
+	unsigned long now = now_ms();
+	unsigned long elapsed = now - last_ms;
+	struct timeval tv;
+	int type;
+
+	if (!ls)
+		return;
+
+	gettimeofday(&tv, NULL);
+
+	/* seqlock write side: odd seq, then the data */
+	__atomic_store_n(&ls->seq, ls->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	ls->nr_threads = update_threads(elapsed, calls, bytes);
+	ls->nr_callsites = update_callsites(elapsed);
+
+	for (type = 0; type < NR_EVENTS; type++) {
+		struct livestats_event *ev = &ls->events[type];
+
+		ev->calls = calls[type];
+		ev->bytes = bytes[type];
+		ev->calls_rate = per_sec(calls[type] - last_calls[type],
+				elapsed);
+		ev->bytes_rate = per_sec(bytes[type] - last_bytes[type],
+				elapsed);
+		last_calls[type] = calls[type];
+		last_bytes[type] = bytes[type];
+	}
+
+	ls->updates++;
+	ls->tv_sec = tv.tv_sec;
+	ls->tv_usec = tv.tv_usec;
+
+	__atomic_store_n(&ls->seq, ls->seq + 1, __ATOMIC_RELEASE);
+	last_ms = now;
+}
+
+/*
+ * A segment left behind by a dead process with the same pid is
+ * replaced. The file is created read-only, only our own descriptor
+ * can write to it.
+ */
+static int livestats_map(void)
+{
+	int fd, type;
+
+	snprintf(ls_path, sizeof(ls_path), LIVESTATS_PATH, getpid());
+
+	fd = open(ls_path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0444);
+	if (fd < 0 && errno == EEXIST) {
+		unlink(ls_path);
+		fd = open(ls_path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+				0444);
+	}
+	if (fd < 0)
+		return -errno;
+
+	if (ftruncate(fd, sizeof(*ls))) {
+		close(fd);
+		unlink(ls_path);
+		return -errno;
+	}
+
+	ls = mmap(NULL, sizeof(*ls), PROT_READ | PROT_WRITE, MAP_SHARED,
+			fd, 0);
+	close(fd);
+	if (ls == MAP_FAILED) {
+		ls = NULL;
+		unlink(ls_path);
+		return -ENOMEM;
+	}
+
+	ls->magic = LIVESTATS_MAGIC;
+	ls->version = LIVESTATS_VERSION;
+	ls->pid = getpid();
+	ls->interval_ms = ls_interval_ms;
+	ls->nr_events = NR_EVENTS;
+	for (type = 0; type < NR_EVENTS; type++)
+		strncpy(ls->events[type].name, event_names[type].human_name,
+				LIVESTATS_NAME_SZ - 1);
+	return 0;
+}
+
+/*
+ * MTRACE_LIVE_STATS_INTERVAL=SECONDS, 1 by default.
+ */
+int livestats_setup(struct options *opts)
+{
+	unsigned long interval = LIVESTATS_DEF_INTERVAL;
+	int ret;
+
+	if (getenv("MTRACE_LIVE_STATS_INTERVAL"))
+		interval = strtoul(getenv("MTRACE_LIVE_STATS_INTERVAL"),
+				NULL, 10);
+	if (!interval)
+		interval = LIVESTATS_DEF_INTERVAL;
+	ls_interval_ms = interval * 1000;
+
+	ret = livestats_map();
+	if (ret) {
+		fprintf(stderr, "ERROR: unable to create %s: %s\n",
+				ls_path, strerror(-ret));
+		return ret;
+	}
+
+	opts->flags |= OPTS_LIVE_STATS;
+	last_ms = now_ms();
+	return sampler_register(livestats_update, ls_interval_ms);
+}
+
+/*
+ * In the child of a fork(). The segment is shared with the parent,
+ * the child publishes its numbers in a segment of its own.
+ */
+void livestats_fork_child(void)
+{
+	int ret;
+
+	if (!ls)
+		return;
+
+	munmap(ls, sizeof(*ls));
+	ls = NULL;
+
+	ret = livestats_map();
+	if (ret)
+		fprintf(stderr, "ERROR: unable to create %s: %s\n",
+				ls_path, strerror(-ret));
+}
+
+void livestats_exit(void)
+{
+	if (ls)
+		unlink(ls_path);
+}
@@ -36,6 +36,7 @@
 
 #include "config.h"
 #include <maps_cache.h>
+#include <meta.h>
 
 static pthread_rwlock_t lock;
 
@@ -75,11 +76,14 @@ static int maps_add_entry(char *line)
 	if (mmap_cache_max_id >= mmap_cache_sz - 1) {
 		void *new_buf;
 
+		new_buf = meta_realloc(mmap_cache, (mmap_cache_sz +
+				mmap_cache_sz / 2) * sizeof(struct mmap_entry));
+		/* out of metadata, the mapping is not cached */
+		if (!new_buf) {
+			mmap_cache_max_id--;
+			return -1;
+		}
 		mmap_cache_sz += mmap_cache_sz / 2;
-		new_buf = realloc(mmap_cache,
-				mmap_cache_sz * sizeof(struct mmap_entry));
-		if (!new_buf)
-			abort();
 		mmap_cache = new_buf;
 	}
 	return 0;
@@ -179,9 +183,10 @@ static int maps_cache_reinit(void)
 	 * We don't free the mmap_cache table, reuse it instead.
 	 */
 	if (!mmap_cache)
-		mmap_cache = malloc(mmap_cache_sz * sizeof(struct mmap_entry));
+		mmap_cache = meta_alloc(mmap_cache_sz *
+				sizeof(struct mmap_entry));
 	if (!mmap_cache)
-		abort();
+		goto out;
 
 	mmap_cache_max_id = 0;
 	deferred_flush = 0;
@@ -278,3 +283,28 @@ int early_maps_cache_init()
 	if (pthread_rwlock_init(&lock, NULL) != 0)
 		abort;
 }
+
+/*
+ * Write locked across fork(), the child never sees an entry half
+ * added. The mappings are the parent's, the cache stays.
+ */
+void maps_cache_fork_prepare(void)
+{
+	pthread_rwlock_wrlock(&lock);
+}
+
+void maps_cache_fork_parent(void)
+{
+	pthread_rwlock_unlock(&lock);
+}
+
+/*
+ * The rwlock remembers its writer by tid and the child has a new one,
+ * an unlock would be taken for a reader's. Nobody else can hold the
+ * lock in the child, it starts over.
+ */
+void maps_cache_fork_child(void)
+{
+	if (pthread_rwlock_init(&lock, NULL) != 0)
+		abort();
+}
@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2017 Sergey Senozhatsky
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <linux/perf_event.h>
+
+#include "config.h"
+#include <memgrow.h>
+
+/*
+ * Memory growth detection.
+ *
+ * We used to serialize every intercepted call on a global mutex, so
+ * that an RSS change in /proc/self/statm could be attributed to the
+ * call. Instead we look at the per-thread minor page fault counter:
+ * if it moved while we were in glibc (and in forced_pgfault()) then
+ * this very call has faulted in new pages. No other thread can move
+ * our counter, so no locking is needed.
+ *
+ * Backends, from the cheapest one:
+ *
+ * - perf: per-thread PERF_COUNT_SW_PAGE_FAULTS_MIN counter, opened on
+ *   the first event of every thread. Works unprivileged for our own
+ *   threads (perf_event_paranoid <= 2). The counter is read from the
+ *   mmap-ed user page when the kernel lets us (cap_user_rdpmc), which
+ *   is never the case for software counters as of today, otherwise
+ *   with a single read() on the counter fd.
+ * - rusage: getrusage(RUSAGE_THREAD), one syscall.
+ * - statm: global RSS from /proc/self/statm. Not per-thread, so other
+ *   threads can make us believe that we have grown, but still no locks.
+ *
+ * If perf_event_open() is not available, we fall back to rusage.
+ */
+
+#ifndef RUSAGE_THREAD
+#define RUSAGE_THREAD	1
+#endif
+
+enum memgrow_backend {
+	MEMGROW_PERF,
+	MEMGROW_RUSAGE,
+	MEMGROW_STATM,
+};
+
+static int backend = MEMGROW_PERF;
+
+static int statm_fd = -1;
+static pthread_key_t perf_key;
+
+/* 0 - not opened yet, 1 - opened, -1 - not available */
+static __thread int perf_state;
+static __thread int perf_fd = -1;
+static __thread struct perf_event_mmap_page *perf_page;
+
+static __thread unsigned long start_faults;
+
+/*
+ * A key destructor, runs at thread exit with tracing enabled: a raw
+ * syscall keeps our munmap() from tracing the counter page.
+ */
+static void perf_close(void *arg __attribute__((unused)))
+{
+	if (perf_page)
+		syscall(SYS_munmap, perf_page, sysconf(_SC_PAGESIZE));
+	if (perf_fd >= 0)
+		close(perf_fd);
+
+	perf_page = NULL;
+	perf_fd = -1;
+	perf_state = 0;
+}
+
+static int perf_open(void)
+{
+	struct perf_event_attr attr;
+	void *page;
+
+	memset(&attr, 0x00, sizeof(attr));
+	attr.type = PERF_TYPE_SOFTWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_SW_PAGE_FAULTS_MIN;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+			PERF_FLAG_FD_CLOEXEC);
+	if (perf_fd < 0) {
+		perf_state = -1;
+		return -1;
+	}
+
+	page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED,
+			perf_fd, 0);
+	if (page != MAP_FAILED)
+		perf_page = page;
+
+	/* closes the counter when the thread exits */
+	pthread_setspecific(perf_key, (void *)1);
+	perf_state = 1;
+	return 0;
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+static unsigned long long rdpmc(unsigned int counter)
+{
+	unsigned int low, high;
+
+	asm volatile("rdpmc" : "=a" (low), "=d" (high) : "c" (counter));
+	return low | ((unsigned long long)high) << 32;
+}
+
+static int perf_read_user(unsigned long *ret)
+{
+	struct perf_event_mmap_page *pc = perf_page;
+	unsigned long long count;
+	unsigned int seq, idx;
+
+	if (!pc)
+		return -1;
+
+	do {
+		seq = pc->lock;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		idx = pc->index;
+		if (!pc->cap_user_rdpmc || !idx)
+			return -1;
+
+		count = pc->offset;
+		count += rdpmc(idx - 1) <<
+			(64 - pc->pmc_width) >> (64 - pc->pmc_width);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (pc->lock != seq);
+
+	*ret = count;
+	return 0;
+}
+#else
+static int perf_read_user(unsigned long *ret)
+{
+	return -1;
+}
+#endif
+
+static unsigned long thread_minflt(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_THREAD, &ru))
+		return 0;
+	return ru.ru_minflt;
+}
+
+static unsigned long perf_minflt(void)
+{
+	unsigned long long count;
+	unsigned long ret;
+
+	if (!perf_state)
+		perf_open();
+	if (perf_state < 0)
+		return thread_minflt();
+
+	if (!perf_read_user(&ret))
+		return ret;
+
+	if (read(perf_fd, &count, sizeof(count)) != sizeof(count))
+		return thread_minflt();
+	return count;
+}
+
+static unsigned long faults(void)
+{
+	switch (backend) {
+		case MEMGROW_PERF:
+			return perf_minflt();
+		case MEMGROW_RUSAGE:
+			return thread_minflt();
+		default:
+			return memgrow_rss();
+	}
+}
+
+/*
+ * MTRACE_MEMGROW_BACKEND=perf|rusage|statm
+ */
+int memgrow_setup(const char *name)
+{
+	statm_fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+
+	if (name) {
+		if (!strcmp(name, "perf"))
+			backend = MEMGROW_PERF;
+		else if (!strcmp(name, "rusage"))
+			backend = MEMGROW_RUSAGE;
+		else if (!strcmp(name, "statm"))
+			backend = MEMGROW_STATM;
+		else
+			fprintf(stderr, "ERROR: unknown memgrow backend %s\n",
+					name);
+	}
+
+	if (backend == MEMGROW_PERF &&
+			pthread_key_create(&perf_key, perf_close))
+		backend = MEMGROW_RUSAGE;
+	return 0;
+}
+
+/*
+ * In the child of a fork(). The inherited counter and /proc/self/statm
+ * still describe the parent, open our own.
+ */
+void memgrow_fork_child(void)
+{
+	perf_close(NULL);
+
+	if (statm_fd >= 0)
+		close(statm_fd);
+	statm_fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+}
+
+/*
+ * Called at the beginning of the event top frame.
+ */
+void memgrow_start(void)
+{
+	start_faults = faults();
+}
+
+/*
+ * Number of pages faulted in by this thread since memgrow_start()
+ */
+unsigned long memgrow_faults(void)
+{
+	unsigned long now = faults();
+
+	if (now < start_faults)
+		return 0;
+	return now - start_faults;
+}
+
+unsigned long memgrow_rss(void)
+{
+/*
+          /proc/[pid]/statm
+              Provides information about memory usage, measured in pages.
+              The columns are:
+
+                  size       (1) total program size
+                             (same as VmSize in /proc/[pid]/status)
+                  resident   (2) resident set size
+                             (same as VmRSS in /proc/[pid]/status)
+                  shared     (3) number of resident shared pages (i.e., backed by a file)
+                             (same as RssFile+RssShmem in /proc/[pid]/status)
+                  text       (4) text (code)
+                  lib        (5) library (unused since Linux 2.6; always 0)
+                  data       (6) data + stack
+                  dt         (7) dirty pages (unused since Linux 2.6; always 0)
+*/
+
+	/* VSZ RSS */
+	unsigned long mem[2] = {0, 0};
+	char buf[64];
+
+	if (statm_fd < 0)
+		return 0;
+
+	memset(buf, 0x00, sizeof(buf));
+	if (pread(statm_fd, buf, sizeof(buf) - 1, 0) > 0)
+		sscanf(buf, "%lu %lu", &mem[0], &mem[1]);
+
+	/* return RSS. in page_size units */
+	return mem[1];
+}
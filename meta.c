@@ -0,0 +1,378 @@
+/*
+ * Copyright (C) 2017 Sergey Senozhatsky
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "config.h"
+#include <output.h>
+#include <meta.h>
+
+/*
+ * Metadata allocator.
+ *
+ * Call stacks, pointer tables, symbols and the rest of libmtrace's own
+ * state used to come from the interposed malloc(). That is not traced,
+ * but it is the application's heap: it shows up in mallinfo, RSS and
+ * the memgrow numbers. Metadata lives in its own mappings instead, made
+ * with a raw mmap syscall so that our mmap() doesn't see them either.
+ *
+ * Small objects come from 64K slabs of one power of two size class,
+ * freed objects go to the class free list. Larger objects get their own
+ * mapping. Both are SLAB_SZ aligned with a header at the start, so
+ * meta_free() finds the header by masking the pointer.
+ *
+ * Symbol names are interned into append-only string chunks, a name is
+ * stored once however many times it is resolved.
+ *
+ * MTRACE_META_LIMIT caps the mapped bytes, allocations over the limit
+ * fail and the tracer loses what it wanted to remember. At exit
+ *	[o:MAPPED:USED:PEAK:FAILED]
+ * is reported.
+ */
+
+#define META_SLAB_SZ		(64 * 1024)
+#define META_HDR_SZ		64
+#define META_MIN_CLASS		4
+#define META_MAX_CLASS		12
+#define META_STR_CHUNK_SZ	(64 * 1024)
+#define META_STR_BUCKETS	4096
+
+struct meta_hdr {
+	/* 0 for a mapping of its own */
+	unsigned int	class;
+	size_t		len;
+};
+
+struct meta_str {
+	struct meta_str	*next;
+	unsigned long	hash;
+	char		str[];
+};
+
+static void *free_lists[META_MAX_CLASS + 1];
+
+static struct meta_str *strings[META_STR_BUCKETS];
+static char *str_cur;
+static char *str_end;
+
+static struct meta_stats stats;
+static unsigned long limit;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *raw_mmap(size_t len)
+{
+	void *mem;
+
+	if (limit && stats.mapped + len > limit)
+		return NULL;
+
+#ifdef SYS_mmap2
+	mem = (void *)syscall(SYS_mmap2, NULL, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#else
+	mem = (void *)syscall(SYS_mmap, NULL, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#endif
+	if (mem == MAP_FAILED)
+		return NULL;
+
+	stats.mapped += len;
+	return mem;
+}
+
+static void raw_munmap(void *addr, size_t len)
+{
+	syscall(SYS_munmap, addr, len);
+	stats.mapped -= len;
+}
+
+/*
+ * Over-map by a slab and trim both ends, what's left is aligned.
+ */
+static struct meta_hdr *aligned_mmap(size_t len)
+{
+	unsigned long mem, start;
+
+	mem = (unsigned long)raw_mmap(len + META_SLAB_SZ);
+	if (!mem)
+		return NULL;
+
+	start = ALIGN(mem, (unsigned long)META_SLAB_SZ);
+	if (start != mem)
+		raw_munmap((void *)mem, start - mem);
+	raw_munmap((void *)(start + len), mem + META_SLAB_SZ - start);
+	return (struct meta_hdr *)start;
+}
+
+static struct meta_hdr *hdr(void *ptr)
+{
+	return (struct meta_hdr *)((unsigned long)ptr &
+			~((unsigned long)META_SLAB_SZ - 1));
+}
+
+static int size_class(size_t size)
+{
+	int class = META_MIN_CLASS;
+
+	while ((1UL << class) < size)
+		class++;
+	return class;
+}
+
+static int slab_add(int class)
+{
+	struct meta_hdr *slab = aligned_mmap(META_SLAB_SZ);
+	size_t len = 1UL << class;
+	char *obj;
+
+	if (!slab)
+		return -1;
+
+	slab->class = class;
+	slab->len = META_SLAB_SZ;
+
+	for (obj = (char *)slab + META_SLAB_SZ - len;
+			obj >= (char *)slab + META_HDR_SZ; obj -= len) {
+		*(void **)obj = free_lists[class];
+		free_lists[class] = obj;
+	}
+	return 0;
+}
+
+static void account(long bytes)
+{
+	stats.used += bytes;
+	if (stats.used > stats.peak)
+		stats.peak = stats.used;
+}
+
+/*
+ * Returns zeroed memory.
+ */
+void *meta_alloc(size_t size)
+{
+	struct meta_hdr *large;
+	void *ptr = NULL;
+	size_t len;
+	int class;
+
+	if (size > (1UL << META_MAX_CLASS)) {
+		len = ALIGN(size + META_HDR_SZ, (size_t)DEFAULT_PAGE_SIZE);
+		if (len < size)
+			return NULL;
+
+		pthread_mutex_lock(&lock);
+		large = aligned_mmap(len);
+		if (large) {
+			large->class = 0;
+			large->len = len;
+			account(len);
+			ptr = (char *)large + META_HDR_SZ;
+		} else {
+			stats.failed++;
+		}
+		pthread_mutex_unlock(&lock);
+		return ptr;
+	}
+
+	class = size_class(size);
+
+	pthread_mutex_lock(&lock);
+	if (!free_lists[class] && slab_add(class)) {
+		stats.failed++;
+		pthread_mutex_unlock(&lock);
+		return NULL;
+	}
+
+	ptr = free_lists[class];
+	free_lists[class] = *(void **)ptr;
+	account(1UL << class);
+	pthread_mutex_unlock(&lock);
+
+	memset(ptr, 0x00, 1UL << class);
+	return ptr;
+}
+
+static size_t meta_size(void *ptr)
+{
+	struct meta_hdr *h = hdr(ptr);
+
+	if (!h->class)
+		return h->len - META_HDR_SZ;
+	return 1UL << h->class;
+}
+
+void meta_free(void *ptr)
+{
+	struct meta_hdr *h;
+
+	if (!ptr)
+		return;
+
+	h = hdr(ptr);
+
+	pthread_mutex_lock(&lock);
+	if (!h->class) {
+		account(-(long)h->len);
+		raw_munmap(h, h->len);
+	} else {
+		account(-(1L << h->class));
+		*(void **)ptr = free_lists[h->class];
+		free_lists[h->class] = ptr;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Tables grow by 1.5, copying is rare enough.
+ */
+void *meta_realloc(void *ptr, size_t size)
+{
+	void *new;
+
+	if (!ptr)
+		return meta_alloc(size);
+
+	if (size <= meta_size(ptr))
+		return ptr;
+
+	new = meta_alloc(size);
+	if (!new)
+		return NULL;
+
+	memcpy(new, ptr, meta_size(ptr));
+	meta_free(ptr);
+	return new;
+}
+
+static unsigned long hash_str(const char *str)
+{
+	unsigned long hash = 5381;
+
+	while (*str)
+		hash = hash * 33 + (unsigned char)*str++;
+	return hash;
+}
+
+/*
+ * Names are never freed, the region only grows. A name that doesn't
+ * fit into a chunk gets a chunk of its own.
+ */
+const char *meta_intern(const char *str)
+{
+	unsigned long hash = hash_str(str);
+	size_t len = ALIGN(sizeof(struct meta_str) + strlen(str) + 1,
+			sizeof(long));
+	struct meta_str **bucket = &strings[hash & (META_STR_BUCKETS - 1)];
+	struct meta_str *s;
+
+	pthread_mutex_lock(&lock);
+	for (s = *bucket; s; s = s->next) {
+		if (s->hash == hash && !strcmp(s->str, str))
+			goto out;
+	}
+
+	if ((size_t)(str_end - str_cur) < len) {
+		size_t chunk = META_STR_CHUNK_SZ;
+		char *mem;
+
+		if (chunk < len)
+			chunk = ALIGN(len, (size_t)DEFAULT_PAGE_SIZE);
+
+		mem = raw_mmap(chunk);
+		if (!mem) {
+			stats.failed++;
+			pthread_mutex_unlock(&lock);
+			return NULL;
+		}
+
+		/* the tail of the old chunk is lost */
+		account(str_end - str_cur);
+		str_cur = mem;
+		str_end = mem + chunk;
+	}
+
+	s = (struct meta_str *)str_cur;
+	str_cur += len;
+	account(len);
+
+	s->hash = hash;
+	strcpy(s->str, str);
+	s->next = *bucket;
+	*bucket = s;
+out:
+	pthread_mutex_unlock(&lock);
+	return s->str;
+}
+
+/*
+ * Held across fork(), the child's free lists and string chunks are
+ * never caught half way. The mappings are private copies, nothing else
+ * to do.
+ */
+void meta_fork_prepare(void)
+{
+	pthread_mutex_lock(&lock);
+}
+
+void meta_fork_parent(void)
+{
+	pthread_mutex_unlock(&lock);
+}
+
+void meta_fork_child(void)
+{
+	pthread_mutex_unlock(&lock);
+}
+
+void meta_setup(unsigned long __limit)
+{
+	limit = __limit;
+}
+
+void meta_get_stats(struct meta_stats *__stats)
+{
+	pthread_mutex_lock(&lock);
+	*__stats = stats;
+	pthread_mutex_unlock(&lock);
+}
+
+void meta_dump(struct options *opts)
+{
+	struct meta_stats st;
+
+	if (opts->flags & OPTS_HUMAN_READABLE)
+		return;
+
+	meta_get_stats(&st);
+	output("[o:%lu:%lu:%lu:%lu]\n", st.mapped, st.used, st.peak,
+			st.failed);
+	output_commit(opts);
+}
@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) 2017 Sergey Senozhatsky
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <livestats.h>
+
+/*
+ * mtrace-top: a refreshing terminal view of the live statistics that
+ * libmtrace publishes with MTRACE_LIVE_STATS=1.
+ */
+
+#define DEF_ROWS	10
+#define READ_RETRIES	100
+
+static int pid;
+static int rows = DEF_ROWS;
+static unsigned long delay_ms;
+static long iterations = -1;
+static int batch;
+
+static const struct livestats *ls;
+static struct livestats snap;
+
+static const char *human_size(unsigned long sz, char *buf, size_t len)
+{
+	static const char *units[] = { "B", "K", "M", "G", "T" };
+	int u = 0;
+	double v = sz;
+
+	while (v >= 1024 && u < 4) {
+		v /= 1024;
+		u++;
+	}
+
+	if (!u)
+		snprintf(buf, len, "%lu%s", sz, units[u]);
+	else
+		snprintf(buf, len, "%.1f%s", v, units[u]);
+	return buf;
+}
+
+/*
+ * Seqlock read side: retry while the writer is active or was active
+ * during the copy.
+ */
+static int read_snapshot(void)
+{
+	int i;
+
+	for (i = 0; i < READ_RETRIES; i++) {
+		uint32_t seq, seq2;
+
+		seq = __atomic_load_n(&ls->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			usleep(1000);
+			continue;
+		}
+
+		memcpy(&snap, (const void *)ls, sizeof(snap));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		seq2 = __atomic_load_n(&ls->seq, __ATOMIC_RELAXED);
+		if (seq == seq2)
+			return 0;
+	}
+	return -EAGAIN;
+}
+
+static void show(void)
+{
+	char b1[32], b2[32];
+	int i, shown;
+
+	if (!batch)
+		printf("\033[H\033[2J");
+
+	printf("mtrace-top - pid %d, update %lu, every %lu ms\n\n",
+			snap.pid, snap.updates, snap.interval_ms);
+
+	printf("%-23s %14s %10s %14s %10s\n", "EVENT", "CALLS", "BYTES",
+			"CALLS/s", "BYTES/s");
+	for (i = 0; i < snap.nr_events && i < LIVESTATS_EVENTS; i++) {
+		const struct livestats_event *ev = &snap.events[i];
+
+		if (!ev->calls)
+			continue;
+
+		printf("%-23.*s %14lu %10s %14lu %10s\n",
+				LIVESTATS_NAME_SZ, ev->name, ev->calls,
+				human_size(ev->bytes, b1, sizeof(b1)),
+				ev->calls_rate,
+				human_size(ev->bytes_rate, b2, sizeof(b2)));
+	}
+
+	printf("\n%-8s %14s %10s %14s %10s\n", "TID", "CALLS", "BYTES",
+			"CALLS/s", "BYTES/s");
+	shown = snap.nr_threads < rows ? snap.nr_threads : rows;
+	for (i = 0; i < shown && i < LIVESTATS_THREADS; i++) {
+		const struct livestats_thread *t = &snap.threads[i];
+
+		printf("%-8d %14lu %10s %14lu %10s\n", t->tid, t->calls,
+				human_size(t->bytes, b1, sizeof(b1)),
+				t->calls_rate,
+				human_size(t->bytes_rate, b2, sizeof(b2)));
+	}
+
+	printf("\n%-18s %14s %10s  %s\n", "CALLSITE", "CALLS/s", "BYTES/s",
+			"SYMBOL");
+	shown = snap.nr_callsites < rows ? snap.nr_callsites : rows;
+	for (i = 0; i < shown && i < LIVESTATS_CALLSITES; i++) {
+		const struct livestats_callsite *c = &snap.callsites[i];
+
+		printf("0x%016lx %14lu %10s  %.*s\n", c->addr,
+				c->calls_rate,
+				human_size(c->bytes_rate, b1, sizeof(b1)),
+				LIVESTATS_SYM_SZ, c->sym);
+	}
+
+	if (batch)
+		printf("\n");
+	fflush(stdout);
+}
+
+static int attach(void)
+{
+	char path[64];
+	int fd;
+
+	snprintf(path, sizeof(path), LIVESTATS_PATH, pid);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+
+	ls = mmap(NULL, sizeof(*ls), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ls == MAP_FAILED) {
+		fprintf(stderr, "Can't map %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+
+	if (ls->magic != LIVESTATS_MAGIC ||
+			ls->version != LIVESTATS_VERSION) {
+		fprintf(stderr, "%s: unsupported segment version\n", path);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static void error_usage(void)
+{
+	printf("mtrace-top\n"
+		"-p --pid=PID        process to watch\n"
+		"-d --delay=SEC      refresh interval (the update interval)\n"
+		"-n --iterations=N   exit after N refreshes\n"
+		"-r --rows=N         threads and callsites to show (%d)\n"
+		"-b --batch          no screen clearing, for logs and pipes\n",
+		DEF_ROWS);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	static struct option long_options[] = {
+		{"pid", 1, 0, 'p'},
+		{"delay", 1, 0, 'd'},
+		{"iterations", 1, 0, 'n'},
+		{"rows", 1, 0, 'r'},
+		{"batch", 0, 0, 'b'},
+		{0, 0, 0, 0}
+	};
+
+	const char *appopts = "p:d:n:r:b";
+	while (1) {
+		int c = getopt_long(argc, argv, appopts, long_options, NULL);
+		if (c == -1)
+			break;
+
+		switch (c) {
+			case 'p':
+				pid = atoi(optarg);
+				break;
+			case 'd':
+				delay_ms = strtod(optarg, NULL) * 1000;
+				break;
+			case 'n':
+				iterations = atol(optarg);
+				break;
+			case 'r':
+				rows = atoi(optarg);
+				break;
+			case 'b':
+				batch = 1;
+				break;
+			default:
+				error_usage();
+		}
+	}
+
+	if (pid <= 0)
+		error_usage();
+
+	if (attach())
+		return EXIT_FAILURE;
+
+	if (!delay_ms)
+		delay_ms = ls->interval_ms;
+
+	while (iterations) {
+		/* the segment outlives a crashed process */
+		if (kill(pid, 0) && errno == ESRCH) {
+			fprintf(stderr, "Process %d is gone\n", pid);
+			return EXIT_FAILURE;
+		}
+
+		if (read_snapshot()) {
+			fprintf(stderr, "Can't read a consistent snapshot\n");
+		} else {
+			show();
+		}
+
+		if (iterations > 0)
+			iterations--;
+		if (iterations)
+			usleep(delay_ms * 1000);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2017 Sergey Senozhatsky
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+
+#include "config.h"
+#include <output.h>
+#include <sampler.h>
+#include <profile.h>
+#include <numa.h>
+
+/*
+ * NUMA placement sampler.
+ *
+ * Allocations remember the CPU they were made on (see profile.c). Every
+ * `interval' seconds the sampler thread takes the large live blocks from
+ * the pointer table and asks the kernel on which node a few of their
+ * pages are, move_pages() with no target nodes only queries. Pages that
+ * were not touched yet are not placed and are not counted. Each block
+ * with at least one placed page is reported:
+ *	[n:SEQ:SEC.USEC:NR_NODES]
+ *	[N:ID:TID:CPU:CPU_NODE:BYTES:LOCAL_PAGES:REMOTE_PAGES]
+ *	...
+ *
+ * Without NUMA (one node, or no move_pages()) every resident page is
+ * local, so the records stay the same everywhere.
+ */
+
+#define NUMA_DEF_INTERVAL	10
+#define NUMA_MAX_BLOCKS		4096
+#define NUMA_SAMPLE_PAGES	8
+#define NUMA_MAX_CPUS		4096
+#define NUMA_MAX_NODES		1024
+
+static struct options *numa_opts;
+static size_t numa_min_size;
+static unsigned long page_size;
+static unsigned long numa_seq;
+static int nr_nodes = 1;
+static int have_move_pages = 1;
+
+static short cpu_node[NUMA_MAX_CPUS];
+
+/* only the sampler thread uses this */
+static struct live_block blocks[NUMA_MAX_BLOCKS];
+
+/*
+ * /sys/devices/system/node/nodeN/cpulist, e.g. "0-3,8-11"
+ */
+static void parse_cpulist(int node, const char *list)
+{
+	while (*list) {
+		char *end;
+		long from, to;
+
+		from = strtol(list, &end, 10);
+		if (end == list)
+			break;
+
+		to = from;
+		if (*end == '-')
+			to = strtol(end + 1, &end, 10);
+
+		for (; from <= to && from < NUMA_MAX_CPUS; from++)
+			if (from >= 0)
+				cpu_node[from] = node;
+
+		if (*end != ',')
+			break;
+		list = end + 1;
+	}
+}
+
+static void read_topology(void)
+{
+	int node;
+
+	for (node = 0; node < NUMA_MAX_NODES; node++) {
+		char path[64], buf[4096];
+		FILE *f;
+
+		snprintf(path, sizeof(path),
+				"/sys/devices/system/node/node%d/cpulist", node);
+		f = fopen(path, "re");
+		if (!f)
+			continue;
+
+		if (fgets(buf, sizeof(buf), f))
+			parse_cpulist(node, buf);
+		fclose(f);
+
+		if (node + 1 > nr_nodes)
+			nr_nodes = node + 1;
+	}
+}
+
+static int node_of_cpu(int cpu)
+{
+	if (cpu < 0 || cpu >= NUMA_MAX_CPUS)
+		return -1;
+	return cpu_node[cpu];
+}
+
+/*
+ * Fills `status' with the node of every page, or a negative errno for
+ * pages that are not there.
+ */
+static void query_pages(void **pages, int *status, int nr)
+{
+	unsigned char vec;
+	int i;
+
+	if (have_move_pages) {
+		if (!syscall(SYS_move_pages, 0, nr, pages, NULL, status, 0))
+			return;
+		if (errno == ENOSYS)
+			have_move_pages = 0;
+	}
+
+	/* no NUMA, resident pages are on node 0 */
+	for (i = 0; i < nr; i++) {
+		if (mincore(pages[i], page_size, &vec))
+			status[i] = -EFAULT;
+		else
+			status[i] = vec & 1 ? 0 : -ENOENT;
+	}
+}
+
+static void sample_block(struct live_block *b)
+{
+	void *pages[NUMA_SAMPLE_PAGES];
+	int status[NUMA_SAMPLE_PAGES];
+	unsigned long start = b->ptr & ~(page_size - 1);
+	unsigned long nr_pages, step;
+	int i, nr, node, local = 0, remote = 0;
+
+	nr_pages = (ALIGN(b->ptr + b->size, page_size) - start) / page_size;
+	/* zero sized blocks, MTRACE_NUMA_MIN_SIZE=0 lets them through */
+	if (!nr_pages)
+		return;
+
+	nr = nr_pages < NUMA_SAMPLE_PAGES ? nr_pages : NUMA_SAMPLE_PAGES;
+	step = nr_pages / nr;
+
+	/* spread the samples over the whole block */
+	for (i = 0; i < nr; i++)
+		pages[i] = (void *)(start + i * step * page_size);
+
+	query_pages(pages, status, nr);
+
+	node = node_of_cpu(b->cpu);
+	for (i = 0; i < nr; i++) {
+		if (status[i] < 0)
+			continue;
+
+		if (status[i] == node || node < 0)
+			local++;
+		else
+			remote++;
+	}
+
+	if (!local && !remote)
+		return;
+
+	output("[N:%lu:%d:%d:%d:%lu:%d:%d]\n", b->stack_id, b->tid,
+			b->cpu, node, (unsigned long)b->size, local, remote);
+	output_commit(numa_opts);
+}
+
+static void numa_sample(void)
+{
+	struct timeval tv;
+	int i, nr_blocks;
+
+	nr_blocks = profile_live_blocks(numa_min_size, blocks,
+			NUMA_MAX_BLOCKS);
+
+	gettimeofday(&tv, NULL);
+	output("[n:%lu:%lu.%06d:%d]\n", ++numa_seq,
+			(unsigned long)tv.tv_sec,
+			(int)tv.tv_usec,
+			nr_nodes);
+	output_commit(numa_opts);
+
+	for (i = 0; i < nr_blocks; i++)
+		sample_block(&blocks[i]);
+}
+
+/*
+ * MTRACE_NUMA_MIN_SIZE=<num> enables the sampler for blocks of at least
+ * <num> bytes, MTRACE_NUMA_INTERVAL=SECONDS, 10 by default. Needs the
+ * pointer table, the caller turns it on.
+ */
+int numa_setup(struct options *opts, size_t min_size)
+{
+	unsigned long interval = NUMA_DEF_INTERVAL;
+
+	if (getenv("MTRACE_NUMA_INTERVAL"))
+		interval = strtoul(getenv("MTRACE_NUMA_INTERVAL"), NULL, 10);
+	if (!interval)
+		return 0;
+
+	numa_opts = opts;
+	numa_min_size = min_size;
+	page_size = sysconf(_SC_PAGESIZE);
+	read_topology();
+
+	opts->flags |= OPTS_NUMA_SAMPLE;
+	return sampler_register(numa_sample, interval * 1000);
+}
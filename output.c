@@ -21,23 +21,31 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <errno.h>
 #include <string.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <sys/time.h>
 #include <unistd.h>
 #include <sys/syscall.h>
 
 #include <output.h>
+#include <lineage.h>
 
 static __thread int offt = 0;
 static __thread char output_buf[2 * DEFAULT_PAGE_SIZE];
 
 static __thread long thread_id = -1;
 
+static char log_dir[4096];
+/* the trace file of this image, rotated files add a suffix to it */
+static char log_name[sizeof(log_dir) + NAME_MAX + 32];
+static int log_seq;
+
 static int __get_pid(void)
 {
 	if (thread_id < 0)
@@ -69,6 +77,11 @@ int output(const char *fmt, ...)
 	return wr;
 }
 
+int output_tid(void)
+{
+	return __get_pid();
+}
+
 int output_event_pid(void)
 {
 	return output("[t:%ld]", __get_pid());
@@ -91,22 +104,44 @@ void output_commit(struct options *opts)
 	offt = 0;
 }
 
-static void create_mtrace_file(struct options *opts, const char *base_path)
+void output_discard(void)
+{
+	offt = 0;
+}
+
+/*
+ * An image that replaced a traced one with exec() has the same name and
+ * pid. It gets path/mtrace-${APPLICATION_NAME}-${PID}.exec${N}, the
+ * trace of the old image is kept.
+ */
+static int create_mtrace_file(struct options *opts, const char *base_path)
 {
-	char fname[4096];
+	int exec = lineage_exec();
 	FILE *out;
+	int seq;
 
-	snprintf(fname, sizeof(fname) - 1, "%s/mtrace-%s-%lu",
+	snprintf(log_name, sizeof(log_name), "%s/mtrace-%s-%lu",
 			base_path,
 			program_invocation_short_name,
-			__get_pid());
+			(unsigned long)__get_pid());
+	out = fopen(log_name, exec ? "wx" : "w");
+
+	for (seq = 1; !out && errno == EEXIST; seq++) {
+		snprintf(log_name, sizeof(log_name), "%s/mtrace-%s-%lu.exec%d",
+				base_path,
+				program_invocation_short_name,
+				(unsigned long)__get_pid(),
+				seq);
+		out = fopen(log_name, "wx");
+	}
 
-	out = fopen(fname, "w");
 	if (!out) {
+		int err = errno;
+
 		fprintf(stderr,
 			"can't open %s: %s\n",
-			fname, strerror(errno));
-		exit(1);
+			log_name, strerror(err));
+		return -err;
 	}
 
 	setvbuf(out, (char *)NULL, _IOLBF, 0);
@@ -114,10 +149,83 @@ static void create_mtrace_file(struct options *opts, const char *base_path)
 
 	opts->fd = out;
 
-	fprintf(stderr, "\n\n*** Trace file name: `tailf %s'\n\n", fname);
+	fprintf(stderr, "\n\n*** Trace file name: `tailf %s'\n\n", log_name);
+	return 0;
 }
 
 void mtrace_init_file(struct options *opts, const char *fname)
 {
-	create_mtrace_file(opts, fname);
+	snprintf(log_dir, sizeof(log_dir) - 1, "%s", fname);
+	if (create_mtrace_file(opts, fname))
+		exit(1);
+}
+
+/*
+ * In the child of a fork(), which gets path/mtrace-${APPLICATION_NAME}-${PID}
+ * of its own. Whatever the parent had buffered in the stream is dropped,
+ * the parent writes it. If the file can't be created the child traces
+ * to stderr, like without MTRACE_LOG_DIR: exiting would kill the
+ * application's child.
+ */
+void output_fork_child(struct options *opts)
+{
+	thread_id = -1;
+	offt = 0;
+	log_seq = 0;
+
+	if (!log_dir[0])
+		return;
+
+	__fpurge(opts->fd);
+	fclose(opts->fd);
+	if (create_mtrace_file(opts, log_dir)) {
+		opts->fd = stderr;
+		log_dir[0] = 0x00;
+	}
+}
+
+/*
+ * Switch the trace to path/mtrace-${APPLICATION_NAME}-${PID}.${SEQ}, or
+ * to .exec${N}.${SEQ} of an image that replaced a traced one.
+ * The stream stays, the new file replaces its descriptor under the
+ * stream lock. If the new file can't be opened we keep the old one.
+ */
+int mtrace_rotate_file(struct options *opts)
+{
+	char fname[sizeof(log_name) + 16];
+	FILE *out;
+	int err;
+
+	if (!log_dir[0])
+		return -EINVAL;
+
+	snprintf(fname, sizeof(fname), "%s.%d", log_name, ++log_seq);
+
+	out = fopen(fname, "w");
+	if (!out) {
+		err = errno;
+		fprintf(stderr,
+			"can't open %s: %s\n",
+			fname, strerror(err));
+		return -err;
+	}
+
+	flockfile(opts->fd);
+	fflush(opts->fd);
+	err = 0;
+	if (dup3(fileno(out), fileno(opts->fd), O_CLOEXEC) < 0)
+		err = errno;
+	funlockfile(opts->fd);
+	fclose(out);
+
+	if (err > 0) {
+		unlink(fname);
+		fprintf(stderr,
+			"can't switch to %s: %s\n",
+			fname, strerror(err));
+		return -err;
+	}
+
+	fprintf(stderr, "\n\n*** Trace file name: `tailf %s'\n\n", fname);
+	return 0;
 }
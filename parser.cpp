@@ -19,6 +19,7 @@
 
 #include <sys/ioctl.h>
 #include <sys/types.h>
+#include <dirent.h>
 #include <errno.h>
 #include <getopt.h>
 #include <limits.h>
@@ -26,6 +27,7 @@
 #include <string.h>
 #include <iostream>
 #include <cstring>
+#include <cmath>
 #include <fstream>
 #include <sys/mman.h>
 #include <unordered_map>
@@ -38,6 +40,7 @@ using namespace std;
 
 static struct options opts = {
 	.file = string(),
+	.tree = string(),
 	.plain = 0,
 	.debug = 0,
 };
@@ -45,6 +48,64 @@ static struct options opts = {
 static map<int, struct proc_tid*> proc_map;
 
 static unordered_map<size_t, long> callpath_freq;
+/* first backtrace frame (the callsite) -> callpath hash */
+static unordered_map<unsigned long, size_t> callsite_hash;
+/* [R:] records: callsites with rate limited events left at exit */
+static vector<pair<unsigned long, unsigned long>> suppressed_callsites;
+
+/* profile mode: stack id -> stack */
+static map<unsigned long, struct profile_stack> profile_stacks;
+static unsigned long profile_seq;
+
+/* leak report / heap snapshot */
+static vector<struct heap_group> heap_groups;
+static unsigned long heap_seq;
+static string heap_reason;
+
+/* counters mode: calls and bytes per event name, total and per thread */
+static map<string, pair<unsigned long, unsigned long>> counters_total;
+static map<int, map<string, pair<unsigned long, unsigned long>>> counters_tid;
+static unsigned long counters_elapsed_ms;
+static unsigned long counters_seq;
+
+/* size histograms: class -> bucket -> count, log2 and fine grained */
+static map<string, map<int, unsigned long>> size_hist_log2;
+static map<string, map<int, unsigned long>> size_hist_fine;
+static unsigned long size_hist_seq;
+
+/* latency mode: event name -> lower bucket bound in ns -> count */
+static map<string, map<unsigned long, unsigned long>> latency_hist;
+static unsigned long latency_threshold_ns;
+static unsigned long latency_seq;
+
+/* glibc statistics: [a:] samples and the last [x:] malloc_info() */
+static vector<struct heap_stat> heap_stats;
+static map<int, struct arena_info> arenas;
+static unsigned long malloc_info_seq;
+static int malloc_info_heap = -1;
+/* the traced process, [proc:] */
+static struct proc_info proc_self;
+static bool proc_seen;
+
+/* libmtrace's own memory, [o:] at exit */
+static unsigned long meta_mapped, meta_used, meta_peak, meta_failed;
+static bool meta_seen;
+
+/* cold memory sampler */
+static vector<struct cold_group> cold_groups;
+static unsigned long cold_seq;
+
+/* NUMA placement sampler: stack id -> placement */
+static map<unsigned long, struct numa_group> numa_groups;
+static unsigned long numa_seq;
+static int numa_nodes;
+
+/* application tags: tag id -> stats, tag 0 stands for untagged events */
+static map<int, struct tag_stat> tag_stats;
+/* live blocks of traced events: address -> size, tag */
+static unordered_map<unsigned long, pair<unsigned long, int>> tag_blocks;
+/* [mark:] records: tag id, timestamp */
+static vector<pair<int, string>> tag_marks;
 
 struct symbol {
 	long nr;
@@ -68,6 +129,7 @@ static int security_report = 0;
 #define CELL_COLOR_USED_ALLOC	"#aaff80"
 #define CELL_COLOR_USED_MEMSET	"#b3ffb3"
 #define CELL_COLOR_UNUSED	"#e6f7ff"
+#define CELL_COLOR_RELEASED	"#d9d9d9"
 
 #define CELL_COLOR_WARNING	"#ffcccc"
 
@@ -81,10 +143,10 @@ static bool events_sz_cmp(const struct mm_event *a, const struct mm_event *b)
 	unsigned long sz1 = a->size;
 	unsigned long sz2 = b->size;
 
-	if (a->type == EVENT_CALLOC)
+	if (a->type == EVENT_CALLOC || a->type == EVENT_REALLOCARRAY)
 		sz1 *= a->flags;
 
-	if (b->type == EVENT_CALLOC)
+	if (b->type == EVENT_CALLOC || b->type == EVENT_REALLOCARRAY)
 		sz2 *= b->flags;
 
 	if (a->type == EVENT_MEMALIGN ||
@@ -339,6 +401,149 @@ int munlockall_event_header(struct mm_event *event, string &line)
 				&event->ret);
 }
 
+int new_event_header(struct mm_event *event, string &line)
+{
+	event->type = EVENT_NEW;
+	return sscanf(line.c_str(), formatters[EVENT_NEW].regex,
+				&event->tid,
+				&event->timestamp.tv_sec,
+				&event->timestamp.tv_usec,
+				&event->size,
+				&event->align,
+				&event->addr);
+}
+
+int new_array_event_header(struct mm_event *event, string &line)
+{
+	event->type = EVENT_NEW_ARRAY;
+	return sscanf(line.c_str(), formatters[EVENT_NEW_ARRAY].regex,
+				&event->tid,
+				&event->timestamp.tv_sec,
+				&event->timestamp.tv_usec,
+				&event->size,
+				&event->align,
+				&event->addr);
+}
+
+int delete_event_header(struct mm_event *event, string &line)
+{
+	event->type = EVENT_DELETE;
+	return sscanf(line.c_str(), formatters[EVENT_DELETE].regex,
+				&event->tid,
+				&event->timestamp.tv_sec,
+				&event->timestamp.tv_usec,
+				&event->addr,
+				&event->size);
+}
+
+int delete_array_event_header(struct mm_event *event, string &line)
+{
+	event->type = EVENT_DELETE_ARRAY;
+	return sscanf(line.c_str(), formatters[EVENT_DELETE_ARRAY].regex,
+				&event->tid,
+				&event->timestamp.tv_sec,
+				&event->timestamp.tv_usec,
+				&event->addr,
+				&event->size);
+}
+
+int reallocarray_event_header(struct mm_event *event, string &line)
+{
+	event->type = EVENT_REALLOCARRAY;
+	return sscanf(line.c_str(), formatters[EVENT_REALLOCARRAY].regex,
+				&event->tid,
+				&event->timestamp.tv_sec,
+				&event->timestamp.tv_usec,
+				&event->prev_addr,
+				&event->size,
+				&event->flags,
+				&event->addr);
+}
+
+int free_sized_event_header(struct mm_event *event, string &line)
+{
+	event->type = EVENT_FREE_SIZED;
+	return sscanf(line.c_str(), formatters[EVENT_FREE_SIZED].regex,
+				&event->tid,
+				&event->timestamp.tv_sec,
+				&event->timestamp.tv_usec,
+				&event->addr,
+				&event->size);
+}
+
+int free_aligned_sized_event_header(struct mm_event *event, string &line)
+{
+	event->type = EVENT_FREE_ALIGNED_SIZED;
+	return sscanf(line.c_str(), formatters[EVENT_FREE_ALIGNED_SIZED].regex,
+				&event->tid,
+				&event->timestamp.tv_sec,
+				&event->timestamp.tv_usec,
+				&event->addr,
+				&event->align,
+				&event->size);
+}
+
+int malloc_usable_size_event_header(struct mm_event *event, string &line)
+{
+	event->type = EVENT_MALLOC_USABLE_SIZE;
+	return sscanf(line.c_str(), formatters[EVENT_MALLOC_USABLE_SIZE].regex,
+				&event->tid,
+				&event->timestamp.tv_sec,
+				&event->timestamp.tv_usec,
+				&event->addr,
+				&event->size);
+}
+
+int mremap_event_header(struct mm_event *event, string &line)
+{
+	event->type = EVENT_MREMAP;
+	return sscanf(line.c_str(), formatters[EVENT_MREMAP].regex,
+				&event->tid,
+				&event->timestamp.tv_sec,
+				&event->timestamp.tv_usec,
+				&event->prev_addr,
+				&event->prev_size,
+				&event->size,
+				&event->flags,
+				&event->addr);
+}
+
+int madvise_event_header(struct mm_event *event, string &line)
+{
+	event->type = EVENT_MADVISE;
+	return sscanf(line.c_str(), formatters[EVENT_MADVISE].regex,
+				&event->tid,
+				&event->timestamp.tv_sec,
+				&event->timestamp.tv_usec,
+				&event->addr,
+				&event->size,
+				&event->mask,
+				&event->ret);
+}
+
+int brk_event_header(struct mm_event *event, string &line)
+{
+	event->type = EVENT_BRK;
+	return sscanf(line.c_str(), formatters[EVENT_BRK].regex,
+				&event->tid,
+				&event->timestamp.tv_sec,
+				&event->timestamp.tv_usec,
+				&event->addr,
+				&event->incr,
+				&event->ret);
+}
+
+int sbrk_event_header(struct mm_event *event, string &line)
+{
+	event->type = EVENT_SBRK;
+	return sscanf(line.c_str(), formatters[EVENT_SBRK].regex,
+				&event->tid,
+				&event->timestamp.tv_sec,
+				&event->timestamp.tv_usec,
+				&event->incr,
+				&event->addr);
+}
+
 static struct mm_event *new_mm_event(string &line)
 {
 	int i = 0;
@@ -351,6 +556,11 @@ static struct mm_event *new_mm_event(string &line)
 
 			event->mem_from = 0;
 			event->mem_to = 0;
+			event->suppressed = 0;
+			event->latency_ns = 0;
+			event->tag = 0;
+			event->prev_size = 0;
+			event->incr = 0;
 			event->trace_hash = 0;
 
 			ret = formatters[i].parse(event, line);
@@ -435,155 +645,759 @@ static int parse_event_backtrace(struct mm_event *event, string &line)
 	return 0;
 }
 
-static struct proc_tid *get_proc_tid(int tid)
+static void parse_stack_frame(struct profile_stack *stack, string &line)
 {
-	struct proc_tid *proc;
-	
-	if (proc_map.find(tid) == proc_map.end()) {
-		proc = new proc_tid;
+	struct backtrace trace;
 
-		proc->tid = tid;
-		memset(proc->stats, 0x00, sizeof(proc->stats));
-		proc_map[tid] = proc;
-	} else {
-		proc = proc_map[tid];
+	if (sscanf(line.c_str(), "#%lx#%ld#%lx",
+			&trace.addr,
+			&trace.num,
+			&trace.offt) != 3) {
+		cerr << "Can't parse backtrace: " << line << endl;
+		return;
 	}
 
-	return proc;
+	stack->trace.push_back(trace);
 }
 
-static void __print_event(struct mm_event *event);
-
-static void add_tid_event(struct mm_event *event)
+static struct profile_stack *new_profile_stack(string &line)
 {
-	struct proc_tid *proc = get_proc_tid(event->tid);
+	unsigned long id;
+	struct profile_stack *stack;
 
-	if (event->trace.size() != 0) {
-		size_t _hash = 0;
+	// [s:42]
+	if (sscanf(line.c_str(), "[s:%lu]", &id) != 1) {
+		cerr << "Can't parse stack: " << line << endl;
+		return NULL;
+	}
 
-		for (auto &p : event->trace) {
-			size_t fh = std::hash<size_t>{}(p.addr);
-			_hash ^= (fh << 1);
-			_hash = std::hash<size_t>{}(_hash);
-		}
+	stack = &profile_stacks[id];
+	stack->id = id;
+	stack->trace.clear();
+	return stack;
+}
 
-		if (_hash != 0) {
-			if (callpath_freq.find(_hash) != callpath_freq.end())
-				callpath_freq[_hash]++;
-			else
-				callpath_freq[_hash] = 1;
-		}
-		event->trace_hash = _hash;
+static void profile_snapshot(string &line)
+{
+	// [p:3:1500000000.123456]
+	if (sscanf(line.c_str(), "[p:%lu:", &profile_seq) != 1) {
+		cerr << "Can't parse profile: " << line << endl;
+		return;
 	}
 
-	proc->events.push_back(event);
-	proc->stats[event->type]++;
+	// only the last snapshot is reported
+	for (auto &p : profile_stacks) {
+		p.second.allocs = 0;
+		p.second.alloc_bytes = 0;
+		p.second.frees = 0;
+		p.second.live_bytes = 0;
+		p.second.lifetime.clear();
+	}
 }
 
-static void add_mem_area(struct mm_event *event)
+static void profile_row(string &line)
 {
-	unsigned long size = 0;
-	unsigned long addr = 0;
-
-	/* MEMSET can be called on a sub-range of allocated object.
-	 * e.g. allocate structure, memset() a small buffer in
-	 * that structure. It will require a whole linear scan of
-	 * the tree to find the proper sub-object.
-	 *
-	 * so skip MEMSET events for now.
-	 */
-	if (event->type == EVENT_MEMSET)
+	unsigned long id, allocs, alloc_bytes, frees, live_bytes;
+	struct profile_stack *stack;
+
+	// [P:42:1000:64000:990:640]
+	if (sscanf(line.c_str(), "[P:%lu:%lu:%lu:%lu:%lu]",
+			&id, &allocs, &alloc_bytes,
+			&frees, &live_bytes) != 5) {
+		cerr << "Can't parse profile: " << line << endl;
 		return;
+	}
 
-	if (event->type == EVENT_REALLOC) {
-		if (mem_area.find(event->prev_addr) != mem_area.end()) {
-			delete mem_area[event->prev_addr];
-			mem_area.erase(event->prev_addr);
-		}
+	stack = &profile_stacks[id];
+	stack->id = id;
+	stack->allocs = allocs;
+	stack->alloc_bytes = alloc_bytes;
+	stack->frees = frees;
+	stack->live_bytes = live_bytes;
+}
+
+static void profile_lifetime(string &line)
+{
+	struct profile_stack *stack;
+	unsigned long id, count;
+	int bucket, off;
+
+	// [L:42:10=5,17=3]
+	if (sscanf(line.c_str(), "[L:%lu:%n", &id, &off) != 1) {
+		cerr << "Can't parse lifetime: " << line << endl;
+		return;
 	}
 
-	if (event->type == EVENT_MALLOC ||
-		event->type == EVENT_REALLOC ||
-		event->type == EVENT_MMAP ||
-		event->type == EVENT_MMAP2 ||
-		event->type == EVENT_CALLOC ||
-		event->type == EVENT_MEMALIGN ||
-		event->type == EVENT_POSIX_MEMALIGN ||
-		event->type == EVENT_ALIGNED_ALLOC ||
-		event->type == EVENT_VALLOC ||
-		event->type == EVENT_PVALLOC ||
-		event->type == EVENT_MEMSET) {
+	stack = &profile_stacks[id];
+	stack->id = id;
 
-		size = event->size;
-		addr = event->addr;
+	const char *p = line.c_str() + off;
+	while (sscanf(p, "%d=%lu", &bucket, &count) == 2) {
+		stack->lifetime[bucket] += count;
+
+		p = strchr(p, ',');
+		if (!p)
+			break;
+		p++;
 	}
+}
 
-	if (event->type == EVENT_CALLOC)
-		size *= event->flags;
+static void heap_snapshot(string &line)
+{
+	char reason[64];
 
-	if (event->type == EVENT_MEMALIGN ||
-			event->type == EVENT_POSIX_MEMALIGN ||
-			event->type == EVENT_ALIGNED_ALLOC)
-		size = ALIGN(size, event->align);
+	// [h:1:1500000000.123456:exit]
+	if (sscanf(line.c_str(), "[h:%lu:%*[0-9.]:%63[^]]]",
+			&heap_seq, reason) != 2) {
+		cerr << "Can't parse heap snapshot: " << line << endl;
+		return;
+	}
 
-	if (!addr && !size)
+	heap_reason = reason;
+	heap_groups.clear();
+}
+
+static void heap_row(string &line)
+{
+	struct heap_group group;
+	char oldest[32];
+
+	// [H:42:10:640:1500000000.123:1234]
+	if (sscanf(line.c_str(), "[H:%lu:%lu:%lu:%31[0-9.]:%d]",
+			&group.id, &group.count, &group.bytes,
+			oldest, &group.oldest_tid) != 5) {
+		cerr << "Can't parse heap snapshot: " << line << endl;
 		return;
+	}
 
-	if (mem_area.find(addr) != mem_area.end()) {
+	group.oldest = oldest;
+	heap_groups.push_back(group);
+}
+
+static void counters_header(string &line)
+{
+	unsigned long elapsed;
+
+	// [c:3:1500000000.123456:1000]
+	if (sscanf(line.c_str(), "[c:%lu:%*[0-9.]:%lu]",
+			&counters_seq, &elapsed) != 2) {
+		cerr << "Can't parse counters: " << line << endl;
 		return;
+	}
 
-		if (mem_area[addr]->event->trace.size() != 0)
-			return;
-		if (event->trace.size() == 0)
-			return;
-		delete mem_area[addr];
+	counters_elapsed_ms += elapsed;
+}
+
+static void counters_row(string &line)
+{
+	unsigned long calls, bytes;
+	char name[64];
+	int tid;
+
+	// [C:1234:malloc:1000:64000]
+	if (sscanf(line.c_str(), "[C:%d:%63[^:]:%lu:%lu]",
+			&tid, name, &calls, &bytes) != 4) {
+		cerr << "Can't parse counters: " << line << endl;
+		return;
 	}
 
-	struct mem_area *mem = new struct mem_area;
-	mem->size = size;
-	mem->event = event;
+	counters_total[name].first += calls;
+	counters_total[name].second += bytes;
+	counters_tid[tid][name].first += calls;
+	counters_tid[tid][name].second += bytes;
+}
 
-	mem_area[addr] = mem;
+static void size_hist_header(string &line)
+{
+	// [z:1:1500000000.123456]
+	if (sscanf(line.c_str(), "[z:%lu:", &size_hist_seq) != 1) {
+		cerr << "Can't parse size histogram: " << line << endl;
+		return;
+	}
+
+	// histograms are cumulative, only the last one is reported
+	size_hist_log2.clear();
+	size_hist_fine.clear();
 }
 
-static void remove_mem_area(struct mm_event *event)
+static void size_hist_row(string &line)
 {
-	if (!(event->type == EVENT_FREE ||
-		event->type == EVENT_CFREE ||
-		event->type == EVENT_MUNMAP))
-			return;
+	map<int, unsigned long> *hist;
+	char name[32], kind[8];
+	unsigned long count;
+	int idx, off;
+
+	// [Z:malloc:log2:5=10,7=3]
+	if (sscanf(line.c_str(), "[Z:%31[^:]:%7[^:]:%n",
+			name, kind, &off) != 2) {
+		cerr << "Can't parse size histogram: " << line << endl;
+		return;
+	}
 
-	if (mem_area.find(event->addr) != mem_area.end()) {
-		delete mem_area[event->addr];
-		mem_area.erase(event->addr);
+	if (!strcmp(kind, "log2"))
+		hist = &size_hist_log2[name];
+	else
+		hist = &size_hist_fine[name];
+
+	const char *p = line.c_str() + off;
+	while (sscanf(p, "%d=%lu", &idx, &count) == 2) {
+		(*hist)[idx] += count;
+
+		p = strchr(p, ',');
+		if (!p)
+			break;
+		p++;
 	}
 }
 
-static int parse_file(struct options *opts)
+static void latency_header(string &line)
 {
-	struct mm_event *event = NULL;
-	int ret = 0;
+	// [g:1:1500000000.123456:10000]
+	if (sscanf(line.c_str(), "[g:%lu:%*[0-9.]:%lu]",
+			&latency_seq, &latency_threshold_ns) != 2) {
+		cerr << "Can't parse latency: " << line << endl;
+		return;
+	}
 
-	ifstream log_file;
-	string line;
+	// histograms are cumulative, only the last one is reported
+	latency_hist.clear();
+}
 
-	log_file.open(opts->file.c_str());
-	if (!log_file.is_open())
-		return -EINVAL;
+static void latency_row(string &line)
+{
+	map<unsigned long, unsigned long> *hist;
+	unsigned long ns, count;
+	char name[64];
+	int off;
+
+	// [G:malloc:20=1354,24=1411]
+	if (sscanf(line.c_str(), "[G:%63[^:]:%n", name, &off) != 1) {
+		cerr << "Can't parse latency: " << line << endl;
+		return;
+	}
 
-	while (getline(log_file, line)) {
-		string_chomp(line);
+	hist = &latency_hist[name];
 
-		if (line.find("[t:") != std::string::npos) {
-			// commit already existing event
-			if (event) {
-				add_tid_event(event);
-				add_mem_area(event);
-				remove_mem_area(event);
-			}
+	const char *p = line.c_str() + off;
+	while (sscanf(p, "%lu=%lu", &ns, &count) == 2) {
+		(*hist)[ns] += count;
 
-			event = new_mm_event(line);
-			if (!event) {
+		p = strchr(p, ',');
+		if (!p)
+			break;
+		p++;
+	}
+}
+
+static void heap_stat_row(string &line)
+{
+	struct heap_stat st;
+
+	// [a:1:1500000000.123456:RSS:ARENA:HBLKHD:UORDBLKS:FORDBLKS:KEEPCOST]
+	if (sscanf(line.c_str(), "[a:%*u:%lf:%lu:%lu:%lu:%lu:%lu:%lu]",
+			&st.ts, &st.rss, &st.arena, &st.hblkhd,
+			&st.uordblks, &st.fordblks, &st.keepcost) != 7) {
+		cerr << "Can't parse mallinfo: " << line << endl;
+		return;
+	}
+
+	heap_stats.push_back(st);
+}
+
+// [proc:PID:PPID:HOW:SEC.USEC:NAME]
+static int parse_proc(const string &line, struct proc_info *pi)
+{
+	char how[16];
+	int off = 0;
+
+	if (sscanf(line.c_str(), "[proc:%d:%d:%15[^:]:%lf:%n",
+			&pi->pid, &pi->ppid, how, &pi->ts, &off) != 4 || !off)
+		return -EINVAL;
+
+	pi->how = how;
+	pi->name = line.substr(off, line.size() - off - 1);
+	return 0;
+}
+
+static void meta_stat_row(string &line)
+{
+	// [o:MAPPED:USED:PEAK:FAILED]
+	if (sscanf(line.c_str(), "[o:%lu:%lu:%lu:%lu]",
+			&meta_mapped, &meta_used, &meta_peak,
+			&meta_failed) != 4) {
+		cerr << "Can't parse tracer memory: " << line << endl;
+		return;
+	}
+
+	meta_seen = true;
+}
+
+static void malloc_info_header(string &line)
+{
+	// [x:1:1500000000.123456]
+	if (sscanf(line.c_str(), "[x:%lu:", &malloc_info_seq) != 1) {
+		cerr << "Can't parse malloc_info: " << line << endl;
+		return;
+	}
+
+	// only the last snapshot is reported
+	arenas.clear();
+	malloc_info_heap = -1;
+}
+
+/*
+ * [X:1] <heap nr="0">
+ * [X:1] <total type="fast" count="0" size="0"/>
+ * [X:1] <system type="current" size="135168"/>
+ * [X:1] </heap>
+ */
+static void malloc_info_row(string &line)
+{
+	struct arena_info *arena;
+	unsigned long count, size;
+	char type[16];
+	int nr;
+
+	if (sscanf(line.c_str(), "[X:%*u] <heap nr=\"%d\"", &nr) == 1) {
+		malloc_info_heap = nr;
+		arenas[nr] = arena_info();
+		return;
+	}
+
+	if (line.find("</heap>") != string::npos) {
+		malloc_info_heap = -1;
+		return;
+	}
+
+	// totals of all arenas follow the last heap
+	if (malloc_info_heap < 0)
+		return;
+
+	arena = &arenas[malloc_info_heap];
+	if (sscanf(line.c_str(),
+			"[X:%*u] <total type=\"%15[^\"]\" count=\"%lu\" size=\"%lu\"",
+			type, &count, &size) == 3) {
+		if (!strcmp(type, "fast")) {
+			arena->fast_count = count;
+			arena->fast_size = size;
+		} else if (!strcmp(type, "rest")) {
+			arena->rest_count = count;
+			arena->rest_size = size;
+		}
+		return;
+	}
+
+	if (sscanf(line.c_str(),
+			"[X:%*u] <system type=\"%15[^\"]\" size=\"%lu\"",
+			type, &size) == 2) {
+		if (!strcmp(type, "current"))
+			arena->system = size;
+		else if (!strcmp(type, "max"))
+			arena->system_max = size;
+	}
+}
+
+static void cold_header(string &line)
+{
+	// [k:3:1500000000.123456]
+	if (sscanf(line.c_str(), "[k:%lu:", &cold_seq) != 1) {
+		cerr << "Can't parse cold memory: " << line << endl;
+		return;
+	}
+
+	// only the last sample is reported
+	cold_groups.clear();
+}
+
+static void cold_row(string &line)
+{
+	struct cold_group group;
+
+	// [K:42:2:100663296:8392704:1048576]
+	if (sscanf(line.c_str(), "[K:%lu:%lu:%lu:%lu:%lu]",
+			&group.id, &group.blocks, &group.bytes,
+			&group.resident, &group.dirty) != 5) {
+		cerr << "Can't parse cold memory: " << line << endl;
+		return;
+	}
+
+	cold_groups.push_back(group);
+}
+
+static void numa_header(string &line)
+{
+	// [n:3:1500000000.123456:2]
+	if (sscanf(line.c_str(), "[n:%lu:%*[0-9.]:%d]",
+			&numa_seq, &numa_nodes) != 2) {
+		cerr << "Can't parse NUMA sample: " << line << endl;
+		return;
+	}
+
+	// only the last sample is reported
+	numa_groups.clear();
+}
+
+static void numa_row(string &line)
+{
+	unsigned long id, bytes, local, remote;
+	struct numa_group *group;
+	int tid, cpu, node;
+
+	// [N:42:1234:3:0:67108864:6:2]
+	if (sscanf(line.c_str(), "[N:%lu:%d:%d:%d:%lu:%lu:%lu]",
+			&id, &tid, &cpu, &node, &bytes,
+			&local, &remote) != 7) {
+		cerr << "Can't parse NUMA sample: " << line << endl;
+		return;
+	}
+
+	group = &numa_groups[id];
+	group->blocks++;
+	group->bytes += bytes;
+	group->local_pages += local;
+	group->remote_pages += remote;
+	// sampled pages stand for the whole block
+	if (local + remote)
+		group->remote_bytes += bytes * remote / (local + remote);
+}
+
+static struct proc_tid *get_proc_tid(int tid)
+{
+	struct proc_tid *proc;
+	
+	if (proc_map.find(tid) == proc_map.end()) {
+		proc = new proc_tid;
+
+		proc->tid = tid;
+		memset(proc->stats, 0x00, sizeof(proc->stats));
+		proc_map[tid] = proc;
+	} else {
+		proc = proc_map[tid];
+	}
+
+	return proc;
+}
+
+static void __print_event(struct mm_event *event);
+
+static void add_tid_event(struct mm_event *event)
+{
+	struct proc_tid *proc = get_proc_tid(event->tid);
+
+	if (event->trace.size() != 0) {
+		size_t _hash = 0;
+
+		for (auto &p : event->trace) {
+			size_t fh = std::hash<size_t>{}(p.addr);
+			_hash ^= (fh << 1);
+			_hash = std::hash<size_t>{}(_hash);
+		}
+
+		if (_hash != 0) {
+			if (callpath_freq.find(_hash) != callpath_freq.end())
+				callpath_freq[_hash] += 1 + event->suppressed;
+			else
+				callpath_freq[_hash] = 1 + event->suppressed;
+			callsite_hash[event->trace[0].addr] = _hash;
+		}
+		event->trace_hash = _hash;
+	}
+
+	proc->events.push_back(event);
+	proc->stats[event->type]++;
+}
+
+static void add_mem_area(struct mm_event *event)
+{
+	unsigned long size = 0;
+	unsigned long addr = 0;
+
+	/* MEMSET can be called on a sub-range of allocated object.
+	 * e.g. allocate structure, memset() a small buffer in
+	 * that structure. It will require a whole linear scan of
+	 * the tree to find the proper sub-object.
+	 *
+	 * so skip MEMSET events for now.
+	 */
+	if (event->type == EVENT_MEMSET)
+		return;
+
+	/* a failed mremap() or reallocarray() left the old area in place */
+	if (event->type == EVENT_MREMAP &&
+			event->addr == (unsigned long)MAP_FAILED)
+		return;
+	if (event->type == EVENT_REALLOCARRAY && !event->addr &&
+			event->size && event->flags)
+		return;
+
+	if (event->type == EVENT_REALLOC ||
+			event->type == EVENT_REALLOCARRAY ||
+			event->type == EVENT_MREMAP) {
+		if (mem_area.find(event->prev_addr) != mem_area.end()) {
+			delete mem_area[event->prev_addr];
+			mem_area.erase(event->prev_addr);
+		}
+	}
+
+	if (event->type == EVENT_MALLOC ||
+		event->type == EVENT_REALLOC ||
+		event->type == EVENT_MMAP ||
+		event->type == EVENT_MMAP2 ||
+		event->type == EVENT_CALLOC ||
+		event->type == EVENT_MEMALIGN ||
+		event->type == EVENT_POSIX_MEMALIGN ||
+		event->type == EVENT_ALIGNED_ALLOC ||
+		event->type == EVENT_VALLOC ||
+		event->type == EVENT_PVALLOC ||
+		event->type == EVENT_NEW ||
+		event->type == EVENT_NEW_ARRAY ||
+		event->type == EVENT_REALLOCARRAY ||
+		event->type == EVENT_MREMAP ||
+		event->type == EVENT_MEMSET) {
+
+		size = event->size;
+		addr = event->addr;
+	}
+
+	if (event->type == EVENT_CALLOC ||
+			event->type == EVENT_REALLOCARRAY)
+		size *= event->flags;
+
+	if (event->type == EVENT_MEMALIGN ||
+			event->type == EVENT_POSIX_MEMALIGN ||
+			event->type == EVENT_ALIGNED_ALLOC)
+		size = ALIGN(size, event->align);
+
+	if (!addr && !size)
+		return;
+
+	if (mem_area.find(addr) != mem_area.end()) {
+		return;
+
+		if (mem_area[addr]->event->trace.size() != 0)
+			return;
+		if (event->trace.size() == 0)
+			return;
+		delete mem_area[addr];
+	}
+
+	struct mem_area *mem = new struct mem_area;
+	mem->size = size;
+	mem->released = 0;
+	mem->event = event;
+
+	mem_area[addr] = mem;
+}
+
+static void remove_mem_area(struct mm_event *event)
+{
+	if (!(event->type == EVENT_FREE ||
+		event->type == EVENT_CFREE ||
+		event->type == EVENT_FREE_SIZED ||
+		event->type == EVENT_FREE_ALIGNED_SIZED ||
+		event->type == EVENT_DELETE ||
+		event->type == EVENT_DELETE_ARRAY ||
+		event->type == EVENT_MUNMAP))
+			return;
+
+	if (mem_area.find(event->addr) != mem_area.end()) {
+		delete mem_area[event->addr];
+		mem_area.erase(event->addr);
+	}
+}
+
+static void tag_name(string &line)
+{
+	size_t pos = line.find(':', 5);
+	int id;
+
+	// [tag:3:request/GET]
+	if (sscanf(line.c_str(), "[tag:%d:", &id) != 1 ||
+			pos == string::npos) {
+		cerr << "Can't parse tag: " << line << endl;
+		return;
+	}
+
+	// the name may have any characters, the record ends with ']'
+	tag_stats[id].name = line.substr(pos + 1,
+			line.find_last_of(']') - pos - 1);
+}
+
+static void tag_mark(string &line)
+{
+	char ts[32];
+	int id;
+
+	// [mark:4:1500000000.123456]
+	if (sscanf(line.c_str(), "[mark:%d:%31[0-9.]]", &id, ts) != 2) {
+		cerr << "Can't parse mark: " << line << endl;
+		return;
+	}
+
+	tag_marks.push_back(make_pair(id, string(ts)));
+}
+
+static unsigned long event_alloc_size(struct mm_event *event)
+{
+	switch (event->type) {
+	case EVENT_MALLOC:
+	case EVENT_REALLOC:
+	case EVENT_MMAP:
+	case EVENT_MMAP2:
+	case EVENT_VALLOC:
+	case EVENT_PVALLOC:
+	case EVENT_NEW:
+	case EVENT_NEW_ARRAY:
+		return event->size;
+	case EVENT_CALLOC:
+	case EVENT_REALLOCARRAY:
+		return event->size * event->flags;
+	case EVENT_MREMAP:
+		if (event->addr == (unsigned long)MAP_FAILED)
+			return 0;
+		return event->size;
+	case EVENT_MEMALIGN:
+	case EVENT_POSIX_MEMALIGN:
+	case EVENT_ALIGNED_ALLOC:
+		return ALIGN(event->size, event->align);
+	default:
+		return 0;
+	}
+}
+
+static void tag_free(unsigned long addr)
+{
+	auto block = tag_blocks.find(addr);
+	struct tag_stat *stat;
+
+	if (block == tag_blocks.end())
+		return;
+
+	/* frees are accounted to the tag of the allocation */
+	stat = &tag_stats[block->second.second];
+	stat->frees++;
+	stat->free_bytes += block->second.first;
+	stat->live -= block->second.first;
+	tag_blocks.erase(block);
+}
+
+static void add_tag_event(struct mm_event *event)
+{
+	unsigned long size = event_alloc_size(event);
+	struct tag_stat *stat;
+
+	if (event->type == EVENT_FREE ||
+			event->type == EVENT_CFREE ||
+			event->type == EVENT_FREE_SIZED ||
+			event->type == EVENT_FREE_ALIGNED_SIZED ||
+			event->type == EVENT_DELETE ||
+			event->type == EVENT_DELETE_ARRAY ||
+			event->type == EVENT_MUNMAP) {
+		tag_free(event->addr);
+		return;
+	}
+
+	if (event->type == EVENT_REALLOC ||
+			event->type == EVENT_REALLOCARRAY ||
+			(event->type == EVENT_MREMAP &&
+			 event->addr != (unsigned long)MAP_FAILED))
+		tag_free(event->prev_addr);
+
+	if (!size || !event->addr)
+		return;
+
+	stat = &tag_stats[event->tag];
+	stat->allocs++;
+	stat->alloc_bytes += size;
+	stat->live += size;
+	stat->peak = max(stat->peak, stat->live);
+	tag_blocks[event->addr] = make_pair(size, event->tag);
+}
+
+/*
+ * Pages given back with madvise() are still mapped, but no longer
+ * resident: account them to every area the range covers.
+ */
+static void release_mem_area(struct mm_event *event)
+{
+	unsigned long start = event->addr;
+	unsigned long end = event->addr + event->size;
+	auto p = mem_area.upper_bound(start);
+
+	if (event->type != EVENT_MADVISE || event->ret != 0)
+		return;
+
+	if (event->mask != MADV_DONTNEED &&
+#ifdef MADV_FREE
+			event->mask != MADV_FREE &&
+#endif
+			event->mask != MADV_REMOVE)
+		return;
+
+	if (p != mem_area.begin())
+		p--;
+
+	for (; p != mem_area.end() && p->first < end; p++) {
+		unsigned long lo = max(start, p->first);
+		unsigned long hi = min(end, p->first + p->second->size);
+
+		if (lo >= hi)
+			continue;
+
+		p->second->released = min(p->second->size,
+				p->second->released + hi - lo);
+	}
+}
+
+static int parse_file(struct options *opts)
+{
+	struct mm_event *event = NULL;
+	struct profile_stack *stack = NULL;
+	int ret = 0;
+
+	ifstream log_file;
+	string line;
+
+	log_file.open(opts->file.c_str());
+	if (!log_file.is_open())
+		return -EINVAL;
+
+	while (getline(log_file, line)) {
+		string_chomp(line);
+
+		/* names are arbitrary strings, match these first */
+		if (!line.compare(0, 5, "[tag:")) {
+			tag_name(line);
+			continue;
+		}
+
+		if (!line.compare(0, 6, "[mark:")) {
+			tag_mark(line);
+			continue;
+		}
+
+		if (!line.compare(0, 6, "[proc:")) {
+			if (parse_proc(line, &proc_self))
+				cerr << "Can't parse process: " << line << endl;
+			else
+				proc_seen = true;
+			continue;
+		}
+
+		if (line.find("[t:") != std::string::npos) {
+			stack = NULL;
+
+			// commit already existing event
+			if (event) {
+				add_tid_event(event);
+				add_tag_event(event);
+				add_mem_area(event);
+				remove_mem_area(event);
+				release_mem_area(event);
+			}
+
+			event = new_mm_event(line);
+			if (!event) {
 				cerr << "Can't parse event header: " <<
 					line << endl;
 				return -1;
@@ -591,410 +1405,1237 @@ static int parse_file(struct options *opts)
 			continue;
 		}
 
-		if (line.find("[f:") != string::npos) {
-			append_symbol(line);
-			continue;
-		}
+		if (line.find("[f:") != string::npos) {
+			append_symbol(line);
+			continue;
+		}
+
+		if (line.find("[r:") != string::npos) {
+			// [r:1023]
+			if (!event || sscanf(line.c_str(), "[r:%lu]",
+						&event->suppressed) != 1) {
+				cerr << "Can't parse ratelimit: " << line << endl;
+			}
+			continue;
+		}
+
+		if (line.find("[R:") != string::npos) {
+			unsigned long addr, num;
+
+			// [R:7f0da4e3473f:1023]
+			if (sscanf(line.c_str(), "[R:%lx:%lu]",
+						&addr, &num) != 2) {
+				cerr << "Can't parse ratelimit: " << line << endl;
+				continue;
+			}
+			suppressed_callsites.push_back(make_pair(addr, num));
+			continue;
+		}
+
+		if (line.find("[l:") != string::npos) {
+			// [l:35159]
+			if (!event || sscanf(line.c_str(), "[l:%lu]",
+						&event->latency_ns) != 1) {
+				cerr << "Can't parse latency: " << line << endl;
+			}
+			continue;
+		}
+
+		if (line.find("[T:") != string::npos) {
+			// [T:3]
+			if (!event || sscanf(line.c_str(), "[T:%d]",
+						&event->tag) != 1) {
+				cerr << "Can't parse tag: " << line << endl;
+			}
+			continue;
+		}
+
+		if (line.find("[g:") != string::npos) {
+			latency_header(line);
+			continue;
+		}
+
+		if (line.find("[G:") != string::npos) {
+			latency_row(line);
+			continue;
+		}
+
+		if (line.find("[a:") != string::npos) {
+			heap_stat_row(line);
+			continue;
+		}
+
+		if (line.find("[x:") != string::npos) {
+			malloc_info_header(line);
+			continue;
+		}
+
+		if (line.find("[X:") != string::npos) {
+			malloc_info_row(line);
+			continue;
+		}
+
+		if (line.find("[o:") != string::npos) {
+			meta_stat_row(line);
+			continue;
+		}
+
+		if (line.find("[m:") != string::npos) {
+			// [m:86274048-86278144]
+			if (sscanf(line.c_str(), "[m:%ld-%ld]",
+						&event->mem_from,
+						&event->mem_to) != 2) {
+				cerr << "Can't parse mm: " << line << endl;
+			}
+			continue;
+		}
+
+		if (line.find("[s:") != string::npos) {
+			stack = new_profile_stack(line);
+			continue;
+		}
+
+		if (line.find("[p:") != string::npos) {
+			stack = NULL;
+			profile_snapshot(line);
+			continue;
+		}
+
+		if (line.find("[P:") != string::npos) {
+			profile_row(line);
+			continue;
+		}
+
+		if (line.find("[L:") != string::npos) {
+			profile_lifetime(line);
+			continue;
+		}
+
+		if (line.find("[k:") != string::npos) {
+			stack = NULL;
+			cold_header(line);
+			continue;
+		}
+
+		if (line.find("[K:") != string::npos) {
+			cold_row(line);
+			continue;
+		}
+
+		if (line.find("[n:") != string::npos) {
+			stack = NULL;
+			numa_header(line);
+			continue;
+		}
+
+		if (line.find("[N:") != string::npos) {
+			numa_row(line);
+			continue;
+		}
+
+		if (line.find("[h:") != string::npos) {
+			stack = NULL;
+			heap_snapshot(line);
+			continue;
+		}
+
+		if (line.find("[H:") != string::npos) {
+			heap_row(line);
+			continue;
+		}
+
+		if (line.find("[c:") != string::npos) {
+			counters_header(line);
+			continue;
+		}
+
+		if (line.find("[C:") != string::npos) {
+			counters_row(line);
+			continue;
+		}
+
+		if (line.find("[z:") != string::npos) {
+			size_hist_header(line);
+			continue;
+		}
+
+		if (line.find("[Z:") != string::npos) {
+			size_hist_row(line);
+			continue;
+		}
+
+		if (line[0] == '#') {
+			if (stack)
+				parse_stack_frame(stack, line);
+			else
+				parse_event_backtrace(event, line);
+			continue;
+		}
+
+		if (line[0] == '-') {
+			cerr << "Error: " << line << endl;
+			continue;
+		}
+	}
+
+	for (auto &p : suppressed_callsites) {
+		auto cs = callsite_hash.find(p.first);
+
+		if (cs != callsite_hash.end())
+			callpath_freq[cs->second] += p.second;
+	}
+
+	if (opts->debug)
+		cout << "File parsed" << endl;
+
+out:
+	log_file.close();
+	return ret;
+}
+
+static void decode_mmap_prot(int prot)
+{
+	if (prot & PROT_EXEC && prot & PROT_WRITE)
+		security_report = 1;
+
+	printf("%d /* <b>", prot);
+
+	if (prot & PROT_EXEC)
+		printf("PROT_EXEC ");
+	if (prot & PROT_READ)
+		printf("PROT_READ ");
+	if (prot & PROT_WRITE)
+		printf("PROT_WRITE ");
+	if (prot & PROT_NONE)
+		printf("PROT_NONE ");
+
+	printf("</b>*/, ");
+}
+
+static void decode_mmap_flags(int flags)
+{
+	printf("%d /* <b>", flags);
+
+	if (flags & MAP_SHARED)
+		printf("MAP_SHARED ");
+	if (flags & MAP_PRIVATE)
+		printf("MAP_PRIVATE ");
+	if (flags & MAP_32BIT)
+		printf("MAP_32BIT ");
+	if (flags & MAP_ANON)
+		printf("MAP_ANON ");
+	if (flags & MAP_ANONYMOUS)
+		printf("MAP_ANONYMOUS ");
+	if (flags & MAP_DENYWRITE)
+		printf("MAP_DENYWRITE ");
+	if (flags & MAP_EXECUTABLE)
+		printf("MAP_EXECUTABLE ");
+	if (flags & MAP_FILE)
+		printf("MAP_FILE ");
+	if (flags & MAP_FIXED)
+		printf("MAP_FIXED ");
+	if (flags & MAP_GROWSDOWN)
+		printf("MAP_GROWSDOWN ");
+	if (flags & MAP_HUGETLB)
+		printf("MAP_HUGETLB ");
+	if (flags & MAP_LOCKED)
+		printf("MAP_LOCKED ");
+	if (flags & MAP_NONBLOCK)
+		printf("MAP_NONBLOCK ");
+	if (flags & MAP_NORESERVE)
+		printf("MAP_NORESERVE ");
+	if (flags & MAP_POPULATE)
+		printf("MAP_POPULATE ");
+	if (flags & MAP_STACK)
+		printf("MAP_STACK ");
+
+	printf("</b>*/, ");
+}
+
+static void print_event_header(struct mm_event *event)
+{
+	if (!event)
+		return;
+
+	printf("[%lu.%06d] Thread %d \n <br><br>",
+			event->timestamp.tv_sec,
+			event->timestamp.tv_usec,
+			event->tid);
+
+	printf("Issued <b>%s</b>(", event_names[event->type]);
+
+	if (event->type == EVENT_MALLOC ||
+			event->type == EVENT_VALLOC ||
+			event->type == EVENT_PVALLOC) {
+		printf("%ld) = 0x%x",
+				event->size,
+				event->addr);
+	}
+
+	if (event->type == EVENT_MEMALIGN ||
+			event->type == EVENT_POSIX_MEMALIGN ||
+			event->type == EVENT_ALIGNED_ALLOC) {
+		printf("%ld, %ld) = 0x%x",
+				event->size,
+				event->align,
+				event->addr);
+	}
+
+	if (event->type == EVENT_CALLOC) {
+		printf("%ld, %ld) = 0x%x",
+				event->size,
+				event->flags,
+				event->addr);
+	}
+
+	if (event->type == EVENT_FREE || event->type == EVENT_CFREE) {
+		printf("0x%x)\n<br>", event->addr);
+	}
+
+	if (event->type == EVENT_NEW || event->type == EVENT_NEW_ARRAY) {
+		printf("%ld, %ld) = 0x%x",
+				event->size,
+				event->align,
+				event->addr);
+	}
+
+	if (event->type == EVENT_DELETE ||
+			event->type == EVENT_DELETE_ARRAY ||
+			event->type == EVENT_FREE_SIZED) {
+		printf("0x%x, %ld)\n<br>", event->addr, event->size);
+	}
+
+	if (event->type == EVENT_FREE_ALIGNED_SIZED) {
+		printf("0x%x, %ld, %ld)\n<br>",
+				event->addr,
+				event->align,
+				event->size);
+	}
+
+	if (event->type == EVENT_REALLOCARRAY) {
+		printf("0x%x, %ld, %ld) = 0x%x",
+				event->prev_addr,
+				event->size,
+				event->flags,
+				event->addr);
+	}
+
+	if (event->type == EVENT_MALLOC_USABLE_SIZE) {
+		printf("0x%x) = %ld", event->addr, event->size);
+	}
+
+	if (event->type == EVENT_MREMAP) {
+		printf("0x%x, %ld, %ld, %ld) = 0x%x",
+				event->prev_addr,
+				event->prev_size,
+				event->size,
+				event->flags,
+				event->addr);
+	}
+
+	if (event->type == EVENT_MADVISE) {
+		printf("0x%x, %ld, %ld) = %d",
+				event->addr,
+				event->size,
+				event->mask,
+				event->ret);
+	}
+
+	if (event->type == EVENT_BRK) {
+		printf("0x%x) = %d, break moved by %ld",
+				event->addr,
+				event->ret,
+				event->incr);
+	}
+
+	if (event->type == EVENT_SBRK) {
+		printf("%ld) = 0x%x", event->incr, event->addr);
+	}
+
+	if (event->type == EVENT_REALLOC) {
+		printf("0x%x, %ld) = 0x%x",
+				event->prev_addr,
+				event->size,
+				event->addr);
+	}
+
+	if (event->type == EVENT_MMAP || event->type == EVENT_MMAP2) {
+		printf("0x%x, %ld, ", event->prev_addr, event->size);
+		decode_mmap_prot(event->prot);
+		decode_mmap_flags(event->flags);
+		printf("%d, %ld) = 0x%x",
+				event->fd,
+				event->offt,
+				event->addr);
+	}
+
+	if (event->type == EVENT_MUNMAP) {
+		printf("0x%x, %lx) = %d",
+				event->addr,
+				event->size,
+				event->ret);
+	}
+
+	if (event->type == EVENT_MEMSET) {
+		printf("0x%x, ", event->addr);
+
+		if (event->mask == 0x00)
+			printf("'0'");
+		else
+			printf("'%c'", event->mask);
+
+		printf(", %ld) = 0x%x",
+				event->size,
+				event->prev_addr);
+	}
+
+	if (event->type == EVENT_MEMMOVE) {
+		printf("0x%x, 0x%x, %ld) = 0x%x",
+				event->addr,
+				event->prev_addr,
+				event->size,
+				event->addr);
+	}
+
+	if (event->type == EVENT_MLOCK || event->type == EVENT_MUNLOCK) {
+		printf("0x%x, %ld) = %ld",
+				event->addr,
+				event->size,
+				event->ret);
+	}
+
+	if (event->type == EVENT_MLOCKALL) {
+		printf("%ld) = %ld",
+				event->flags,
+				event->ret);
+	}
+
+	if (event->type == EVENT_MUNLOCKALL) {
+		printf(") = %ld",
+				event->ret);
+	}
+
+	printf("\n<br><br>");
+}
+
+static void print_mem_growth(struct mm_event *event)
+{
+	if (!event)
+		return;
+
+	if (event->mem_from != event->mem_to) {
+		printf("Detected /proc/self/statm <b>RSS</b> change from %lu to %lu bytes\n<br>",
+				event->mem_from,
+				event->mem_to);
+
+		printf("/* Diff: %ld\n */\n<br><br>",
+				event->mem_to - event->mem_from);
+	}
+}
+
+static void print_latency(struct mm_event *event)
+{
+	if (!event || !event->latency_ns)
+		return;
+
+	printf("Slow call: <b>%lu</b> ns in glibc\n<br><br>",
+			event->latency_ns);
+}
+
+static long num_cells = 0;
+static int cells = 0;
+
+static void __print_event(struct mm_event *event)
+{
+	print_event_header(event);
+	print_mem_growth(event);
+	print_latency(event);
+
+	if (!event) {
+		printf("&nbsp; <br>\n");
+		return;
+	}
+
+	if (event->trace.size() != 0) {
+		auto tr = event->trace.begin();
+
+		printf(" Backtrace: \n <br> ");
+
+		while (tr != event->trace.end()) {
+			printf("&nbsp; [<0x%08lx>] %s+0x%lx &nbsp; \n <br>",
+					tr->addr,
+					symbols[tr->num].name.c_str(),
+					tr->offt);
+			tr++;
+		}
+	} else {
+		printf(" No backtrace available \n <br> ");
+	}
+}
+
+static int ignore_event_type(int eid)
+{
+	if (eid == EVENT_FREE ||
+		eid == EVENT_CFREE ||
+		eid == EVENT_FREE_SIZED ||
+		eid == EVENT_FREE_ALIGNED_SIZED ||
+		eid == EVENT_MALLOC_USABLE_SIZE ||
+		eid == EVENT_MADVISE ||
+		eid == EVENT_BRK ||
+		eid == EVENT_SBRK ||
+		eid == EVENT_DELETE ||
+		eid == EVENT_DELETE_ARRAY ||
+		eid == EVENT_MEMMOVE ||
+		eid == EVENT_MUNMAP ||
+		eid == EVENT_MEMSET ||
+		eid == EVENT_MLOCK ||
+		eid == EVENT_MLOCKALL ||
+		eid == EVENT_MUNLOCK ||
+		eid == EVENT_MUNLOCKALL)
+		return 1;
+
+	return 0;
+}
+
+static void add_event_to_top_list(struct mm_event *event)
+{
+	if (!event)
+		return;
+
+	if (ignore_event_type(event->type))
+		return;
+
+	mm_event_top.push_back(event);
+}
+
+static void add_cell(const char *bgcolor, struct mm_event *event)
+{
+	const char *border_color = CELL_BORDER_COLOR_NO_BACKTRACE;
+
+	if (event && event->trace.size() != 0)
+		border_color = CELL_BORDER_COLOR_BACKTRACE;
+
+	if (event && (event->type == EVENT_MLOCK ||
+				event->type == EVENT_MLOCKALL))
+		border_color = CELL_BORDER_COLOR_MLOCKED;
+
+	printf("<td width=7 height=7 bgcolor=\"%s\" id=\"%s\" "
+		"onclick='show_backtrace(\"backtrace%ld\");'>\n",
+		bgcolor,
+		border_color,
+		num_cells);
+
+	add_event_to_top_list(event);
+
+	printf("<div id=\"backtrace%ld\" style=\"display: none\">", num_cells);
+
+	__print_event(event);
+
+	printf("</div>\n");
+	printf("</td>\n");
+
+	num_cells++;
+	cells++;
+	if (cells >= MAX_MEM_CELLS_IN_A_ROW) {
+		printf("</tr>\n");
+		printf("<tr>\n");
+		cells = 0;
+	}
+}
+
+static void do_security_report(void)
+{
+	auto p = mem_area.begin();
+
+	printf("<table width=50%>\n");
+	printf("<tr width=50%><td>\n");
+	printf("<tr><td bgcolor=\"%s\">\n",
+		CELL_COLOR_WARNING);
+	printf("<a name=\"security_report\"></a>Go to list "
+		"<a style=\"text-decoration: none; color: #7191bc;\" href=\"#list_top\"><b>top</b></a>\n<br>\n");
+	printf("<br><b>Security report</b><br>");
+	printf("</td></tr>\n");
+
+	while (p != mem_area.end()) {
+		if (p->second->event->type != EVENT_MMAP &&
+				p->second->event->type != EVENT_MMAP2)
+			goto skip;
+
+		if ((p->second->event->prot & PROT_EXEC) &&
+				(p->second->event->prot & PROT_WRITE)) {
+			printf("<tr><td>\n");
+			__print_event(p->second->event);
+			printf("</td></tr>\n");
+
+			printf("<tr><td bgcolor=\"%s\">\n",
+					CELL_COLOR_UNUSED);
+			printf("<br></td></tr>\n");
+		}
+skip:
+		p++;
+	}
+
+	printf("</table>\n");
+}
+
+static void do_event_top_report(void)
+{
+	printf("<a name=\"list_top\"></a>\n");
+
+	printf("<table width=50%>\n");
+	printf("<tr width=50%><td>\n");
+	printf("Per-event type top list sorted by size in reverse order. (Up to %ld events of each type)\n<br>\n",
+			MAX_EVENTS_IN_TOP_LIST);
+	printf("</td></tr>\n");
+
+	printf("<tr><td>\n");
+	printf("<table><tr>\n");
+	for (int eid = 0; eid < EVENT_MAX; eid++) {
+		if (ignore_event_type(eid))
+			continue;
+		printf("<td>&nbsp; <a style=\"text-decoration: none; color: #7191bc;\" href=\"#list_%d\"> <b>%s</b> </a>  &nbsp;</td>\n",
+				eid, event_names[eid].human_name);
+	}
+	printf("</tr></table><br>\n");
+	printf("</td></tr>\n");
+
+	std::sort(mm_event_top.begin(), mm_event_top.end(), events_sz_cmp);
+
+	for (int eid = 0; eid < EVENT_MAX; eid++) {
+		int top_list = 0;
+		auto rb = mm_event_top.rbegin();
+
+		if (ignore_event_type(eid))
+			continue;
+
+		printf("<tr><td bgcolor=\"%s\">\n",
+			CELL_COLOR_USED_MEMSET);
+		printf("<a name=\"list_%d\"></a>Go to list "
+				"<a style=\"text-decoration: none; color: #7191bc;\" href=\"#list_top\"><b>top</b></a>\n<br>\n",
+				eid);
+		printf("<br>Event type: <b>%s</b><br>", event_names[eid]);
+		printf("</td></tr>\n");
+
+		while (top_list < MAX_EVENTS_IN_TOP_LIST && rb != mm_event_top.rend()) {
+			struct mm_event *event = *rb;
+	
+			if (event->type == eid) {
+				if (event->trace_hash != 0) {
+					long num = callpath_freq[event->trace_hash];
+					printf("<tr><td>\n");
+					printf("This callpath has been seen %ld time%c [backtrace hash %llx]\n",
+							num, num > 1 ? 's' : ' ',
+							event->trace_hash);
+					printf("</td></tr>\n");
+				}
+				printf("<tr><td>\n");
+				__print_event(event);
+				printf("</td></tr>\n");
+
+				printf("<tr><td bgcolor=\"%s\">\n",
+						CELL_COLOR_UNUSED);
+				printf("<br></td></tr>\n");
 
-		if (line.find("[m:") != string::npos) {
-			// [m:86274048-86278144]
-			if (sscanf(line.c_str(), "[m:%ld-%ld]",
-						&event->mem_from,
-						&event->mem_to) != 2) {
-				cerr << "Can't parse mm: " << line << endl;
+				top_list++;
 			}
-			continue;
-		}
 
-		if (line[0] == '#') {
-			parse_event_backtrace(event, line);
-			continue;
+			rb++;
 		}
+	}
 
-		if (line[0] == '-') {
-			cerr << "Error: " << line << endl;
-			continue;
+	printf("</table>\n");
+}
+
+static void print_profile_stack(struct profile_stack *stack)
+{
+	if (stack && stack->trace.size() != 0) {
+		printf(" Backtrace: \n <br> ");
+		for (auto &tr : stack->trace) {
+			printf("&nbsp; [<0x%08lx>] %s+0x%lx &nbsp; \n <br>",
+					tr.addr,
+					symbols[tr.num].name.c_str(),
+					tr.offt);
 		}
+	} else {
+		printf(" No backtrace available \n <br> ");
 	}
+}
 
-	if (opts->debug)
-		cout << "File parsed" << endl;
+static const char *lifetime_str(int bucket, char *buf, size_t sz)
+{
+	unsigned long ns = bucket ? 1UL << (bucket - 1) : 0;
+
+	if (ns < 1000)
+		snprintf(buf, sz, "%lu ns", ns);
+	else if (ns < 1000000)
+		snprintf(buf, sz, "%lu us", ns / 1000);
+	else if (ns < 1000000000)
+		snprintf(buf, sz, "%lu ms", ns / 1000000);
+	else
+		snprintf(buf, sz, "%lu s", ns / 1000000000);
+	return buf;
+}
 
-out:
-	log_file.close();
-	return ret;
+/* lower bound of the bucket that holds the pct percentile */
+static int lifetime_percentile(struct profile_stack *stack, int pct)
+{
+	unsigned long total = 0, seen = 0;
+
+	for (auto &b : stack->lifetime)
+		total += b.second;
+
+	for (auto &b : stack->lifetime) {
+		seen += b.second;
+		if (seen * 100 >= total * pct)
+			return b.first;
+	}
+	return 0;
 }
 
-static void decode_mmap_prot(int prot)
+static void print_profile_lifetime(struct profile_stack *stack)
 {
-	if (prot & PROT_EXEC && prot & PROT_WRITE)
-		security_report = 1;
+	char p50[32], p90[32];
 
-	printf("%d /* <b>", prot);
+	if (stack->lifetime.empty())
+		return;
 
-	if (prot & PROT_EXEC)
-		printf("PROT_EXEC ");
-	if (prot & PROT_READ)
-		printf("PROT_READ ");
-	if (prot & PROT_WRITE)
-		printf("PROT_WRITE ");
-	if (prot & PROT_NONE)
-		printf("PROT_NONE ");
+	printf("Lifetime of freed blocks: p50 &gt;= %s, p90 &gt;= %s\n<br>",
+			lifetime_str(lifetime_percentile(stack, 50),
+				p50, sizeof(p50)),
+			lifetime_str(lifetime_percentile(stack, 90),
+				p90, sizeof(p90)));
+}
 
-	printf("</b>*/, ");
+static bool profile_live_cmp(const struct profile_stack *a,
+			     const struct profile_stack *b)
+{
+	if (a->live_bytes == b->live_bytes)
+		return a->alloc_bytes > b->alloc_bytes;
+	return a->live_bytes > b->live_bytes;
 }
 
-static void decode_mmap_flags(int flags)
+/* blocks that lived less than 2^SHORT_LIVED_BUCKET ns, ~1ms */
+#define SHORT_LIVED_BUCKET	20
+
+static unsigned long short_lived(const struct profile_stack *stack)
 {
-	printf("%d /* <b>", flags);
+	unsigned long nr = 0;
 
-	if (flags & MAP_SHARED)
-		printf("MAP_SHARED ");
-	if (flags & MAP_PRIVATE)
-		printf("MAP_PRIVATE ");
-	if (flags & MAP_32BIT)
-		printf("MAP_32BIT ");
-	if (flags & MAP_ANON)
-		printf("MAP_ANON ");
-	if (flags & MAP_ANONYMOUS)
-		printf("MAP_ANONYMOUS ");
-	if (flags & MAP_DENYWRITE)
-		printf("MAP_DENYWRITE ");
-	if (flags & MAP_EXECUTABLE)
-		printf("MAP_EXECUTABLE ");
-	if (flags & MAP_FILE)
-		printf("MAP_FILE ");
-	if (flags & MAP_FIXED)
-		printf("MAP_FIXED ");
-	if (flags & MAP_GROWSDOWN)
-		printf("MAP_GROWSDOWN ");
-	if (flags & MAP_HUGETLB)
-		printf("MAP_HUGETLB ");
-	if (flags & MAP_LOCKED)
-		printf("MAP_LOCKED ");
-	if (flags & MAP_NONBLOCK)
-		printf("MAP_NONBLOCK ");
-	if (flags & MAP_NORESERVE)
-		printf("MAP_NORESERVE ");
-	if (flags & MAP_POPULATE)
-		printf("MAP_POPULATE ");
-	if (flags & MAP_STACK)
-		printf("MAP_STACK ");
+	for (auto &b : stack->lifetime) {
+		if (b.first <= SHORT_LIVED_BUCKET)
+			nr += b.second;
+	}
+	return nr;
+}
 
-	printf("</b>*/, ");
+static bool short_lived_cmp(const struct profile_stack *a,
+			    const struct profile_stack *b)
+{
+	return short_lived(a) > short_lived(b);
 }
 
-static void print_event_header(struct mm_event *event)
+static void do_short_lived_report(vector<struct profile_stack *> &stacks)
 {
-	if (!event)
+	vector<struct profile_stack *> hot;
+
+	for (auto stack : stacks) {
+		if (short_lived(stack))
+			hot.push_back(stack);
+	}
+
+	if (hot.empty())
 		return;
 
-	printf("[%lu.%06d] Thread %d \n <br><br>",
-			event->timestamp.tv_sec,
-			event->timestamp.tv_usec,
-			event->tid);
+	std::sort(hot.begin(), hot.end(), short_lived_cmp);
 
-	printf("Issued <b>%s</b>(", event_names[event->type]);
+	printf("<a name=\"short_lived\"></a>\n");
+	printf("<table width=50%%>\n");
+	printf("<tr><td bgcolor=\"%s\">\n", CELL_COLOR_USED_MEMSET);
+	printf("<br>Short lived allocations (freed within ~1 ms), call paths sorted by count<br>\n");
+	printf("</td></tr>\n");
 
-	if (event->type == EVENT_MALLOC ||
-			event->type == EVENT_VALLOC ||
-			event->type == EVENT_PVALLOC) {
-		printf("%ld) = 0x%x",
-				event->size,
-				event->addr);
-	}
+	for (auto stack : hot) {
+		printf("<tr><td>\n");
+		printf("Short lived: <b>%lu</b> of %lu allocations (%lu bytes)\n<br>",
+				short_lived(stack), stack->allocs,
+				stack->alloc_bytes);
+		print_profile_lifetime(stack);
 
-	if (event->type == EVENT_MEMALIGN ||
-			event->type == EVENT_POSIX_MEMALIGN ||
-			event->type == EVENT_ALIGNED_ALLOC) {
-		printf("%ld, %ld) = 0x%x",
-				event->size,
-				event->align,
-				event->addr);
-	}
+		print_profile_stack(stack);
+		printf("</td></tr>\n");
 
-	if (event->type == EVENT_CALLOC) {
-		printf("%ld, %ld) = 0x%x",
-				event->size,
-				event->flags,
-				event->addr);
+		printf("<tr><td bgcolor=\"%s\">\n", CELL_COLOR_UNUSED);
+		printf("<br></td></tr>\n");
 	}
 
-	if (event->type == EVENT_FREE || event->type == EVENT_CFREE) {
-		printf("0x%x)\n<br>", event->addr);
-	}
+	printf("</table>\n");
+}
 
-	if (event->type == EVENT_REALLOC) {
-		printf("0x%x, %ld) = 0x%x",
-				event->prev_addr,
-				event->size,
-				event->addr);
-	}
+static void do_profile_report(void)
+{
+	vector<struct profile_stack *> stacks;
 
-	if (event->type == EVENT_MMAP || event->type == EVENT_MMAP2) {
-		printf("0x%x, %ld, ", event->prev_addr, event->size);
-		decode_mmap_prot(event->prot);
-		decode_mmap_flags(event->flags);
-		printf("%d, %ld) = 0x%x",
-				event->fd,
-				event->offt,
-				event->addr);
+	for (auto &p : profile_stacks) {
+		if (p.second.allocs)
+			stacks.push_back(&p.second);
 	}
 
-	if (event->type == EVENT_MUNMAP) {
-		printf("0x%x, %lx) = %d",
-				event->addr,
-				event->size,
-				event->ret);
-	}
+	std::sort(stacks.begin(), stacks.end(), profile_live_cmp);
 
-	if (event->type == EVENT_MEMSET) {
-		printf("0x%x, ", event->addr);
+	printf("<a name=\"profile\"></a>\n");
+	printf("<table width=50%%>\n");
+	printf("<tr><td bgcolor=\"%s\">\n", CELL_COLOR_USED_MEMSET);
+	printf("<br>Heap profile, snapshot <b>%lu</b>, call paths sorted by live bytes<br>\n",
+			profile_seq);
+	printf("</td></tr>\n");
 
-		if (event->mask == 0x00)
-			printf("'0'");
-		else
-			printf("'%c'", event->mask);
+	for (auto stack : stacks) {
+		printf("<tr><td>\n");
+		printf("Allocations: %lu (%lu bytes), frees: %lu, live: <b>%lu</b> bytes\n<br>",
+				stack->allocs, stack->alloc_bytes,
+				stack->frees, stack->live_bytes);
+		print_profile_lifetime(stack);
 
-		printf(", %ld) = 0x%x",
-				event->size,
-				event->prev_addr);
-	}
+		print_profile_stack(stack);
+		printf("</td></tr>\n");
 
-	if (event->type == EVENT_MEMMOVE) {
-		printf("0x%x, 0x%x, %ld) = 0x%x",
-				event->addr,
-				event->prev_addr,
-				event->size,
-				event->addr);
+		printf("<tr><td bgcolor=\"%s\">\n", CELL_COLOR_UNUSED);
+		printf("<br></td></tr>\n");
 	}
 
-	if (event->type == EVENT_MLOCK || event->type == EVENT_MUNLOCK) {
-		printf("0x%x, %ld) = %ld",
-				event->addr,
-				event->size,
-				event->ret);
-	}
+	printf("</table>\n");
 
-	if (event->type == EVENT_MLOCKALL) {
-		printf("%ld) = %ld",
-				event->flags,
-				event->ret);
+	do_short_lived_report(stacks);
+}
+
+static void do_counters_report(void)
+{
+	double sec = counters_elapsed_ms / 1000.0;
+
+	if (sec <= 0)
+		sec = 1;
+
+	printf("<a name=\"counters\"></a>\n");
+	printf("<table width=50%%>\n");
+	printf("<tr><td bgcolor=\"%s\" colspan=6>\n", CELL_COLOR_USED_MEMSET);
+	printf("<br>Event counters, %lu dumps over %.1f seconds<br>\n",
+			counters_seq, sec);
+	printf("</td></tr>\n");
+
+	printf("<tr><td><b>thread</b></td><td><b>event</b></td>"
+		"<td><b>calls</b></td><td><b>bytes</b></td>"
+		"<td><b>calls/sec</b></td><td><b>bytes/sec</b></td></tr>\n");
+
+	for (auto &c : counters_total) {
+		printf("<tr><td>all</td><td>%s</td><td>%lu</td><td>%lu</td>"
+			"<td>%.1f</td><td>%.1f</td></tr>\n",
+			c.first.c_str(), c.second.first, c.second.second,
+			c.second.first / sec, c.second.second / sec);
 	}
 
-	if (event->type == EVENT_MUNLOCKALL) {
-		printf(") = %ld",
-				event->ret);
+	for (auto &t : counters_tid) {
+		for (auto &c : t.second) {
+			printf("<tr><td>%d</td><td>%s</td><td>%lu</td><td>%lu</td>"
+				"<td>%.1f</td><td>%.1f</td></tr>\n",
+				t.first, c.first.c_str(),
+				c.second.first, c.second.second,
+				c.second.first / sec, c.second.second / sec);
+		}
 	}
 
-	printf("\n<br><br>");
+	printf("</table>\n");
 }
 
-static void print_mem_growth(struct mm_event *event)
+static void print_size_hist(const char *name, map<int, unsigned long> &hist,
+			    bool log2)
 {
-	if (!event)
+	unsigned long total = 0;
+
+	for (auto &b : hist)
+		total += b.second;
+	if (!total)
 		return;
 
-	if (event->mem_from != event->mem_to) {
-		printf("Detected /proc/self/statm <b>RSS</b> change from %lu to %lu bytes\n<br>",
-				event->mem_from,
-				event->mem_to);
+	printf("<tr><td colspan=3><b>%s</b>, %s buckets, %lu calls</td></tr>\n",
+			name, log2 ? "log2" : "16 byte", total);
 
-		printf("/* Diff: %ld\n */\n<br><br>",
-				event->mem_to - event->mem_from);
+	for (auto &b : hist) {
+		unsigned long lo, hi;
+
+		if (log2) {
+			lo = b.first ? 1UL << (b.first - 1) : 0;
+			hi = b.first ? (1UL << (b.first - 1)) * 2 - 1 : 0;
+		} else {
+			lo = b.first * 16 + 1;
+			hi = (b.first + 1) * 16;
+		}
+
+		printf("<tr><td>%lu - %lu</td><td>%lu</td>"
+			"<td><div style=\"background-color: %s; width: %lu%%\">"
+			"&nbsp;</div></td></tr>\n",
+			lo, hi, b.second, CELL_COLOR_USED_ALLOC,
+			b.second * 100 / total);
 	}
 }
 
-static long num_cells = 0;
-static int cells = 0;
+static void do_size_hist_report(void)
+{
+	printf("<a name=\"size_histogram\"></a>\n");
+	printf("<table width=50%%>\n");
+	printf("<tr><td bgcolor=\"%s\" colspan=3>\n", CELL_COLOR_USED_MEMSET);
+	printf("<br>Allocation size histograms<br>\n");
+	printf("</td></tr>\n");
 
-static void __print_event(struct mm_event *event)
+	printf("<tr><td><b>bytes</b></td><td><b>calls</b></td>"
+		"<td width=50%%></td></tr>\n");
+
+	for (auto &h : size_hist_log2)
+		print_size_hist(h.first.c_str(), h.second, true);
+	for (auto &h : size_hist_fine)
+		print_size_hist(h.first.c_str(), h.second, false);
+
+	printf("</table>\n");
+}
+
+static void do_latency_report(void)
 {
-	print_event_header(event);
-	print_mem_growth(event);
+	printf("<a name=\"latency\"></a>\n");
+	printf("<table width=50%%>\n");
+	printf("<tr><td bgcolor=\"%s\" colspan=5>\n", CELL_COLOR_USED_MEMSET);
+	printf("<br>glibc call latency, calls slower than %lu ns are backtraced<br>\n",
+			latency_threshold_ns);
+	printf("</td></tr>\n");
+
+	printf("<tr><td><b>event</b></td><td><b>calls</b></td>"
+		"<td><b>p50 ns</b></td><td><b>p99 ns</b></td>"
+		"<td><b>max ns</b></td></tr>\n");
+
+	for (auto &h : latency_hist) {
+		unsigned long total = 0, seen = 0;
+		unsigned long p50 = 0, p99 = 0, max = 0;
+
+		for (auto &b : h.second)
+			total += b.second;
+
+		for (auto &b : h.second) {
+			seen += b.second;
+			if (!p50 && seen * 2 >= total)
+				p50 = b.first;
+			if (!p99 && seen * 100 >= total * 99)
+				p99 = b.first;
+			max = b.first;
+		}
+
+		printf("<tr><td>%s</td><td>%lu</td><td>%lu</td>"
+			"<td>%lu</td><td>%lu</td></tr>\n",
+			h.first.c_str(), total, p50, p99, max);
+	}
+
+	printf("</table>\n");
+}
+
+#define CHART_WIDTH	800
+#define CHART_HEIGHT	300
+
+struct chart_series {
+	const char *name;
+	const char *color;
+	vector<pair<double, unsigned long>> points;
+};
+
+static void print_chart(vector<struct chart_series> &series)
+{
+	double t0 = 0, t1 = 0;
+	unsigned long max = 1;
+	bool first = true;
+
+	for (auto &s : series) {
+		for (auto &p : s.points) {
+			if (first || p.first < t0)
+				t0 = p.first;
+			if (first || p.first > t1)
+				t1 = p.first;
+			if (p.second > max)
+				max = p.second;
+			first = false;
+		}
+	}
+
+	if (t1 <= t0)
+		t1 = t0 + 1;
+
+	printf("<svg width=\"%d\" height=\"%d\" style=\"border: 1px solid #ccc\">\n",
+			CHART_WIDTH, CHART_HEIGHT);
+	for (auto &s : series) {
+		printf("<polyline fill=\"none\" stroke=\"%s\" points=\"",
+				s.color);
+		for (auto &p : s.points) {
+			printf("%.1f,%.1f ",
+				(p.first - t0) * CHART_WIDTH / (t1 - t0),
+				CHART_HEIGHT - (double)p.second * CHART_HEIGHT / max);
+		}
+		printf("\"/>\n");
+	}
+	printf("</svg>\n<br>\n");
+
+	printf("%.1f seconds, max %lu bytes:", t1 - t0, max);
+	for (auto &s : series) {
+		if (s.points.size())
+			printf(" <font color=\"%s\">&#9632;</font> %s",
+					s.color, s.name);
+	}
+	printf("\n<br>\n");
+}
+
+static void do_heap_stat_report(void)
+{
+	vector<struct chart_series> series(5);
+
+	series[0].name = "RSS";
+	series[0].color = "#000000";
+	series[1].name = "glibc: obtained from the system (arena + mmap)";
+	series[1].color = "#0066cc";
+	series[2].name = "glibc: in use (uordblks + mmap)";
+	series[2].color = "#00aa00";
+	series[3].name = "glibc: free chunks (fordblks)";
+	series[3].color = "#cc0000";
+	series[4].name = "[m:] RSS after traced events";
+	series[4].color = "#999999";
+
+	for (auto &st : heap_stats) {
+		series[0].points.push_back(make_pair(st.ts, st.rss));
+		series[1].points.push_back(make_pair(st.ts,
+					st.arena + st.hblkhd));
+		series[2].points.push_back(make_pair(st.ts,
+					st.uordblks + st.hblkhd));
+		series[3].points.push_back(make_pair(st.ts, st.fordblks));
+	}
 
-	if (!event) {
-		printf("&nbsp; <br>\n");
-		return;
+	for (auto &p : proc_map) {
+		for (auto event : p.second->events) {
+			if (!event->mem_to)
+				continue;
+
+			series[4].points.push_back(make_pair(
+				event->timestamp.tv_sec +
+				event->timestamp.tv_usec / 1000000.0,
+				event->mem_to));
+		}
 	}
+	std::sort(series[4].points.begin(), series[4].points.end());
 
-	if (event->trace.size() != 0) {
-		auto tr = event->trace.begin();
+	printf("<a name=\"mallinfo\"></a>\n");
+	printf("<table width=50%%>\n");
+	printf("<tr><td bgcolor=\"%s\" colspan=5>\n", CELL_COLOR_USED_MEMSET);
+	printf("<br>glibc allocator statistics, %zu samples<br>\n",
+			heap_stats.size());
+	printf("</td></tr>\n");
 
-		printf(" Backtrace: \n <br> ");
+	printf("<tr><td colspan=5>\n");
+	if (heap_stats.size())
+		print_chart(series);
+	printf("</td></tr>\n");
 
-		while (tr != event->trace.end()) {
-			printf("&nbsp; [<0x%08lx>] %s+0x%lx &nbsp; \n <br>",
-					tr->addr,
-					symbols[tr->num].name.c_str(),
-					tr->offt);
-			tr++;
+	if (meta_seen) {
+		printf("<tr><td colspan=5>libmtrace metadata, not included above: "
+			"mapped <b>%lu</b> bytes, in use <b>%lu</b>, peak <b>%lu</b>",
+				meta_mapped, meta_used, meta_peak);
+		if (meta_failed)
+			printf(", <b>%lu</b> allocations over MTRACE_META_LIMIT",
+					meta_failed);
+		printf("</td></tr>\n");
+	}
+
+	if (malloc_info_seq) {
+		printf("<tr><td colspan=5>Arenas, malloc_info() snapshot <b>%lu</b></td></tr>\n",
+				malloc_info_seq);
+		printf("<tr><td><b>arena</b></td><td><b>system bytes</b></td>"
+			"<td><b>max system bytes</b></td><td><b>free chunks</b></td>"
+			"<td><b>free bytes</b></td></tr>\n");
+
+		for (auto &a : arenas) {
+			printf("<tr><td>%d</td><td>%lu</td><td>%lu</td>"
+				"<td>%lu</td><td>%lu</td></tr>\n",
+				a.first, a.second.system, a.second.system_max,
+				a.second.fast_count + a.second.rest_count,
+				a.second.fast_size + a.second.rest_size);
 		}
-	} else {
-		printf(" No backtrace available \n <br> ");
 	}
+
+	printf("</table>\n");
 }
 
-static int ignore_event_type(int eid)
+static unsigned long cold_bytes(const struct cold_group &g)
 {
-	if (eid == EVENT_FREE ||
-		eid == EVENT_CFREE ||
-		eid == EVENT_MEMMOVE ||
-		eid == EVENT_MUNMAP ||
-		eid == EVENT_MEMSET ||
-		eid == EVENT_MLOCK ||
-		eid == EVENT_MLOCKALL ||
-		eid == EVENT_MUNLOCK ||
-		eid == EVENT_MUNLOCKALL)
-		return 1;
-
-	return 0;
+	return g.bytes > g.resident ? g.bytes - g.resident : 0;
 }
 
-static void add_event_to_top_list(struct mm_event *event)
+static bool cold_group_cmp(const struct cold_group &a,
+			   const struct cold_group &b)
 {
-	if (!event)
-		return;
-
-	if (ignore_event_type(event->type))
-		return;
-
-	mm_event_top.push_back(event);
+	return cold_bytes(a) > cold_bytes(b);
 }
 
-static void add_cell(const char *bgcolor, struct mm_event *event)
+static void do_cold_report(void)
 {
-	const char *border_color = CELL_BORDER_COLOR_NO_BACKTRACE;
-
-	if (event && event->trace.size() != 0)
-		border_color = CELL_BORDER_COLOR_BACKTRACE;
-
-	if (event && (event->type == EVENT_MLOCK ||
-				event->type == EVENT_MLOCKALL))
-		border_color = CELL_BORDER_COLOR_MLOCKED;
+	std::sort(cold_groups.begin(), cold_groups.end(), cold_group_cmp);
 
-	printf("<td width=7 height=7 bgcolor=\"%s\" id=\"%s\" "
-		"onclick='show_backtrace(\"backtrace%ld\");'>\n",
-		bgcolor,
-		border_color,
-		num_cells);
+	printf("<a name=\"cold\"></a>\n");
+	printf("<table width=50%%>\n");
+	printf("<tr><td bgcolor=\"%s\">\n", CELL_COLOR_WARNING);
+	printf("<br>Cold memory, sample <b>%lu</b>, call paths sorted by non-resident bytes<br>\n",
+			cold_seq);
+	printf("</td></tr>\n");
 
-	add_event_to_top_list(event);
+	for (auto &group : cold_groups) {
+		auto stack = profile_stacks.find(group.id);
 
-	printf("<div id=\"backtrace%ld\" style=\"display: none\">", num_cells);
+		printf("<tr><td>\n");
+		printf("Large blocks: %lu, %lu bytes, resident: %lu bytes (%lu%%), "
+			"written since the previous sample: %lu bytes\n<br>",
+				group.blocks, group.bytes, group.resident,
+				group.bytes ? group.resident * 100 / group.bytes : 0,
+				group.dirty);
+
+		if (stack != profile_stacks.end())
+			print_profile_stack(&stack->second);
+		else
+			print_profile_stack(NULL);
+		printf("</td></tr>\n");
 
-	__print_event(event);
+		printf("<tr><td bgcolor=\"%s\">\n", CELL_COLOR_UNUSED);
+		printf("<br></td></tr>\n");
+	}
 
-	printf("</div>\n");
-	printf("</td>\n");
+	printf("</table>\n");
+}
 
-	num_cells++;
-	cells++;
-	if (cells >= MAX_MEM_CELLS_IN_A_ROW) {
-		printf("</tr>\n");
-		printf("<tr>\n");
-		cells = 0;
-	}
+static bool numa_group_cmp(const pair<unsigned long, struct numa_group> &a,
+			   const pair<unsigned long, struct numa_group> &b)
+{
+	return a.second.remote_bytes > b.second.remote_bytes;
 }
 
-static void do_security_report(void)
+static void do_numa_report(void)
 {
-	auto p = mem_area.begin();
+	vector<pair<unsigned long, struct numa_group>> groups(
+			numa_groups.begin(), numa_groups.end());
 
-	printf("<table width=50%>\n");
-	printf("<tr width=50%><td>\n");
-	printf("<tr><td bgcolor=\"%s\">\n",
-		CELL_COLOR_WARNING);
-	printf("<a name=\"security_report\"></a>Go to list "
-		"<a style=\"text-decoration: none; color: #7191bc;\" href=\"#list_top\"><b>top</b></a>\n<br>\n");
-	printf("<br><b>Security report</b><br>");
+	std::sort(groups.begin(), groups.end(), numa_group_cmp);
+
+	printf("<a name=\"numa\"></a>\n");
+	printf("<table width=50%%>\n");
+	printf("<tr><td bgcolor=\"%s\">\n", CELL_COLOR_WARNING);
+	printf("<br>NUMA placement, sample <b>%lu</b>, %d node(s), call paths sorted by remote bytes<br>\n",
+			numa_seq, numa_nodes);
 	printf("</td></tr>\n");
 
-	while (p != mem_area.end()) {
-		if (p->second->event->type != EVENT_MMAP &&
-				p->second->event->type != EVENT_MMAP2)
-			goto skip;
+	for (auto &g : groups) {
+		auto stack = profile_stacks.find(g.first);
 
-		if ((p->second->event->prot & PROT_EXEC) &&
-				(p->second->event->prot & PROT_WRITE)) {
-			printf("<tr><td>\n");
-			__print_event(p->second->event);
-			printf("</td></tr>\n");
+		printf("<tr><td>\n");
+		printf("Large blocks: %lu, %lu bytes, on a remote node: <b>~%lu</b> bytes "
+			"(%lu of %lu sampled pages)\n<br>",
+				g.second.blocks, g.second.bytes,
+				g.second.remote_bytes, g.second.remote_pages,
+				g.second.local_pages + g.second.remote_pages);
+
+		if (stack != profile_stacks.end())
+			print_profile_stack(&stack->second);
+		else
+			print_profile_stack(NULL);
+		printf("</td></tr>\n");
 
-			printf("<tr><td bgcolor=\"%s\">\n",
-					CELL_COLOR_UNUSED);
-			printf("<br></td></tr>\n");
-		}
-skip:
-		p++;
+		printf("<tr><td bgcolor=\"%s\">\n", CELL_COLOR_UNUSED);
+		printf("<br></td></tr>\n");
 	}
 
 	printf("</table>\n");
 }
 
-static void do_event_top_report(void)
+static bool tag_stat_cmp(const pair<int, struct tag_stat> &a,
+			 const pair<int, struct tag_stat> &b)
 {
-	printf("<a name=\"list_top\"></a>\n");
+	return a.second.peak > b.second.peak;
+}
 
-	printf("<table width=50%>\n");
-	printf("<tr width=50%><td>\n");
-	printf("Per-event type top list sorted by size in reverse order. (Up to %ld events of each type)\n<br>\n",
-			MAX_EVENTS_IN_TOP_LIST);
+static void do_tag_report(void)
+{
+	vector<pair<int, struct tag_stat>> stats(tag_stats.begin(),
+			tag_stats.end());
+
+	std::sort(stats.begin(), stats.end(), tag_stat_cmp);
+
+	printf("<a name=\"tags\"></a>\n");
+	printf("<table width=50%%>\n");
+	printf("<tr><td bgcolor=\"%s\" colspan=7>\n", CELL_COLOR_WARNING);
+	printf("<br>Application tags, sorted by peak live bytes of traced events<br>\n");
 	printf("</td></tr>\n");
 
-	printf("<tr><td>\n");
-	printf("<table><tr>\n");
-	for (int eid = 0; eid < EVENT_MAX; eid++) {
-		if (ignore_event_type(eid))
+	printf("<tr><td><b>tag</b></td><td><b>allocs</b></td>"
+		"<td><b>allocated bytes</b></td><td><b>frees</b></td>"
+		"<td><b>freed bytes</b></td><td><b>live bytes</b></td>"
+		"<td><b>peak live bytes</b></td></tr>\n");
+
+	for (auto &s : stats) {
+		if (!s.second.allocs)
 			continue;
-		printf("<td>&nbsp; <a style=\"text-decoration: none; color: #7191bc;\" href=\"#list_%d\"> <b>%s</b> </a>  &nbsp;</td>\n",
-				eid, event_names[eid].human_name);
+
+		printf("<tr><td>%s</td><td>%lu</td><td>%lu</td><td>%lu</td>"
+			"<td>%lu</td><td>%lu</td><td><b>%lu</b></td></tr>\n",
+				s.first ? s.second.name.c_str() : "(none)",
+				s.second.allocs, s.second.alloc_bytes,
+				s.second.frees, s.second.free_bytes,
+				s.second.live, s.second.peak);
 	}
-	printf("</tr></table><br>\n");
+
+	printf("</table>\n");
+
+	if (tag_marks.empty())
+		return;
+
+	printf("<br><table width=50%%>\n");
+	printf("<tr><td bgcolor=\"%s\" colspan=2>\n", CELL_COLOR_WARNING);
+	printf("<br>Marks<br>\n");
 	printf("</td></tr>\n");
 
-	std::sort(mm_event_top.begin(), mm_event_top.end(), events_sz_cmp);
+	for (auto &m : tag_marks)
+		printf("<tr><td>%s</td><td>%s</td></tr>\n", m.second.c_str(),
+				tag_stats[m.first].name.c_str());
 
-	for (int eid = 0; eid < EVENT_MAX; eid++) {
-		int top_list = 0;
-		auto rb = mm_event_top.rbegin();
+	printf("</table>\n");
+}
 
-		if (ignore_event_type(eid))
-			continue;
+static bool heap_group_cmp(const struct heap_group &a,
+			   const struct heap_group &b)
+{
+	return a.bytes > b.bytes;
+}
 
-		printf("<tr><td bgcolor=\"%s\">\n",
-			CELL_COLOR_USED_MEMSET);
-		printf("<a name=\"list_%d\"></a>Go to list "
-				"<a style=\"text-decoration: none; color: #7191bc;\" href=\"#list_top\"><b>top</b></a>\n<br>\n",
-				eid);
-		printf("<br>Event type: <b>%s</b><br>", event_names[eid]);
-		printf("</td></tr>\n");
+static void do_heap_report(void)
+{
+	std::sort(heap_groups.begin(), heap_groups.end(), heap_group_cmp);
 
-		while (top_list < MAX_EVENTS_IN_TOP_LIST && rb != mm_event_top.rend()) {
-			struct mm_event *event = *rb;
-	
-			if (event->type == eid) {
-				if (event->trace_hash != 0) {
-					long num = callpath_freq[event->trace_hash];
-					printf("<tr><td>\n");
-					printf("This callpath has been seen %ld time%c [backtrace hash %llx]\n",
-							num, num > 1 ? 's' : ' ',
-							event->trace_hash);
-					printf("</td></tr>\n");
-				}
-				printf("<tr><td>\n");
-				__print_event(event);
-				printf("</td></tr>\n");
+	printf("<a name=\"heap\"></a>\n");
+	printf("<table width=50%%>\n");
+	printf("<tr><td bgcolor=\"%s\">\n", CELL_COLOR_WARNING);
+	printf("<br>Live heap snapshot <b>%lu</b> (%s), call paths sorted by live bytes<br>\n",
+			heap_seq, heap_reason.c_str());
+	printf("</td></tr>\n");
 
-				printf("<tr><td bgcolor=\"%s\">\n",
-						CELL_COLOR_UNUSED);
-				printf("<br></td></tr>\n");
+	for (auto &group : heap_groups) {
+		auto stack = profile_stacks.find(group.id);
 
-				top_list++;
-			}
+		printf("<tr><td>\n");
+		printf("Live blocks: %lu, <b>%lu</b> bytes, oldest allocated at %s by thread %d\n<br>",
+				group.count, group.bytes,
+				group.oldest.c_str(), group.oldest_tid);
+		print_profile_stack(stack != profile_stacks.end() ?
+				&stack->second : NULL);
+		printf("</td></tr>\n");
 
-			rb++;
-		}
+		printf("<tr><td bgcolor=\"%s\">\n", CELL_COLOR_UNUSED);
+		printf("<br></td></tr>\n");
 	}
 
 	printf("</table>\n");
@@ -1042,8 +2683,11 @@ static void do_mem_area_report(void)
 		/* down scale mem_area size to 1 cell per mem_area */
 		sz = min(1L, (long)sz / 4096 ?: 1);
 		while (sz > 0) {
-			if (p->second->event->type == EVENT_MMAP ||
-					p->second->event->type == EVENT_MMAP2)
+			if (p->second->released == p->second->size)
+				add_cell(CELL_COLOR_RELEASED, p->second->event);
+			else if (p->second->event->type == EVENT_MMAP ||
+					p->second->event->type == EVENT_MMAP2 ||
+					p->second->event->type == EVENT_MREMAP)
 				add_cell(CELL_COLOR_USED_MMAP, p->second->event);
 			else if (p->second->event->type == EVENT_MEMSET)
 				add_cell(CELL_COLOR_USED_MEMSET, p->second->event);
@@ -1116,6 +2760,13 @@ static void generate_report(void)
 
 	printf("</head>\n");
 	printf("<body>\n");
+
+	if (proc_seen) {
+		printf("Process <b>%s</b> %d, %s, parent %d<br><br>\n",
+				proc_self.name.c_str(), proc_self.pid,
+				proc_self.how.c_str(), proc_self.ppid);
+	}
+
 	printf("<table>");
 	printf("<tr>\n");
 	printf("<td width=5 height=5 bgcolor=\"%s\" id=\"%s\"> </td>\n",
@@ -1133,6 +2784,10 @@ static void generate_report(void)
 	printf("<td width=5 height=5 bgcolor=\"%s\"> </td>\n",
 			CELL_COLOR_USED_MMAP);
 	printf("<td>mmap-ed memory</td>\n");
+
+	printf("<td width=5 height=5 bgcolor=\"%s\"> </td>\n",
+			CELL_COLOR_RELEASED);
+	printf("<td>Released with madvise()</td>\n");
 	printf("</tr>\n");
 	printf("</table>");
 
@@ -1163,6 +2818,33 @@ static void generate_report(void)
 		printf("</table>\n");
 	}
 
+	if (profile_seq)
+		do_profile_report();
+
+	if (heap_seq)
+		do_heap_report();
+
+	if (counters_seq)
+		do_counters_report();
+
+	if (size_hist_seq)
+		do_size_hist_report();
+
+	if (latency_seq)
+		do_latency_report();
+
+	if (heap_stats.size() || malloc_info_seq || meta_seen)
+		do_heap_stat_report();
+
+	if (cold_seq)
+		do_cold_report();
+
+	if (numa_seq)
+		do_numa_report();
+
+	if (tag_stats.size() > tag_stats.count(0) || !tag_marks.empty())
+		do_tag_report();
+
 	do_event_top_report();
 
 	if (security_report)
@@ -1172,10 +2854,159 @@ static void generate_report(void)
 	printf("</html>\n");
 }
 
+/*
+ * A trace file of each traced image: the [proc:] record comes first.
+ * Rotated files have none, they go with the image of their pid.
+ */
+static int tree_read_file(const string &dir, const string &fname,
+			  vector<struct proc_info> &procs,
+			  vector<pair<int, string>> &rotated)
+{
+	struct proc_info pi;
+	ifstream file;
+	string line;
+	size_t dash;
+
+	file.open((dir + "/" + fname).c_str());
+	if (!file.is_open())
+		return -EINVAL;
+
+	while (getline(file, line)) {
+		string_chomp(line);
+		if (line.compare(0, 6, "[proc:"))
+			continue;
+
+		if (parse_proc(line, &pi))
+			break;
+
+		pi.files.push_back(fname);
+		procs.push_back(pi);
+		return 0;
+	}
+
+	// mtrace-APP-PID.SEQ
+	dash = fname.rfind('-');
+	if (dash != string::npos)
+		rotated.push_back(make_pair(atoi(fname.c_str() + dash + 1),
+					fname));
+	return 0;
+}
+
+/*
+ * The image of `pid' at `ts': the latest one started before it.
+ */
+static int tree_find(vector<struct proc_info> &procs, int pid, double ts,
+		     int skip)
+{
+	int ret = -1;
+
+	for (int i = 0; i < (int)procs.size(); i++) {
+		if (i == skip || procs[i].pid != pid || procs[i].ts > ts)
+			continue;
+		if (ret < 0 || procs[i].ts > procs[ret].ts)
+			ret = i;
+	}
+	return ret;
+}
+
+static void print_tree(vector<struct proc_info> &procs, int idx)
+{
+	struct proc_info &pi = procs[idx];
+
+	printf("<li><b>%s</b> %d, %s at %.6f:", pi.name.c_str(), pi.pid,
+			pi.how.c_str(), pi.ts);
+	for (auto &f : pi.files)
+		printf(" %s", f.c_str());
+	printf("\n");
+
+	if (pi.children.empty()) {
+		printf("</li>\n");
+		return;
+	}
+
+	printf("<ul>\n");
+	for (int child : pi.children)
+		print_tree(procs, child);
+	printf("</ul></li>\n");
+}
+
+static bool proc_ts_cmp(const struct proc_info &a, const struct proc_info &b)
+{
+	return a.ts < b.ts;
+}
+
+/*
+ * Process tree of a directory of trace files (MTRACE_LOG_DIR).
+ * Children of fork() and spawned processes go under the image of their
+ * parent, a new image after exec() under the image it replaced.
+ */
+static int do_process_tree(const string &dir)
+{
+	vector<pair<int, string>> rotated;
+	vector<struct proc_info> procs;
+	vector<int> roots;
+	struct dirent *de;
+	DIR *d;
+
+	d = opendir(dir.c_str());
+	if (!d)
+		return -errno;
+
+	while ((de = readdir(d))) {
+		string fname = de->d_name;
+
+		if (fname.compare(0, 7, "mtrace-") ||
+				fname.find(".demangled") != string::npos)
+			continue;
+		tree_read_file(dir, fname, procs, rotated);
+	}
+	closedir(d);
+
+	std::sort(procs.begin(), procs.end(), proc_ts_cmp);
+
+	for (auto &r : rotated) {
+		int idx = tree_find(procs, r.first, HUGE_VAL, -1);
+
+		if (idx >= 0)
+			procs[idx].files.push_back(r.second);
+	}
+
+	for (int i = 0; i < (int)procs.size(); i++) {
+		int parent = -1;
+
+		if (procs[i].how == "exec")
+			parent = tree_find(procs, procs[i].pid, procs[i].ts, i);
+		if (parent < 0)
+			parent = tree_find(procs, procs[i].ppid, procs[i].ts, i);
+
+		if (parent < 0)
+			roots.push_back(i);
+		else
+			procs[parent].children.push_back(i);
+	}
+
+	printf("<html>\n");
+	printf("<body>\n");
+	printf("<table width=50%%>\n");
+	printf("<tr><td bgcolor=\"%s\">\n", CELL_COLOR_USED_MEMSET);
+	printf("<br>Process tree of <b>%s</b>, %zu processes<br>\n",
+			dir.c_str(), procs.size());
+	printf("</td></tr>\n");
+	printf("<tr><td><ul>\n");
+	for (int root : roots)
+		print_tree(procs, root);
+	printf("</ul></td></tr>\n");
+	printf("</table>\n");
+	printf("</body>\n");
+	printf("</html>\n");
+	return 0;
+}
+
 static void error_usage(void)
 {
 	printf("parser\n"
 		"-f --file=FILE      MM mode file to parse\n"
+		"-t --tree=DIR       process tree of a directory of trace files\n"
 		"-p                  plain output (do not demangle C++ names)\n"
 		"-d                  debug mode\n");
 	exit(1);
@@ -1185,12 +3016,13 @@ int main(int argc, char **argv)
 {
 	static struct option long_options[] = {
 		{"file", 1, 0, 'f'},
+		{"tree", 1, 0, 't'},
 		{"plain", 0, 0, 'p'},
 		{"debug", 0, 0, 'd'},
 		{0, 0, 0, 0}
 	};
 
-	const char *appopts = "f:pd";
+	const char *appopts = "f:t:pd";
 	while (1) {
 		int c = getopt(argc, argv, appopts);
 		if (c == -1)
@@ -1200,6 +3032,9 @@ int main(int argc, char **argv)
 			case 'f':
 				opts.file = optarg;
 				break;
+			case 't':
+				opts.tree = optarg;
+				break;
 			case 'p':
 				opts.plain = 1;
 				break;
@@ -1211,6 +3046,14 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (!opts.tree.empty()) {
+		if (do_process_tree(opts.tree)) {
+			cerr << "Can't read " << opts.tree << endl;
+			return -EINVAL;
+		}
+		return EXIT_SUCCESS;
+	}
+
 	if (opts.file.empty())
 		error_usage();
 
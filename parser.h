@@ -36,6 +36,7 @@ using namespace std;
 
 struct options {
 	std::string file;
+	std::string tree;
 	int plain;
 	int debug;
 };
@@ -65,17 +66,117 @@ struct mm_event {
 	unsigned long mem_from;
 	unsigned long mem_to;
 
+	/* similar events suppressed by the tracer's callsite rate limit */
+	unsigned long suppressed;
+
+	/* latency mode: time spent in the glibc call */
+	unsigned long latency_ns;
+
+	/* innermost application tag of the thread, 0 if none */
+	int tag;
+
+	/* mremap: size of the old mapping */
+	unsigned long prev_size;
+	/* brk/sbrk: change of the program break */
+	long incr;
+
 	struct timeval timestamp;
 
 	size_t trace_hash;
 	std::vector<struct backtrace> trace;
 };
 
+/* [s:] stack and its counters from the last [p:] profile snapshot */
+struct profile_stack {
+	unsigned long id;
+
+	unsigned long allocs;
+	unsigned long alloc_bytes;
+	unsigned long frees;
+	unsigned long live_bytes;
+
+	/* log2 lifetime of freed blocks, ns: bucket -> count */
+	std::map<int, unsigned long> lifetime;
+
+	std::vector<struct backtrace> trace;
+};
+
+/* [H:] live blocks of one stack from the last [h:] heap snapshot */
+struct heap_group {
+	unsigned long id;
+	unsigned long count;
+	unsigned long bytes;
+	string oldest;
+	int oldest_tid;
+};
+
+/* [a:] glibc mallinfo2() sample */
+struct heap_stat {
+	double ts;
+	unsigned long rss;
+	unsigned long arena;
+	unsigned long hblkhd;
+	unsigned long uordblks;
+	unsigned long fordblks;
+	unsigned long keepcost;
+};
+
+/* per-arena numbers from the last [x:] malloc_info() snapshot */
+struct arena_info {
+	unsigned long fast_count;
+	unsigned long fast_size;
+	unsigned long rest_count;
+	unsigned long rest_size;
+	unsigned long system;
+	unsigned long system_max;
+};
+
+/* [K:] large live blocks of one stack from the last [k:] sample */
+struct cold_group {
+	unsigned long id;
+	unsigned long blocks;
+	unsigned long bytes;
+	unsigned long resident;
+	unsigned long dirty;
+};
+
+/* [N:] placement of large blocks of one stack, last [n:] sample */
+struct numa_group {
+	unsigned long blocks;
+	unsigned long bytes;
+	unsigned long remote_bytes;
+	unsigned long local_pages;
+	unsigned long remote_pages;
+};
+
+struct tag_stat {
+	std::string name;
+	unsigned long allocs;
+	unsigned long alloc_bytes;
+	unsigned long frees;
+	unsigned long free_bytes;
+	unsigned long live;
+	unsigned long peak;
+};
+
 struct mem_area {
 	unsigned long size;
+	/* bytes given back with madvise(MADV_DONTNEED/FREE/REMOVE) */
+	unsigned long released;
 	struct mm_event *event;
 };
 
+/* [proc:] lineage record, an image of a process and its trace files */
+struct proc_info {
+	int pid;
+	int ppid;
+	std::string how;
+	double ts;
+	std::string name;
+	std::vector<std::string> files;
+	std::vector<int> children;
+};
+
 struct proc_tid {
 	int tid;
 
@@ -109,6 +210,18 @@ int mlock_event_header(struct mm_event *event, string &line);
 int munlock_event_header(struct mm_event *event, string &line);
 int mlockall_event_header(struct mm_event *event, string &line);
 int munlockall_event_header(struct mm_event *event, string &line);
+int new_event_header(struct mm_event *event, string &line);
+int new_array_event_header(struct mm_event *event, string &line);
+int delete_event_header(struct mm_event *event, string &line);
+int delete_array_event_header(struct mm_event *event, string &line);
+int reallocarray_event_header(struct mm_event *event, string &line);
+int free_sized_event_header(struct mm_event *event, string &line);
+int free_aligned_sized_event_header(struct mm_event *event, string &line);
+int malloc_usable_size_event_header(struct mm_event *event, string &line);
+int mremap_event_header(struct mm_event *event, string &line);
+int madvise_event_header(struct mm_event *event, string &line);
+int brk_event_header(struct mm_event *event, string &line);
+int sbrk_event_header(struct mm_event *event, string &line);
 
 static const formatter formatters[] = {
 	// $ suffix
@@ -232,6 +345,84 @@ static const formatter formatters[] = {
 		4,
 		munlockall_event_header,
 	},
+
+	// C++ operators, $ suffix
+	// EVENT_NEW
+	{
+		"[t:%d][t:%lu.%lu] NW$(%lu, %lu)=0x%x",
+		6,
+		new_event_header,
+	},
+	// EVENT_NEW_ARRAY
+	{
+		"[t:%d][t:%lu.%lu] NA$(%lu, %lu)=0x%x",
+		6,
+		new_array_event_header,
+	},
+	// EVENT_DELETE
+	{
+		"[t:%d][t:%lu.%lu] DL$(0x%x, %lu)",
+		5,
+		delete_event_header,
+	},
+	// EVENT_DELETE_ARRAY
+	{
+		"[t:%d][t:%lu.%lu] DA$(0x%x, %lu)",
+		5,
+		delete_array_event_header,
+	},
+
+	// $ suffix
+	// EVENT_REALLOCARRAY
+	{
+		"[t:%d][t:%lu.%lu] RA$(0x%x, %lu, %lu)=0x%x",
+		7,
+		reallocarray_event_header,
+	},
+	// EVENT_FREE_SIZED
+	{
+		"[t:%d][t:%lu.%lu] FS$(0x%x, %lu)",
+		5,
+		free_sized_event_header,
+	},
+	// EVENT_FREE_ALIGNED_SIZED
+	{
+		"[t:%d][t:%lu.%lu] FA$(0x%x, %lu, %lu)",
+		6,
+		free_aligned_sized_event_header,
+	},
+	// EVENT_MALLOC_USABLE_SIZE
+	{
+		"[t:%d][t:%lu.%lu] US$(0x%x)=%lu",
+		5,
+		malloc_usable_size_event_header,
+	},
+
+	// & suffix
+	// EVENT_MREMAP
+	{
+		"[t:%d][t:%lu.%lu] MR&(0x%x, %lu, %lu, %d)=0x%x",
+		8,
+		mremap_event_header,
+	},
+	// EVENT_MADVISE
+	{
+		"[t:%d][t:%lu.%lu] MA&(0x%x, %lu, %d)=%d",
+		7,
+		madvise_event_header,
+	},
+	// EVENT_BRK
+	{
+		"[t:%d][t:%lu.%lu] BR&(0x%x, %ld)=%d",
+		6,
+		brk_event_header,
+	},
+	// EVENT_SBRK
+	{
+		"[t:%d][t:%lu.%lu] SB&(%ld)=0x%x",
+		5,
+		sbrk_event_header,
+	},
 };
 
 #endif /* _PARSER_H */
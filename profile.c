@@ -0,0 +1,751 @@
+/*
+ * Copyright (C) 2017 Sergey Senozhatsky
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "config.h"
+#include <output.h>
+#include <meta.h>
+#include <sampler.h>
+#include <unwind_trace.h>
+#include <profile.h>
+
+/*
+ * In-process heap profile.
+ *
+ * Instead of writing every event to the trace we keep per call stack
+ * counters: allocations, allocated bytes, frees and freed bytes. Stacks
+ * live in an open addressing table, slots are claimed with a CAS and
+ * never released, so the lookup on every allocation takes no locks. A
+ * new stack is reported once, as a [s:ID] record followed by its frames.
+ *
+ * Frees are matched to the allocating stack through a pointer table,
+ * which is split into shards, each with its own lock, to keep threads
+ * off each other's cache lines.
+ *
+ * The pointer table also remembers when every block was allocated, so
+ * frees add the block's lifetime to a log2 histogram of its stack:
+ * bucket N counts blocks that lived [2^(N-1), 2^N) nanoseconds.
+ *
+ * Snapshots are written by the sampler thread every `interval' seconds
+ * and at exit:
+ *	[p:SEQ:SEC.USEC]
+ *	[P:ID:ALLOCS:ALLOC_BYTES:FREES:LIVE_BYTES]
+ *	[L:ID:BUCKET=COUNT,...]
+ *	...
+ *
+ * The pointer table alone (MTRACE_LEAK_REPORT) also works in other
+ * reporting modes. It remembers when and by which thread every live
+ * block was allocated, and is walked for the leak report at exit and
+ * for heap snapshots on demand:
+ *	[h:SEQ:SEC.USEC:REASON]
+ *	[H:ID:COUNT:BYTES:OLDEST_SEC.MSEC:OLDEST_TID]
+ *	...
+ */
+
+#define PROFILE_STACKS_SZ	16384
+#define PROFILE_MAX_PROBES	64
+#define PROFILE_MAX_DEPTH	64
+
+#define PROFILE_DEF_INTERVAL	10
+
+#define LIVE_SHARDS		64
+#define LIVE_MIN_SZ		1024
+#define LIVE_TOMBSTONE		1UL
+
+#define LIFETIME_BUCKETS	65
+
+struct profile_stack {
+	unsigned long	hash;
+	unsigned long	id;
+
+	unsigned long	alloc_nr;
+	unsigned long	alloc_bytes;
+	unsigned long	free_nr;
+	unsigned long	free_bytes;
+
+	unsigned long	lifetime[LIFETIME_BUCKETS];
+
+	/* heap snapshot, under dump_lock */
+	unsigned long	snap_nr;
+	unsigned long	snap_bytes;
+	uint64_t	snap_oldest_ns;
+	int		snap_oldest_tid;
+
+	int		depth;
+	unsigned long	ips[];
+};
+
+struct live_shard {
+	pthread_mutex_t		lock;
+	struct live_ptr		*slots;
+	unsigned long		size;
+	/* live pointers */
+	unsigned long		nr;
+	/* live pointers and tombstones */
+	unsigned long		used;
+};
+
+static struct profile_stack *stacks[PROFILE_STACKS_SZ];
+static unsigned long stack_ids;
+
+/* stacks we could not capture, or could not fit in the table */
+static struct profile_stack lost_stack;
+
+static struct live_shard shards[LIVE_SHARDS] = {
+	[0 ... LIVE_SHARDS - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER },
+};
+
+static struct options *profile_opts;
+static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long dump_seq;
+static unsigned long snapshot_seq;
+
+static uint64_t clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	/* vDSO, no syscall */
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long hash_long(unsigned long val)
+{
+	val ^= val >> 33;
+	val *= 0xff51afd7ed558ccdUL;
+	val ^= val >> 33;
+	return val;
+}
+
+static unsigned long hash_stack(unsigned long *ips, int nr)
+{
+	unsigned long hash = nr;
+	int i;
+
+	for (i = 0; i < nr; i++)
+		hash = hash_long(hash ^ ips[i]);
+	return hash;
+}
+
+static int stack_equal(struct profile_stack *stack, unsigned long hash,
+		       unsigned long *ips, int nr)
+{
+	if (stack->hash != hash || stack->depth != nr)
+		return 0;
+	return !memcmp(stack->ips, ips, nr * sizeof(ips[0]));
+}
+
+static struct profile_stack *stack_get(struct options *opts,
+				       unsigned long *ips, int nr)
+{
+	unsigned long hash = hash_stack(ips, nr);
+	struct profile_stack *new = NULL;
+	int i;
+
+	if (!nr)
+		return &lost_stack;
+
+	for (i = 0; i < PROFILE_MAX_PROBES; i++) {
+		struct profile_stack **slot;
+		struct profile_stack *old;
+
+		slot = &stacks[(hash + i) & (PROFILE_STACKS_SZ - 1)];
+		old = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+		if (old) {
+			if (stack_equal(old, hash, ips, nr))
+				goto found;
+			continue;
+		}
+
+		if (!new) {
+			new = meta_alloc(sizeof(*new) + nr * sizeof(ips[0]));
+			if (!new)
+				return &lost_stack;
+
+			/* readers see the stack whole, a lost race wastes an id */
+			new->id = __atomic_add_fetch(&stack_ids, 1,
+					__ATOMIC_RELAXED);
+			new->hash = hash;
+			new->depth = nr;
+			memcpy(new->ips, ips, nr * sizeof(ips[0]));
+		}
+
+		if (__atomic_compare_exchange_n(slot, &old, new, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			output("[s:%lu]\n", new->id);
+			unwind_output_stack(opts, ips, nr);
+			return new;
+		}
+
+		/* somebody else took the slot, maybe for the same stack */
+		if (stack_equal(old, hash, ips, nr))
+			goto found;
+	}
+
+	meta_free(new);
+	return &lost_stack;
+
+found:
+	meta_free(new);
+	return __atomic_load_n(&stacks[(hash + i) & (PROFILE_STACKS_SZ - 1)],
+			__ATOMIC_ACQUIRE);
+}
+
+static struct live_shard *live_shard(unsigned long ptr, unsigned long *hash)
+{
+	*hash = hash_long(ptr);
+	return &shards[*hash & (LIVE_SHARDS - 1)];
+}
+
+static struct live_ptr *__live_lookup(struct live_shard *shard,
+				      unsigned long hash,
+				      unsigned long ptr)
+{
+	unsigned long mask = shard->size - 1;
+	unsigned long idx = (hash / LIVE_SHARDS) & mask;
+
+	while (shard->slots[idx].ptr) {
+		if (shard->slots[idx].ptr == ptr)
+			return &shard->slots[idx];
+		idx = (idx + 1) & mask;
+	}
+	return NULL;
+}
+
+static void __live_insert(struct live_shard *shard, unsigned long hash,
+			  struct live_ptr *lp)
+{
+	unsigned long mask = shard->size - 1;
+	unsigned long idx = (hash / LIVE_SHARDS) & mask;
+
+	while (shard->slots[idx].ptr > LIVE_TOMBSTONE)
+		idx = (idx + 1) & mask;
+
+	if (!shard->slots[idx].ptr)
+		shard->used++;
+	shard->slots[idx] = *lp;
+	shard->nr++;
+}
+
+/*
+ * Rehash into a new table once it's 3/4 full, this also drops the
+ * tombstones.
+ */
+static int live_grow(struct live_shard *shard)
+{
+	struct live_ptr *old = shard->slots;
+	unsigned long old_size = shard->size;
+	unsigned long size = LIVE_MIN_SZ;
+	unsigned long i;
+
+	while (size < shard->nr * 4)
+		size *= 2;
+
+	shard->slots = meta_alloc(size * sizeof(struct live_ptr));
+	if (!shard->slots) {
+		shard->slots = old;
+		return -1;
+	}
+
+	shard->size = size;
+	shard->nr = 0;
+	shard->used = 0;
+
+	for (i = 0; i < old_size; i++) {
+		unsigned long hash;
+
+		if (old[i].ptr <= LIVE_TOMBSTONE)
+			continue;
+
+		live_shard(old[i].ptr, &hash);
+		__live_insert(shard, hash, &old[i]);
+	}
+
+	meta_free(old);
+	return 0;
+}
+
+static void live_insert(struct live_ptr *new)
+{
+	unsigned long hash;
+	struct live_shard *shard = live_shard(new->ptr, &hash);
+	struct live_ptr *lp;
+
+	pthread_mutex_lock(&shard->lock);
+	if ((shard->used + 1) * 4 >= shard->size * 3 && live_grow(shard)) {
+		pthread_mutex_unlock(&shard->lock);
+		return;
+	}
+
+	/* the same address again, we missed its free() */
+	lp = __live_lookup(shard, hash, new->ptr);
+	if (lp)
+		*lp = *new;
+	else
+		__live_insert(shard, hash, new);
+	pthread_mutex_unlock(&shard->lock);
+}
+
+static int live_remove(unsigned long ptr, struct live_ptr *old)
+{
+	unsigned long hash;
+	struct live_shard *shard = live_shard(ptr, &hash);
+	struct live_ptr *lp = NULL;
+
+	pthread_mutex_lock(&shard->lock);
+	if (shard->slots)
+		lp = __live_lookup(shard, hash, ptr);
+	if (lp) {
+		*old = *lp;
+		lp->ptr = LIVE_TOMBSTONE;
+		shard->nr--;
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	return lp != NULL;
+}
+
+/*
+ * Must be called from the event top frame, a new stack adds [f:] and
+ * [s:] records to the event's output.
+ */
+void profile_alloc(struct options *opts, void *ptr, size_t size)
+{
+	unsigned long ips[PROFILE_MAX_DEPTH];
+	struct profile_stack *stack;
+	struct live_ptr lp;
+	int depth = unwind_get_depth();
+	int nr;
+
+	if (!ptr)
+		return;
+
+	if (depth > PROFILE_MAX_DEPTH)
+		depth = PROFILE_MAX_DEPTH;
+
+	nr = unwind_stack(opts, ips, depth);
+	stack = stack_get(opts, ips, nr);
+
+	__atomic_add_fetch(&stack->alloc_nr, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&stack->alloc_bytes, size, __ATOMIC_RELAXED);
+
+	lp.ptr = (unsigned long)ptr;
+	lp.stack = stack;
+	lp.size = size;
+	lp.ts_ns = clock_ns(CLOCK_MONOTONIC);
+	lp.tid = output_tid();
+	/* vDSO on most architectures */
+	lp.cpu = opts->flags & OPTS_NUMA_SAMPLE ? sched_getcpu() : -1;
+	live_insert(&lp);
+}
+
+static void account_lifetime(struct live_ptr *lp)
+{
+	uint64_t now = clock_ns(CLOCK_MONOTONIC);
+	uint64_t lifetime = now > lp->ts_ns ? now - lp->ts_ns : 0;
+	int bucket = lifetime ? 64 - __builtin_clzll(lifetime) : 0;
+
+	__atomic_add_fetch(&lp->stack->lifetime[bucket], 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * The block leaves the table before a call that may free it, like a
+ * mapping in profile_munmap_start(). Returns 1 if we knew about it,
+ * `old' is then handed to profile_free_end().
+ */
+int profile_free_start(void *ptr, struct live_ptr *old)
+{
+	if (!ptr)
+		return 0;
+
+	/* allocated before profiling has started, or lost */
+	return live_remove((unsigned long)ptr, old);
+}
+
+/*
+ * A failed call left the block in place, it goes back as it was.
+ */
+void profile_free_end(struct live_ptr *old, int failed)
+{
+	if (failed) {
+		live_insert(old);
+		return;
+	}
+
+	__atomic_add_fetch(&old->stack->free_nr, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&old->stack->free_bytes, old->size,
+			__ATOMIC_RELAXED);
+	account_lifetime(old);
+}
+
+void profile_free(void *ptr)
+{
+	struct live_ptr lp;
+
+	if (profile_free_start(ptr, &lp))
+		profile_free_end(&lp, 0);
+}
+
+/*
+ * Only unmaps from the start of a tracked mapping are accounted. If the
+ * mapping is longer, its tail stays in the table.
+ *
+ * The mapping leaves the table before the call, its address may be
+ * reused as soon as the call returns. Returns 1 if the range started a
+ * mapping we knew about, `old' is then handed to profile_munmap_end().
+ */
+int profile_munmap_start(void *addr, size_t len, struct live_ptr *old)
+{
+	if (!addr || !len)
+		return 0;
+
+	return live_remove((unsigned long)addr, old);
+}
+
+/*
+ * A failed call left the mapping in place, it goes back as it was.
+ */
+void profile_munmap_end(struct live_ptr *old, size_t len, int failed)
+{
+	size_t freed;
+
+	if (failed) {
+		live_insert(old);
+		return;
+	}
+
+	freed = ALIGN(len, (size_t)sysconf(_SC_PAGESIZE));
+	if (freed < old->size) {
+		old->ptr += freed;
+		old->size -= freed;
+		live_insert(old);
+	} else {
+		freed = old->size;
+		__atomic_add_fetch(&old->stack->free_nr, 1, __ATOMIC_RELAXED);
+		account_lifetime(old);
+	}
+
+	__atomic_add_fetch(&old->stack->free_bytes, freed, __ATOMIC_RELAXED);
+}
+
+static void dump_lifetime(struct options *opts, struct profile_stack *stack)
+{
+	int i, first = 1;
+
+	for (i = 0; i < LIFETIME_BUCKETS; i++) {
+		unsigned long nr = __atomic_load_n(&stack->lifetime[i],
+				__ATOMIC_RELAXED);
+
+		if (!nr)
+			continue;
+
+		if (first)
+			output("[L:%lu:", stack->id);
+		output("%s%d=%lu", first ? "" : ",", i, nr);
+		first = 0;
+	}
+
+	if (!first) {
+		output("]\n");
+		output_commit(opts);
+	}
+}
+
+static void dump_stack(struct options *opts, struct profile_stack *stack)
+{
+	unsigned long alloc_nr, alloc_bytes, free_nr, free_bytes;
+
+	alloc_nr = __atomic_load_n(&stack->alloc_nr, __ATOMIC_RELAXED);
+	if (!alloc_nr)
+		return;
+
+	alloc_bytes = __atomic_load_n(&stack->alloc_bytes, __ATOMIC_RELAXED);
+	free_nr = __atomic_load_n(&stack->free_nr, __ATOMIC_RELAXED);
+	free_bytes = __atomic_load_n(&stack->free_bytes, __ATOMIC_RELAXED);
+
+	/* counters are not updated atomically as a whole */
+	if (free_bytes > alloc_bytes)
+		free_bytes = alloc_bytes;
+
+	output("[P:%lu:%lu:%lu:%lu:%lu]\n", stack->id,
+			alloc_nr, alloc_bytes, free_nr,
+			alloc_bytes - free_bytes);
+	output_commit(opts);
+
+	dump_lifetime(opts, stack);
+}
+
+void profile_dump(struct options *opts)
+{
+	struct timeval tv;
+	int i;
+
+	pthread_mutex_lock(&dump_lock);
+
+	gettimeofday(&tv, NULL);
+	output("[p:%lu:%lu.%06d]\n", ++dump_seq,
+			(unsigned long)tv.tv_sec,
+			(int)tv.tv_usec);
+	output_commit(opts);
+
+	dump_stack(opts, &lost_stack);
+	for (i = 0; i < PROFILE_STACKS_SZ; i++) {
+		struct profile_stack *stack;
+
+		stack = __atomic_load_n(&stacks[i], __ATOMIC_ACQUIRE);
+		if (stack)
+			dump_stack(opts, stack);
+	}
+
+	pthread_mutex_unlock(&dump_lock);
+}
+
+static void snapshot_stack(struct options *opts, struct profile_stack *stack,
+			   uint64_t realtime_offset)
+{
+	unsigned long oldest_ms;
+
+	if (!stack->snap_nr)
+		return;
+
+	/* allocation times are monotonic, report them as wall clock time */
+	oldest_ms = (stack->snap_oldest_ns + realtime_offset) / 1000000;
+	output("[H:%lu:%lu:%lu:%lu.%03lu:%d]\n", stack->id,
+			stack->snap_nr, stack->snap_bytes,
+			oldest_ms / 1000,
+			oldest_ms % 1000,
+			stack->snap_oldest_tid);
+	output_commit(opts);
+
+	stack->snap_nr = 0;
+	stack->snap_bytes = 0;
+}
+
+/*
+ * Walk the pointer table and report live blocks grouped by the
+ * allocating stack. Shards are locked one at a time, so this is not
+ * an atomic snapshot of the whole heap, but it never stops the world.
+ */
+void profile_snapshot(struct options *opts, const char *reason)
+{
+	uint64_t realtime_offset;
+	struct timeval tv;
+	int i;
+
+	pthread_mutex_lock(&dump_lock);
+
+	for (i = 0; i < LIVE_SHARDS; i++) {
+		struct live_shard *shard = &shards[i];
+		unsigned long j;
+
+		pthread_mutex_lock(&shard->lock);
+		for (j = 0; j < shard->size; j++) {
+			struct live_ptr *lp = &shard->slots[j];
+			struct profile_stack *stack = lp->stack;
+
+			if (lp->ptr <= LIVE_TOMBSTONE)
+				continue;
+
+			if (!stack->snap_nr ||
+					lp->ts_ns < stack->snap_oldest_ns) {
+				stack->snap_oldest_ns = lp->ts_ns;
+				stack->snap_oldest_tid = lp->tid;
+			}
+			stack->snap_nr++;
+			stack->snap_bytes += lp->size;
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+
+	gettimeofday(&tv, NULL);
+	output("[h:%lu:%lu.%06d:%s]\n", ++snapshot_seq,
+			(unsigned long)tv.tv_sec,
+			(int)tv.tv_usec,
+			reason);
+	output_commit(opts);
+
+	realtime_offset = clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC);
+	snapshot_stack(opts, &lost_stack, realtime_offset);
+	for (i = 0; i < PROFILE_STACKS_SZ; i++) {
+		struct profile_stack *stack;
+
+		stack = __atomic_load_n(&stacks[i], __ATOMIC_ACQUIRE);
+		if (stack)
+			snapshot_stack(opts, stack, realtime_offset);
+	}
+
+	pthread_mutex_unlock(&dump_lock);
+}
+
+/*
+ * Copy out up to `max' live blocks of at least `min_size' bytes, so the
+ * caller can inspect them without holding the shard locks. The blocks
+ * may be gone by the time the caller looks at them.
+ */
+int profile_live_blocks(size_t min_size, struct live_block *blocks, int max)
+{
+	int i, nr = 0;
+
+	for (i = 0; i < LIVE_SHARDS && nr < max; i++) {
+		struct live_shard *shard = &shards[i];
+		unsigned long j;
+
+		pthread_mutex_lock(&shard->lock);
+		for (j = 0; j < shard->size && nr < max; j++) {
+			struct live_ptr *lp = &shard->slots[j];
+
+			if (lp->ptr <= LIVE_TOMBSTONE || lp->size < min_size)
+				continue;
+
+			blocks[nr].ptr = lp->ptr;
+			blocks[nr].size = lp->size;
+			blocks[nr].stack_id = lp->stack->id;
+			blocks[nr].tid = lp->tid;
+			blocks[nr].cpu = lp->cpu;
+			nr++;
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+
+	return nr;
+}
+
+/*
+ * The dump lock, then every shard, the order profile_snapshot() takes
+ * them in. Held across fork(), the child's pointer table is consistent.
+ */
+void profile_fork_prepare(void)
+{
+	int i;
+
+	pthread_mutex_lock(&dump_lock);
+	for (i = 0; i < LIVE_SHARDS; i++)
+		pthread_mutex_lock(&shards[i].lock);
+}
+
+static void profile_fork_unlock(void)
+{
+	int i;
+
+	for (i = LIVE_SHARDS - 1; i >= 0; i--)
+		pthread_mutex_unlock(&shards[i].lock);
+	pthread_mutex_unlock(&dump_lock);
+}
+
+void profile_fork_parent(void)
+{
+	profile_fork_unlock();
+}
+
+static void stack_reset(struct profile_stack *stack)
+{
+	stack->alloc_nr = 0;
+	stack->alloc_bytes = 0;
+	stack->free_nr = 0;
+	stack->free_bytes = 0;
+	memset(stack->lifetime, 0x00, sizeof(stack->lifetime));
+}
+
+/*
+ * In the child of a fork(). The child inherits the heap and with it the
+ * profile and the pointer table, but stacks were reported to the
+ * parent's trace file: the child's file gets them again.
+ *
+ * The parent's counters stay the parent's. The child's profile starts
+ * from the blocks it inherited, as if they were allocated at fork():
+ * ALLOCS and ALLOC_BYTES of a stack are its live blocks, so frees of
+ * those blocks in the child don't take LIVE_BYTES below zero.
+ */
+void profile_fork_child(struct options *opts)
+{
+	int i;
+
+	profile_fork_unlock();
+
+	stack_reset(&lost_stack);
+	for (i = 0; i < PROFILE_STACKS_SZ; i++) {
+		if (stacks[i])
+			stack_reset(stacks[i]);
+	}
+
+	for (i = 0; i < LIVE_SHARDS; i++) {
+		struct live_shard *shard = &shards[i];
+		unsigned long j;
+
+		for (j = 0; j < shard->size; j++) {
+			struct live_ptr *lp = &shard->slots[j];
+
+			if (lp->ptr <= LIVE_TOMBSTONE)
+				continue;
+
+			lp->stack->alloc_nr++;
+			lp->stack->alloc_bytes += lp->size;
+		}
+	}
+
+	for (i = 0; i < PROFILE_STACKS_SZ; i++) {
+		struct profile_stack *stack = stacks[i];
+
+		if (!stack)
+			continue;
+
+		output("[s:%lu]\n", stack->id);
+		unwind_output_stack(opts, stack->ips, stack->depth);
+		output_commit(opts);
+	}
+}
+
+static void profile_sample(void)
+{
+	profile_dump(profile_opts);
+}
+
+/*
+ * MTRACE_PROFILE_INTERVAL=SECONDS, 0 dumps the profile only at exit.
+ * Only the first call does anything.
+ */
+int profile_setup(struct options *opts)
+{
+	unsigned long interval = PROFILE_DEF_INTERVAL;
+
+	if (profile_opts)
+		return 0;
+
+	if (getenv("MTRACE_PROFILE_INTERVAL"))
+		interval = strtoul(getenv("MTRACE_PROFILE_INTERVAL"), NULL, 10);
+
+	profile_opts = opts;
+	if (!interval)
+		return 0;
+
+	return sampler_register(profile_sample, interval * 1000);
+}
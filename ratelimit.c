@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2017 Sergey Senozhatsky
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include <output.h>
+#include <sampler.h>
+#include <ratelimit.h>
+
+/*
+ * Per-callsite backtrace rate limiting.
+ *
+ * A busy loop that calls malloc() a million times from the same place
+ * produces a million identical backtraces in full report mode. Callsites
+ * are keyed on the return address of the interposer and hashed into a
+ * small open addressing table. Slots are claimed with a CAS and never
+ * released, so lookups need no locks.
+ *
+ * Every callsite gets its first `burst' backtraces, then one every `every'
+ * calls or every `interval' ms, whichever comes first. Suppressed calls
+ * are counted and reported as a [r:NUM] record attached to the next
+ * backtraced event of the same callsite. Callsites that go quiet are
+ * flushed by the sampler thread every `interval' ms (every second if
+ * time based backtraces are off) and at exit.
+ */
+
+#define RATELIMIT_TABLE_SZ	4096
+#define RATELIMIT_MAX_PROBES	32
+
+#define RATELIMIT_DEF_BURST	16
+#define RATELIMIT_DEF_EVERY	1024
+#define RATELIMIT_DEF_INTERVAL	1000
+
+struct callsite {
+	unsigned long	ip;
+	unsigned long	calls;
+	unsigned long	suppressed;
+	unsigned long	last_ms;
+};
+
+static struct callsite callsites[RATELIMIT_TABLE_SZ];
+
+static int enabled = 1;
+static unsigned long burst = RATELIMIT_DEF_BURST;
+static unsigned long every = RATELIMIT_DEF_EVERY;
+static unsigned long interval = RATELIMIT_DEF_INTERVAL;
+
+static struct options *ratelimit_opts;
+
+static unsigned long now_ms(void)
+{
+	struct timespec ts;
+
+	/* vDSO, no syscall */
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL;
+}
+
+static unsigned long hash_ip(unsigned long ip)
+{
+	ip ^= ip >> 33;
+	ip *= 0xff51afd7ed558ccdUL;
+	ip ^= ip >> 33;
+	return ip;
+}
+
+static struct callsite *callsite_get(unsigned long ip)
+{
+	unsigned long idx = hash_ip(ip);
+	int i;
+
+	for (i = 0; i < RATELIMIT_MAX_PROBES; i++) {
+		struct callsite *cs;
+		unsigned long old;
+
+		cs = &callsites[(idx + i) & (RATELIMIT_TABLE_SZ - 1)];
+		old = __atomic_load_n(&cs->ip, __ATOMIC_ACQUIRE);
+		if (old == ip)
+			return cs;
+		if (old != 0)
+			continue;
+
+		if (__atomic_compare_exchange_n(&cs->ip, &old, ip, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return cs;
+		if (old == ip)
+			return cs;
+	}
+
+	/* table is full around this slot */
+	return NULL;
+}
+
+static int parse_conf(const char *conf)
+{
+	char *end;
+
+	if (!strcmp(conf, "off") || !strcmp(conf, "0")) {
+		enabled = 0;
+		return 0;
+	}
+
+	burst = strtoul(conf, &end, 10);
+	if (*end == ',')
+		every = strtoul(end + 1, &end, 10);
+	if (*end == ',')
+		interval = strtoul(end + 1, &end, 10);
+
+	if (*end != 0x00) {
+		fprintf(stderr, "ERROR: malformed MTRACE_RATELIMIT: %s\n",
+				conf);
+		burst = RATELIMIT_DEF_BURST;
+		every = RATELIMIT_DEF_EVERY;
+		interval = RATELIMIT_DEF_INTERVAL;
+		return -1;
+	}
+	return 0;
+}
+
+/* the mode can be switched at runtime, only full report mode backtraces */
+static void ratelimit_sample(void)
+{
+	if (ratelimit_opts->flags & OPTS_FULL_REPORT_MODE)
+		ratelimit_flush(ratelimit_opts);
+}
+
+/*
+ * MTRACE_RATELIMIT=BURST[,EVERY[,INTERVAL_MS]] or "off", `conf' is NULL
+ * for the defaults.
+ */
+int ratelimit_setup(struct options *opts, const char *conf)
+{
+	int ret = 0;
+
+	if (conf)
+		ret = parse_conf(conf);
+
+	if (!enabled)
+		return ret;
+
+	ratelimit_opts = opts;
+	if (sampler_register(ratelimit_sample,
+			interval ? interval : RATELIMIT_DEF_INTERVAL))
+		return -1;
+	return ret;
+}
+
+/*
+ * Returns 1 if the event should be backtraced. Must be called from the
+ * event top frame, because it can add a [r:] record to the event.
+ */
+int ratelimit_check(unsigned long callsite)
+{
+	struct callsite *cs;
+	unsigned long calls, now, last, sup;
+
+	if (!enabled || !callsite)
+		return 1;
+
+	/* never lose a callsite, even if we are out of slots */
+	cs = callsite_get(callsite);
+	if (!cs)
+		return 1;
+
+	calls = __atomic_add_fetch(&cs->calls, 1, __ATOMIC_RELAXED);
+	if (calls <= burst)
+		goto trace;
+
+	if (every && calls % every == 0)
+		goto trace;
+
+	if (interval) {
+		now = now_ms();
+		last = __atomic_load_n(&cs->last_ms, __ATOMIC_RELAXED);
+		if (now - last >= interval &&
+				__atomic_compare_exchange_n(&cs->last_ms,
+					&last, now, 0,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			goto trace;
+	}
+
+	__atomic_add_fetch(&cs->suppressed, 1, __ATOMIC_RELAXED);
+	return 0;
+
+trace:
+	if (interval)
+		__atomic_store_n(&cs->last_ms, now_ms(), __ATOMIC_RELAXED);
+
+	sup = __atomic_exchange_n(&cs->suppressed, 0, __ATOMIC_RELAXED);
+	if (sup)
+		output("[r:%lu]\n", sup);
+	return 1;
+}
+
+/*
+ * Report callsites that still have suppressed events. We don't have a
+ * backtrace here, only the callsite address, so the parser matches it
+ * against the first frame of the previously seen backtraces.
+ */
+void ratelimit_flush(struct options *opts)
+{
+	int i;
+
+	if (!enabled)
+		return;
+
+	for (i = 0; i < RATELIMIT_TABLE_SZ; i++) {
+		struct callsite *cs = &callsites[i];
+		unsigned long sup;
+
+		if (!__atomic_load_n(&cs->ip, __ATOMIC_ACQUIRE))
+			continue;
+
+		sup = __atomic_exchange_n(&cs->suppressed, 0,
+				__ATOMIC_RELAXED);
+		if (!sup)
+			continue;
+
+		output("[R:%lx:%lu]\n", cs->ip, sup);
+		output_commit(opts);
+	}
+}
+
+/*
+ * In the child of a fork(). Backtraces and suppressed calls so far were
+ * reported to the parent's trace file, callsites start over.
+ */
+void ratelimit_fork_child(void)
+{
+	memset(callsites, 0x00, sizeof(callsites));
+}
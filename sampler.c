@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2017 Sergey Senozhatsky
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/prctl.h>
+
+#include "config.h"
+#include <sampler.h>
+
+/*
+ * A single background thread that runs periodic jobs: trigger polling,
+ * periodic dumps, etc. Jobs are registered during __init_mtrace() and
+ * the thread is started only if there is at least one job. A runtime
+ * mode switch may register one more job later, from a single thread,
+ * and start the thread if it's not running yet.
+ */
+
+#define SAMPLER_MAX_JOBS	16
+#define SAMPLER_MIN_SLEEP_MS	10
+
+struct sampler_job {
+	sampler_fn_t	fn;
+	unsigned long	interval_ms;
+	unsigned long	next_ms;
+};
+
+static struct sampler_job jobs[SAMPLER_MAX_JOBS];
+static int nr_jobs;
+
+static pthread_t sampler_thread;
+static void (*sampler_thread_init)(void);
+
+static unsigned long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL;
+}
+
+int sampler_register(sampler_fn_t fn, unsigned long interval_ms)
+{
+	int nr = nr_jobs;
+
+	if (nr >= SAMPLER_MAX_JOBS) {
+		fprintf(stderr, "ERROR: too many sampler jobs\n");
+		return -ENOSPC;
+	}
+
+	if (interval_ms < SAMPLER_MIN_SLEEP_MS)
+		interval_ms = SAMPLER_MIN_SLEEP_MS;
+
+	jobs[nr].fn = fn;
+	jobs[nr].interval_ms = interval_ms;
+	jobs[nr].next_ms = 0;
+	/* the sampler thread may be running */
+	__atomic_store_n(&nr_jobs, nr + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static void *sampler_fn(void *arg __attribute__((unused)))
+{
+	sigset_t set;
+
+	/* signals are for the application threads */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	prctl(PR_SET_NAME, "mtrace-sampler", 0, 0, 0);
+
+	if (sampler_thread_init)
+		sampler_thread_init();
+
+	while (1) {
+		unsigned long now = now_ms();
+		unsigned long next = now + 1000;
+		struct timespec ts;
+		int i;
+
+		for (i = 0; i < __atomic_load_n(&nr_jobs, __ATOMIC_ACQUIRE);
+				i++) {
+			struct sampler_job *job = &jobs[i];
+
+			if (job->next_ms <= now) {
+				job->fn();
+				job->next_ms = now + job->interval_ms;
+			}
+
+			if (job->next_ms < next)
+				next = job->next_ms;
+		}
+
+		now = now_ms();
+		if (next <= now)
+			continue;
+
+		ts.tv_sec = (next - now) / 1000;
+		ts.tv_nsec = ((next - now) % 1000) * 1000000;
+		nanosleep(&ts, NULL);
+	}
+
+	return NULL;
+}
+
+/*
+ * The sampler thread doesn't survive a fork(), the child starts its own.
+ */
+void sampler_fork_child(void)
+{
+	sampler_thread = 0;
+}
+
+/*
+ * thread_init() is called first thing in the sampler thread, e.g. to
+ * disable tracing of the thread itself.
+ */
+int sampler_start(void (*thread_init)(void))
+{
+	pthread_attr_t attr;
+	int ret;
+
+	if (!nr_jobs || sampler_thread)
+		return 0;
+
+	sampler_thread_init = thread_init;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	ret = pthread_create(&sampler_thread, &attr, sampler_fn, NULL);
+	pthread_attr_destroy(&attr);
+
+	if (ret) {
+		fprintf(stderr, "ERROR: unable to start sampler thread: %s\n",
+				strerror(ret));
+		sampler_thread = 0;
+	}
+	return -ret;
+}
@@ -24,6 +24,7 @@
 #include <pthread.h>
 #include <symbol_lookup.h>
 #include <output.h>
+#include <meta.h>
 
 static long max_idx = 0;
 static long symbols_sz = 400;
@@ -34,7 +35,7 @@ static pthread_rwlock_t lock;
 static void __init(void)
 {
 	if (!symbols)
-		symbols = malloc(sizeof(struct resovled_sym) * symbols_sz);
+		symbols = meta_alloc(sizeof(struct resovled_sym) * symbols_sz);
 
 	if (!symbols)
 		abort();
@@ -91,10 +92,13 @@ struct resovled_sym add_resolved_symbol(struct options *opts,
 	symbols[max_idx].end_ip = end_ip;
 	symbols[max_idx].nr = symbol_nr;
 
-	if (fn_name == UNRESOLVED_SYM_NAME)
-		symbols[max_idx].fn_name = UNRESOLVED_SYM_NAME;
-	else
-		symbols[max_idx].fn_name = strdup(fn_name);
+	symbols[max_idx].fn_name = UNRESOLVED_SYM_NAME;
+	if (start_ip != end_ip) {
+		const char *name = meta_intern(fn_name);
+
+		if (name)
+			symbols[max_idx].fn_name = (char *)name;
+	}
 
 	/* report a new resolved symbol and its seq nr */
 	if (!(opts->flags & OPTS_HUMAN_READABLE)) {
@@ -109,16 +113,20 @@ struct resovled_sym add_resolved_symbol(struct options *opts,
 	if (max_idx >= symbols_sz - 1) {
 		void *new_table;
 
-		symbols_sz += symbols_sz / 2;
-		new_table = realloc(symbols,
-				symbols_sz * sizeof(struct resovled_sym));
+		new_table = meta_realloc(symbols, (symbols_sz + symbols_sz / 2) *
+				sizeof(struct resovled_sym));
 
-		if (!new_table)
-			abort();
+		/* out of metadata, the symbol is reported again next time */
+		if (!new_table) {
+			max_idx--;
+			goto out;
+		}
+		symbols_sz += symbols_sz / 2;
 		symbols = new_table;
 	}
 
 	qsort(symbols, max_idx - 1, sizeof(struct resovled_sym), sym_compare);
+out:
 	pthread_rwlock_unlock(&lock);
 
 	return s;
@@ -141,6 +149,44 @@ struct resovled_sym lookup_resolved_symbol(unsigned long ip)
 	return s;
 }
 
+/*
+ * Write locked across fork(), the child never sees a symbol half
+ * added.
+ */
+void symbol_lookup_fork_prepare(void)
+{
+	pthread_rwlock_wrlock(&lock);
+}
+
+void symbol_lookup_fork_parent(void)
+{
+	pthread_rwlock_unlock(&lock);
+}
+
+/*
+ * In the child of a fork(). Symbols were reported to the parent's trace
+ * file, the child's file gets them again. The rwlock remembers its
+ * writer by tid and the child has a new one, so it starts over rather
+ * than being unlocked.
+ */
+void symbol_lookup_fork_child(struct options *opts)
+{
+	long idx;
+
+	if (pthread_rwlock_init(&lock, NULL) != 0)
+		abort();
+
+	if (opts->flags & OPTS_HUMAN_READABLE)
+		return;
+
+	for (idx = 0; idx < max_idx; idx++) {
+		output("[f:%ld][%x-%x][%s]\n", symbols[idx].nr,
+				symbols[idx].start_ip, symbols[idx].end_ip,
+				symbols[idx].fn_name);
+		output_commit(opts);
+	}
+}
+
 /*
  * This is early init. Do not allocate dynamic buffers here, since
  * we are still in __init mode.
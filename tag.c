@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2017 Sergey Senozhatsky
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "config.h"
+#include <output.h>
+#include <meta.h>
+#include <tag.h>
+
+/*
+ * Application tags (see mtrace.h).
+ *
+ * Tag names are interned into a table of CAS-claimed slots, like call
+ * stacks in profile.c. A new tag is reported once:
+ *	[tag:ID:NAME]
+ * traced events of a tagged thread carry a [T:ID] record, and marks are
+ *	[mark:ID:SEC.USEC]
+ */
+
+#define TAG_TABLE_SZ	4096
+#define TAG_MAX_PROBES	64
+#define TAG_NAME_SZ	64
+
+struct tag {
+	unsigned long	hash;
+	int		id;
+	char		name[TAG_NAME_SZ];
+};
+
+__thread int tag_stack[TAG_MAX_DEPTH];
+__thread int tag_depth;
+
+static struct tag *tags[TAG_TABLE_SZ];
+static int tag_ids;
+
+static unsigned long hash_name(const char *name)
+{
+	unsigned long hash = 5381;
+
+	while (*name)
+		hash = hash * 33 + (unsigned char)*name++;
+	return hash;
+}
+
+/*
+ * Called with tracing disabled. Returns 0 if the table is full.
+ */
+int tag_get(struct options *opts, const char *name)
+{
+	unsigned long hash = hash_name(name);
+	struct tag *new = NULL;
+	int i;
+
+	for (i = 0; i < TAG_MAX_PROBES; i++) {
+		struct tag **slot = &tags[(hash + i) & (TAG_TABLE_SZ - 1)];
+		struct tag *old = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+
+		if (old) {
+			if (old->hash == hash && !strncmp(old->name, name,
+						TAG_NAME_SZ - 1))
+				goto found;
+			continue;
+		}
+
+		if (!new) {
+			new = meta_alloc(sizeof(*new));
+			if (!new)
+				return 0;
+
+			/* readers see the tag whole, a lost race wastes an id */
+			new->id = __atomic_add_fetch(&tag_ids, 1,
+					__ATOMIC_RELAXED);
+			new->hash = hash;
+			strncpy(new->name, name, TAG_NAME_SZ - 1);
+		}
+
+		if (__atomic_compare_exchange_n(slot, &old, new, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			output("[tag:%d:%s]\n", new->id, new->name);
+			output_commit(opts);
+			return new->id;
+		}
+
+		/* somebody else took the slot, maybe for the same tag */
+		if (old->hash == hash && !strncmp(old->name, name,
+					TAG_NAME_SZ - 1))
+			goto found;
+	}
+
+	meta_free(new);
+	return 0;
+
+found:
+	meta_free(new);
+	return __atomic_load_n(&tags[(hash + i) & (TAG_TABLE_SZ - 1)],
+			__ATOMIC_ACQUIRE)->id;
+}
+
+void tag_mark(struct options *opts, const char *name)
+{
+	struct timeval tv;
+	int id = tag_get(opts, name);
+
+	if (!id)
+		return;
+
+	gettimeofday(&tv, NULL);
+	output("[mark:%d:%lu.%06d]\n", id,
+			(unsigned long)tv.tv_sec,
+			(int)tv.tv_usec);
+	output_commit(opts);
+}
@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2017 Sergey Senozhatsky
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+
+#include "config.h"
+#include <output.h>
+#include <control.h>
+#include <sampler.h>
+#include <unwind_trace.h>
+#include <trigger.h>
+
+/*
+ * Trigger-armed tracing.
+ *
+ * If any trigger is configured we start disarmed: CTL_DISARMED sends
+ * every event straight to glibc, same as disabled tracing. Triggers are
+ * polled by the sampler thread, so the per-event cost is the usual
+ * mtrace_ctl check. Once a trigger fires we arm, optionally raise the
+ * backtrace depth and, if a window is configured, disarm again when it
+ * expires.
+ */
+
+#define TRIGGER_DEF_INTERVAL	100
+
+static struct options *trigger_opts;
+
+static unsigned long rss_limit;
+static unsigned long cgroup_pct;
+static double psi_limit;
+static unsigned long timer_sec;
+static unsigned long window_sec;
+static int armed_depth = -1;
+static int saved_depth = -1;
+
+static char cgroup_current[PATH_MAX];
+static char cgroup_max[PATH_MAX];
+
+static unsigned long start_sec;
+static unsigned long window_end;
+
+static unsigned long now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static ssize_t read_file(const char *path, char *buf, size_t sz)
+{
+	ssize_t num_read;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	do {
+		num_read = read(fd, buf, sz - 1);
+	} while (num_read < 0 && errno == EINTR);
+	close(fd);
+
+	if (num_read < 0)
+		return -1;
+	buf[num_read] = 0x00;
+	return num_read;
+}
+
+static unsigned long read_ulong(const char *path)
+{
+	char buf[64];
+
+	if (read_file(path, buf, sizeof(buf)) <= 0)
+		return 0;
+	/* "max" reads as 0, meaning no limit */
+	return strtoul(buf, NULL, 10);
+}
+
+/*
+ * cgroup v2 has a single "0::/path" line in /proc/self/cgroup
+ */
+static int cgroup_setup(void)
+{
+	char buf[PATH_MAX];
+	char *path;
+
+	if (read_file("/proc/self/cgroup", buf, sizeof(buf)) <= 0)
+		return -1;
+
+	path = strstr(buf, "0::");
+	if (!path)
+		return -1;
+	path += 3;
+	path[strcspn(path, "\n")] = 0x00;
+
+	snprintf(cgroup_current, sizeof(cgroup_current),
+			"/sys/fs/cgroup%s/memory.current", path);
+	snprintf(cgroup_max, sizeof(cgroup_max),
+			"/sys/fs/cgroup%s/memory.max", path);
+
+	if (access(cgroup_current, R_OK))
+		return -1;
+	return 0;
+}
+
+static int rss_fired(void)
+{
+	unsigned long mem[2] = {0, 0};
+	char buf[64];
+
+	if (read_file("/proc/self/statm", buf, sizeof(buf)) <= 0)
+		return 0;
+	sscanf(buf, "%lu %lu", &mem[0], &mem[1]);
+
+	if (mem[1] * sysconf(_SC_PAGESIZE) < rss_limit)
+		return 0;
+
+	output("[trig:rss %lu]\n", mem[1] * sysconf(_SC_PAGESIZE));
+	return 1;
+}
+
+static int cgroup_fired(void)
+{
+	unsigned long cur, max;
+
+	max = read_ulong(cgroup_max);
+	if (!max)
+		return 0;
+
+	cur = read_ulong(cgroup_current);
+	if (cur * 100 < max * cgroup_pct)
+		return 0;
+
+	output("[trig:cgroup %lu/%lu]\n", cur, max);
+	return 1;
+}
+
+/*
+ * some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+ * full avg10=0.00 avg60=0.00 avg300=0.00 total=0
+ */
+static int psi_fired(void)
+{
+	char buf[256];
+	double avg10;
+
+	if (read_file("/proc/pressure/memory", buf, sizeof(buf)) <= 0)
+		return 0;
+
+	if (sscanf(buf, "some avg10=%lf", &avg10) != 1)
+		return 0;
+	if (avg10 < psi_limit)
+		return 0;
+
+	output("[trig:psi %.2f]\n", avg10);
+	return 1;
+}
+
+static int timer_fired(void)
+{
+	if (now_sec() - start_sec < timer_sec)
+		return 0;
+
+	output("[trig:timer %lu]\n", timer_sec);
+	return 1;
+}
+
+void trigger_arm(int arm)
+{
+	if (arm) {
+		if (armed_depth >= 0) {
+			saved_depth = unwind_get_depth();
+			unwind_set_depth(armed_depth);
+		}
+
+		window_end = window_sec ? now_sec() + window_sec : 0;
+		__atomic_and_fetch(&mtrace_ctl, ~CTL_DISARMED,
+				__ATOMIC_RELAXED);
+	} else {
+		__atomic_or_fetch(&mtrace_ctl, CTL_DISARMED,
+				__ATOMIC_RELAXED);
+
+		if (saved_depth >= 0) {
+			unwind_set_depth(saved_depth);
+			saved_depth = -1;
+		}
+		window_end = 0;
+	}
+}
+
+static void trigger_poll(void)
+{
+	int fired = 0;
+
+	if (!(mtrace_ctl & CTL_DISARMED)) {
+		if (!window_end || now_sec() < window_end)
+			return;
+
+		output("[trig:window expired]\n");
+		output_commit(trigger_opts);
+		trigger_arm(0);
+		/* the timer trigger fires only once */
+		timer_sec = 0;
+		return;
+	}
+
+	if (rss_limit)
+		fired = rss_fired();
+	if (!fired && cgroup_pct)
+		fired = cgroup_fired();
+	if (!fired && psi_limit > 0)
+		fired = psi_fired();
+	if (!fired && timer_sec)
+		fired = timer_fired();
+
+	if (fired) {
+		output_commit(trigger_opts);
+		trigger_arm(1);
+	}
+}
+
+int trigger_setup(struct options *opts)
+{
+	unsigned long interval = TRIGGER_DEF_INTERVAL;
+
+	if (getenv("MTRACE_TRIGGER_RSS"))
+		rss_limit = memparse(getenv("MTRACE_TRIGGER_RSS"));
+
+	if (getenv("MTRACE_TRIGGER_CGROUP")) {
+		cgroup_pct = strtoul(getenv("MTRACE_TRIGGER_CGROUP"), NULL, 10);
+		if (cgroup_pct && cgroup_setup()) {
+			fprintf(stderr, "ERROR: cgroup v2 memory controller "
+					"is not available\n");
+			cgroup_pct = 0;
+		}
+	}
+
+	if (getenv("MTRACE_TRIGGER_PSI"))
+		psi_limit = strtod(getenv("MTRACE_TRIGGER_PSI"), NULL);
+
+	if (getenv("MTRACE_TRIGGER_TIMER"))
+		timer_sec = strtoul(getenv("MTRACE_TRIGGER_TIMER"), NULL, 10);
+
+	if (!rss_limit && !cgroup_pct && psi_limit <= 0 && !timer_sec)
+		return 0;
+
+	if (getenv("MTRACE_TRIGGER_WINDOW"))
+		window_sec = strtoul(getenv("MTRACE_TRIGGER_WINDOW"), NULL, 10);
+
+	if (getenv("MTRACE_TRIGGER_DEPTH"))
+		armed_depth = atoi(getenv("MTRACE_TRIGGER_DEPTH"));
+
+	if (getenv("MTRACE_TRIGGER_INTERVAL"))
+		interval = strtoul(getenv("MTRACE_TRIGGER_INTERVAL"), NULL, 10);
+
+	trigger_opts = opts;
+	start_sec = now_sec();
+
+	trigger_arm(0);
+	return sampler_register(trigger_poll, interval);
+}
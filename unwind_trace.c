@@ -25,6 +25,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <link.h>
 
 #ifndef UNW_LOCAL_ONLY
 #define UNW_LOCAL_ONLY
@@ -41,6 +43,11 @@ static int skip_frames = 2;
 static int unwind_depth = UNWIND_DEPTH;
 
 static volatile __thread int recursion;
+static __thread char fn_name[MAX_FN_NAME_BUF_SZ];
+
+/* libmtrace's own text, see unwind_stack() */
+static unsigned long self_text_start;
+static unsigned long self_text_end;
 
 static int output_frame(struct options *opts,
 			unw_word_t ip,
@@ -55,7 +62,7 @@ static int output_frame(struct options *opts,
 		output("#%x#%ld#%x\n",
 				ip, sym->nr, offset);
 
-	return sym->fn_name == UNRESOLVED_SYM_NAME;
+	return symbol_unresolved(sym);
 }
 
 void unwind_set_depth(int __depth)
@@ -63,9 +70,58 @@ void unwind_set_depth(int __depth)
 	unwind_depth = __depth;
 }
 
+int unwind_get_depth(void)
+{
+	return unwind_depth;
+}
+
+/*
+ * Look up the symbol of the frame, resolving it (and reporting it as
+ * a [f:] record) the first time we see it.
+ */
+static int resolve_frame(struct options *opts,
+			 unw_cursor_t *cursor,
+			 unw_word_t ip,
+			 struct resovled_sym *symbol)
+{
+	unsigned long offset;
+	unw_proc_info_t pip;
+	int rc;
+
+	/*
+	 * unw_get_proc_name() is really-really-really slow. because
+	 * for every IP resolution it opens a ELF file, parses it's
+	 * symtabs, then lookups for the symbol.
+	 *
+	 * what we do here is a lazy hashing. we don't read/parse/store
+	 * all symbols from every ELF that process has opened. instead
+	 * we keep only symbols that were resolved during previous stack
+	 * unwind operations - backtraces quite often contain similar
+	 * frames.
+	 */
+	*symbol = lookup_resolved_symbol(ip);
+	if (symbol->start_ip != 0)
+		return 0;
+
+	rc = unw_get_proc_name(cursor, fn_name,
+			sizeof(fn_name),
+			(unw_word_t *) &offset);
+	if (rc == 0) {
+		if (unw_get_proc_info(cursor, &pip) != 0)
+			return -1;
+
+		*symbol = add_resolved_symbol(opts,
+					pip.start_ip,
+					pip.end_ip,
+					fn_name);
+	} else {
+		add_resolved_symbol(opts, ip, ip, UNRESOLVED_SYM_NAME);
+	}
+	return 0;
+}
+
 void unwind_trace(struct options *opts)
 {
-	static __thread char fn_name[MAX_FN_NAME_BUF_SZ] = {0,};
 	int depth = unwind_depth;
 	unw_cursor_t cursor; unw_context_t uc;
 	int frame_nr = 0;
@@ -90,9 +146,7 @@ void unwind_trace(struct options *opts)
 
 	while (depth) {
 		unw_word_t ip;
-		unsigned long offset;
 		int should_break = 0;
-		unw_proc_info_t pip;
 		struct resovled_sym symbol;
 
 		int rc = unw_get_reg(&cursor, UNW_REG_IP, &ip);
@@ -110,37 +164,8 @@ void unwind_trace(struct options *opts)
 		if (frame_nr <= skip_frames)
 			goto cont;
 
-		/*
-		 * unw_get_proc_name() is really-really-really slow. because
-		 * for every IP resolution it opens a ELF file, parses it's
-		 * symtabs, then lookups for the symbol.
-		 *
-		 * what we do here is a lazy hashing. we don't read/parse/store
-		 * all symbols from every ELF that process has opened. instead
-		 * we keep only symbols that were resolved during previous stack
-		 * unwind operations - backtraces quite often contain similar
-		 * frames.
-		 */
-		symbol = lookup_resolved_symbol(ip);
-		if (symbol.start_ip != 0) {
-			should_break = output_frame(opts, ip, &symbol);
-			goto cont;
-		}
-
-		rc = unw_get_proc_name(&cursor, fn_name,
-				sizeof(fn_name),
-				(unw_word_t *) &offset);
-		if (rc == 0) {
-			if (unw_get_proc_info(&cursor, &pip) != 0)
-				break;
-
-			symbol = add_resolved_symbol(opts,
-						pip.start_ip,
-						pip.end_ip,
-						fn_name);
-		} else {
-			add_resolved_symbol(opts, ip, ip, UNRESOLVED_SYM_NAME);
-		}
+		if (resolve_frame(opts, &cursor, ip, &symbol) != 0)
+			break;
 
 		should_break = output_frame(opts, ip, &symbol);
 
@@ -155,6 +180,102 @@ cont:
 	recursion--;
 }
 
+static int self_text_cb(struct dl_phdr_info *info,
+			size_t size __attribute__((unused)), void *data)
+{
+	unsigned long self = (unsigned long)data;
+	unsigned long start = ULONG_MAX, end = 0;
+	int i;
+
+	for (i = 0; i < info->dlpi_phnum; i++) {
+		const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+		unsigned long seg;
+
+		if (phdr->p_type != PT_LOAD || !(phdr->p_flags & PF_X))
+			continue;
+
+		seg = info->dlpi_addr + phdr->p_vaddr;
+		if (seg < start)
+			start = seg;
+		if (seg + phdr->p_memsz > end)
+			end = seg + phdr->p_memsz;
+	}
+
+	if (self < start || self >= end)
+		return 0;
+
+	self_text_start = start;
+	self_text_end = end;
+	return 1;
+}
+
+/*
+ * Capture up to `max' return addresses of the current stack, starting
+ * from the first frame outside of libmtrace, so that the same call path
+ * always gives the same IPs no matter how the interposer was inlined.
+ * Frames are resolved as in unwind_trace(), but not printed.
+ */
+int unwind_stack(struct options *opts, unsigned long *ips, int max)
+{
+	unw_cursor_t cursor; unw_context_t uc;
+	int nr = 0;
+
+	if (recursion)
+		return 0;
+	recursion++;
+
+	if (!self_text_end)
+		dl_iterate_phdr(self_text_cb, (void *)unwind_stack);
+
+	if (unw_getcontext(&uc) != 0)
+		goto out;
+
+	if (unw_init_local(&cursor, &uc) != 0)
+		goto out;
+
+	while (nr < max) {
+		struct resovled_sym symbol;
+		unw_word_t ip;
+
+		if (unw_get_reg(&cursor, UNW_REG_IP, &ip) != 0)
+			break;
+
+		if (maps_cache_lookup(ip) != 0)
+			break;
+
+		if (nr || ip < self_text_start || ip >= self_text_end) {
+			if (resolve_frame(opts, &cursor, ip, &symbol) != 0)
+				break;
+
+			ips[nr++] = ip;
+			if (symbol_unresolved(&symbol))
+				break;
+		}
+
+		if (unw_step(&cursor) <= 0)
+			break;
+	}
+
+out:
+	recursion--;
+	return nr;
+}
+
+/*
+ * Print a stack captured by unwind_stack(), all of its symbols are
+ * already resolved.
+ */
+void unwind_output_stack(struct options *opts, unsigned long *ips, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		struct resovled_sym symbol = lookup_resolved_symbol(ips[i]);
+
+		output_frame(opts, ips[i], &symbol);
+	}
+}
+
 void unwind_flush_cache(void)
 {
 	unw_flush_cache(unw_local_addr_space, 0, 0);